@@ -0,0 +1,103 @@
+#pragma once
+
+// Per-thread heap allocation counter for the frame path.
+//
+// Build with ESP_DOC_COUNT_ALLOCATIONS defined and expand
+// ESP_DOC_DEFINE_ALLOCATION_HOOKS once in the executable's main .cpp. That
+// replaces the global operator new and installs a cv::Mat allocator, and
+// both count into thread-local totals. Without the define every call
+// compiles to nothing.
+//
+// Counts cover the calling thread only. OpenCV's own parallel_for_ workers
+// and the library's internal scratch buffers (bilateralFilter borders,
+// Canny maps, filter engines, findContours storage) are outside our
+// control; AllocationScope reports them but only buffers we own can be
+// required to stay put (see DetectorWorkspace::fingerprint()).
+
+#include <opencv2/core.hpp>
+
+#ifdef ESP_DOC_COUNT_ALLOCATIONS
+#include <cstdlib>
+#include <new>
+
+namespace alloccount {
+    inline unsigned long long& heapCount() {
+        static thread_local unsigned long long count = 0;
+        return count;
+    }
+
+    inline unsigned long long& matCount() {
+        static thread_local unsigned long long count = 0;
+        return count;
+    }
+
+    // Forwards to OpenCV's standard allocator and counts new Mat buffers
+    class CountingMatAllocator : public cv::MatAllocator {
+    public:
+        CountingMatAllocator() : inner(cv::Mat::getStdAllocator()) {}
+
+        cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+            cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override {
+            if (data == 0) matCount()++;
+            return inner->allocate(dims, sizes, type, data, step, flags, usageFlags);
+        }
+
+        bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override {
+            return inner->allocate(data, accessFlags, usageFlags);
+        }
+
+        void deallocate(cv::UMatData* data) const override {
+            inner->deallocate(data);
+        }
+
+    private:
+        cv::MatAllocator* inner;
+    };
+
+    inline void install() {
+        static CountingMatAllocator allocator;
+        cv::Mat::setDefaultAllocator(&allocator);
+    }
+}
+
+#define ESP_DOC_DEFINE_ALLOCATION_HOOKS                                                       \
+    void* operator new(std::size_t size) {                                                  \
+        alloccount::heapCount()++;                                                          \
+        if (void* p = std::malloc(size ? size : 1)) return p;                               \
+        throw std::bad_alloc();                                                             \
+    }                                                                                       \
+    void* operator new[](std::size_t size) { return operator new(size); }                   \
+    void operator delete(void* p) noexcept { std::free(p); }                                \
+    void operator delete[](void* p) noexcept { std::free(p); }                              \
+    void operator delete(void* p, std::size_t) noexcept { std::free(p); }                   \
+    void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+// Snapshot of this thread's counters; read the difference after a frame
+class AllocationScope {
+public:
+    AllocationScope() : heapStart(alloccount::heapCount()), matStart(alloccount::matCount()) {}
+    unsigned long long heapAllocations() const { return alloccount::heapCount() - heapStart; }
+    unsigned long long matAllocations() const { return alloccount::matCount() - matStart; }
+
+private:
+    unsigned long long heapStart;
+    unsigned long long matStart;
+};
+
+#define ESP_DOC_ALLOCATION_COUNTING 1
+#else
+
+namespace alloccount {
+    inline void install() {}
+}
+
+#define ESP_DOC_DEFINE_ALLOCATION_HOOKS
+
+class AllocationScope {
+public:
+    unsigned long long heapAllocations() const { return 0; }
+    unsigned long long matAllocations() const { return 0; }
+};
+
+#define ESP_DOC_ALLOCATION_COUNTING 0
+#endif
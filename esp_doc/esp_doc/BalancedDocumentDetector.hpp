@@ -0,0 +1,441 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+#include "Config.hpp"
+#include "DetectorEngine.hpp"
+#include "FastPreprocess.hpp"
+#include "Metrics.hpp"
+
+// Tests of the contour candidate cascade, cheapest first. A rejected
+// contour is charged to the first test it fails.
+enum class ContourTest {
+    Points,         // fewer than 4 points, no quad can come out of it
+    Box,            // bounding box smaller than minArea (the contour can't be larger)
+    Area,           // contourArea outside minArea..maxArea
+    Corners,        // approxPolyDP did not give 4 corners
+    Aspect,         // quad bounding box outside 1:5..5:1
+    Margin,         // a corner in the frame margin
+    Convexity,      // quad not convex
+    Count
+};
+
+inline const char* contourTestName(ContourTest t) {
+    static const char* names[] = { "points", "box", "area", "corners", "aspect", "margin", "convexity" };
+    return names[(int)t];
+}
+
+// What the cascade did with the contours of one or more frames
+struct ContourStats {
+    unsigned long long contours;        // evaluated
+    unsigned long long accepted;
+    unsigned long long rejected[(int)ContourTest::Count];
+
+    ContourStats() { reset(); }
+
+    void reset() {
+        contours = 0;
+        accepted = 0;
+        for (int i = 0; i < (int)ContourTest::Count; i++) rejected[i] = 0;
+    }
+
+    void add(const ContourStats& other) {
+        contours += other.contours;
+        accepted += other.accepted;
+        for (int i = 0; i < (int)ContourTest::Count; i++) rejected[i] += other.rejected[i];
+    }
+};
+
+// Buffers for one detection pipeline. Allocated on the first frame and
+// reused afterwards; every stage writes into its own member so no
+// temporaries are created per frame.
+struct DetectorWorkspace {
+    cv::Mat gray, enhanced, blurred, edges, dilated, morph;
+    cv::Mat hsv, mask1, mask2, paperMask, paperOpen;
+    cv::Mat pyramid[kMaxDetectionLevel];    // pyramid[i] = frame pyrDown'ed i + 1 times
+    cv::Mat fullGray;                       // full-resolution gray for corner refinement
+    cv::Ptr<cv::CLAHE> clahe;
+    GuidedSmoother smoother;            // fastProcessing stand-in for the bilateral filter
+    cv::Mat kernel;                     // 3x3 rect
+    cv::Mat dilateKernel;               // 5x5 rect = two 3x3 dilations
+    cv::Mat closeKernel;                // 15x15 rect for the paper mask
+
+    std::vector<std::vector<cv::Point> > contours;
+    std::vector<cv::Vec4i> hierarchy;
+    std::vector<cv::Point> approx;      // evaluateContour output for findBestDocument
+    std::vector<cv::Point> best;
+    std::vector<cv::Point2f> corners;
+    std::vector<std::vector<cv::Point> > quads;     // findDocuments candidates
+    std::vector<double> quadAreas;
+    std::vector<int> quadOrder;
+    std::vector<cv::Point2f> overlapA, overlapB, overlap;
+
+    DetectorWorkspace() {
+        clahe = cv::createCLAHE(2.0, cv::Size(8, 8));
+        kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
+        dilateKernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(5, 5));
+        closeKernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(15, 15));
+        approx.reserve(64);
+        best.reserve(4);
+        corners.reserve(4);
+    }
+
+    // Sum of the image buffer addresses. Stays constant once the frame size
+    // is stable; a change means some stage reallocated.
+    size_t fingerprint() const {
+        const cv::Mat* mats[] = { &gray, &enhanced, &blurred, &edges, &dilated, &morph,
+                                  &hsv, &mask1, &mask2, &paperMask, &paperOpen, &fullGray,
+                                  &pyramid[0], &pyramid[1], &pyramid[2] };
+        size_t sum = smoother.fingerprint();
+        for (size_t i = 0; i < sizeof(mats) / sizeof(mats[0]); i++) {
+            sum += (size_t)mats[i]->data;
+        }
+        return sum;
+    }
+};
+
+// BALANCED document detection - fast but accurate
+// The "contour" engine: CLAHE, bilateral, Canny, morphology and the paper
+// mask, then the outer contours fitted to quads. Robust on cluttered and
+// dim scenes; the cost is in the preprocessing.
+class BalancedDocumentDetector : public DetectorEngine {
+private:
+    Config config;
+    DetectorWorkspace ws;
+    int activeLevel;                    // pyramid level of the image being searched
+    int lastLevel;                      // level the last detect() ran on
+    unsigned int preprocessCalls;
+    ContourStats lastContours;          // the last findBestDocument()/findDocuments() call
+    ContourStats totalContours;
+    DetectorCost totalCost;
+
+public:
+    BalancedDocumentDetector(const Config& cfg) : config(cfg), activeLevel(0), lastLevel(0), preprocessCalls(0) {}
+
+    const char* name() const { return "contour"; }
+
+    const DetectorWorkspace& workspace() const { return ws; }
+    size_t workspaceFingerprint() const { return ws.fingerprint(); }
+
+    DetectorCost cost() const {
+        DetectorCost c = totalCost;
+        c.candidates = totalContours.contours;
+        c.accepted = totalContours.accepted;
+        return c;
+    }
+
+    // Candidate cascade counts of the last contour search, and since construction
+    const ContourStats& lastContourStats() const { return lastContours; }
+    const ContourStats& contourStats() const { return totalContours; }
+
+    // Runtime knobs for the QoS controller; take effect on the next frame
+    void setDetectionLevel(int level) { config.detectionPyramidLevel = level; }
+    void setFastProcessing(bool fast) { config.fastProcessing = fast; }
+    void setColorDetection(bool color) { config.useColorDetection = color; }
+
+    // Full-resolution gray of the last detect() frame. Valid when that call
+    // found a document (on pyramid levels it is only made for refinement).
+    const cv::Mat& frameGray() const { return lastLevel > 0 ? ws.fullGray : ws.gray; }
+
+    // BALANCED preprocessing - fast but thorough
+    // Returns a view of the workspace; valid until the next call
+    const cv::Mat& balancedPreprocess(const cv::Mat& img) {
+        // Convert to grayscale
+        cv::cvtColor(img, ws.gray, cv::COLOR_BGR2GRAY);
+
+        // RESTORED: CLAHE for better contrast (essential for detection),
+        // then the bilateral filter for noise reduction. fastProcessing: a
+        // guided filter instead of the bilateral (FastPreprocess.hpp;
+        // tools/bench.cpp checks it against this path)
+        ws.clahe->apply(ws.gray, ws.enhanced);
+        if (config.fastProcessing) {
+            ws.smoother.apply(ws.enhanced, ws.blurred);
+        }
+        else {
+            cv::bilateralFilter(ws.enhanced, ws.blurred, 5, 50, 50); // Faster than original
+        }
+
+        // Multi-scale edge detection in one pass. The edges found at
+        // (cannyLow, cannyHigh) are always a subset of those at half the
+        // thresholds (every weak/strong pixel stays weak/strong, so every
+        // hysteresis chain survives), so OR-ing both maps equals the
+        // half-threshold map alone.
+        cv::Canny(ws.blurred, ws.edges, config.cannyLow / 2, config.cannyHigh / 2);
+
+        // Morphology: dilate(3x3) x2, erode(3x3), close(3x3) collapses to
+        // erode3(dilate5). The first three steps are close3(dilate3(X)) and
+        // closing is idempotent, so the trailing close changes nothing.
+        // OpenCV runs both rect kernels as separable, vectorized min/max.
+        cv::dilate(ws.edges, ws.dilated, ws.dilateKernel);
+        cv::erode(ws.dilated, ws.morph, ws.kernel);
+
+#ifndef NDEBUG
+        // Spot-check against the original chain now and then
+        if (preprocessCalls++ % 64 == 0) {
+            assert(matchesLegacyEdgeChain(ws.blurred, ws.morph));
+        }
+#endif
+
+        return ws.morph;
+    }
+
+    // The chain balancedPreprocess() replaced: two Canny passes OR-ed, then
+    // dilate x2, erode, close. Used to validate the fused version.
+    bool matchesLegacyEdgeChain(const cv::Mat& blurred, const cv::Mat& fused) const {
+        cv::Mat e1, e2, edges, morph;
+        cv::Canny(blurred, e1, config.cannyLow, config.cannyHigh);
+        cv::Canny(blurred, e2, config.cannyLow / 2, config.cannyHigh / 2);
+        cv::bitwise_or(e1, e2, edges);
+        cv::dilate(edges, morph, ws.kernel, cv::Point(-1, -1), 2);
+        cv::erode(morph, edges, ws.kernel, cv::Point(-1, -1), 1);
+        cv::morphologyEx(edges, morph, cv::MORPH_CLOSE, ws.kernel);
+        return cv::norm(morph, fused, cv::NORM_INF) == 0;
+    }
+
+    // RESTORED: Color-based paper detection (critical for documents)
+    // Returns a view of the workspace; valid until the next call
+    const cv::Mat& detectPaper(const cv::Mat& img) {
+        cv::cvtColor(img, ws.hsv, cv::COLOR_BGR2HSV);
+
+        // White paper range in HSV
+        cv::inRange(ws.hsv, cv::Scalar(0, 0, config.paperMinValue), cv::Scalar(180, config.paperMaxSaturation, 255), ws.mask1);
+
+        // Light colored surfaces
+        cv::inRange(ws.hsv, cv::Scalar(0, 0, config.lightMinValue), cv::Scalar(180, config.lightMaxSaturation, 255), ws.mask2);
+
+        cv::bitwise_or(ws.mask1, ws.mask2, ws.paperMask);
+
+        // Morphological operations to clean up
+        cv::morphologyEx(ws.paperMask, ws.paperOpen, cv::MORPH_OPEN, ws.kernel);
+        cv::morphologyEx(ws.paperOpen, ws.paperMask, cv::MORPH_CLOSE, ws.closeKernel);
+
+        return ws.paperMask;
+    }
+
+    static std::vector<cv::Point> reorderPoints(const std::vector<cv::Point>& pts) {
+        if (pts.size() != 4) return pts;
+
+        cv::Point ordered[4];
+        orderQuadCorners(pts, ordered);
+        return std::vector<cv::Point>(ordered, ordered + 4);
+    }
+
+    // IMPROVED: Better validation for smaller resolution
+    // minArea/maxArea and the margin are in capture pixels and shrink with the level
+    //
+    // Candidate cascade: every feature of the contour is computed once and
+    // the tests run cheapest first, so the bulk of a cluttered frame (specks
+    // and text fragments) is dropped before arcLength/approxPolyDP. Aspect,
+    // margin and convexity are defined on the fitted quad and cost O(1)
+    // there. On success `quad` holds the fitted corners and `quadArea`
+    // their area; a rejection is counted in `stats`.
+    bool evaluateContour(const std::vector<cv::Point>& contour, const cv::Size& imgSize,
+        std::vector<cv::Point>& quad, double& quadArea, ContourStats& stats) {
+        stats.contours++;
+        if (contour.size() < 4) return reject(stats, ContourTest::Points);
+
+        double levelArea = (double)(1 << (2 * activeLevel));
+        double minArea = config.minArea / levelArea;
+        cv::Rect box = cv::boundingRect(contour);
+        if ((double)box.width * box.height < minArea) return reject(stats, ContourTest::Box);
+
+        double area = cv::contourArea(contour);
+        if (area < minArea || area > config.maxArea / levelArea) return reject(stats, ContourTest::Area);
+
+        cv::approxPolyDP(contour, quad, config.epsilonFactor * cv::arcLength(contour, true), true);
+        if (quad.size() != 4) return reject(stats, ContourTest::Corners);
+
+        // Check aspect ratio (should be reasonable for documents)
+        cv::Rect bbox = cv::boundingRect(quad);
+        double aspectRatio = (double)bbox.width / bbox.height;
+        if (aspectRatio < 0.2 || aspectRatio > 5.0) return reject(stats, ContourTest::Aspect); // More lenient
+
+        // ADJUSTED: Smaller margin for lower resolution
+        int margin = std::max(1, 10 >> activeLevel); // Reduced from 20
+        if (bbox.x < margin || bbox.y < margin ||
+            bbox.x + bbox.width - 1 > imgSize.width - margin || bbox.y + bbox.height - 1 > imgSize.height - margin) {
+            return reject(stats, ContourTest::Margin);
+        }
+
+        // Check if contour is convex enough
+        if (!cv::isContourConvex(quad)) return reject(stats, ContourTest::Convexity);
+
+        quadArea = cv::contourArea(quad);
+        stats.accepted++;
+        return true;
+    }
+
+    // RESTORED: Find best document with proper filtering
+    // Writes the largest valid quad into `document` (cleared when none)
+    void findBestDocument(const cv::Mat& binary, const cv::Mat& original, std::vector<cv::Point>& document) {
+        cv::findContours(binary, ws.contours, ws.hierarchy, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+
+        // Keep only the largest candidate (first one wins on ties)
+        double bestArea = -1.0;
+        double area = 0.0;
+        ws.best.clear();
+        lastContours.reset();
+        for (size_t i = 0; i < ws.contours.size(); i++) {
+            if (evaluateContour(ws.contours[i], original.size(), ws.approx, area, lastContours) && area > bestArea) {
+                bestArea = area;
+                ws.best.assign(ws.approx.begin(), ws.approx.end());
+            }
+        }
+        recordContourStats();
+
+        document.assign(ws.best.begin(), ws.best.end());
+    }
+
+    std::vector<cv::Point> findBestDocument(const cv::Mat& binary, const cv::Mat& original) {
+        std::vector<cv::Point> document;
+        findBestDocument(binary, original, document);
+        return document;
+    }
+
+    // Every valid quad, largest first, at most maxDocuments of them. A quad
+    // overlapping one already kept is dropped, so a page is not reported
+    // twice. Only the top of the candidate list is ordered (partial_sort);
+    // the rest is sorted only if overlaps used up that prefix.
+    void findDocuments(const cv::Mat& binary, const cv::Mat& original,
+        std::vector<std::vector<cv::Point> >& documents, int maxDocuments) {
+        cv::findContours(binary, ws.contours, ws.hierarchy, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+
+        // The cascade fits straight into the candidate slot; a rejected fit
+        // is overwritten by the next contour
+        size_t count = 0;
+        double area = 0.0;
+        ws.quadAreas.clear();
+        lastContours.reset();
+        for (size_t i = 0; i < ws.contours.size(); i++) {
+            if (ws.quads.size() <= count) ws.quads.resize(count + 1);
+            if (!evaluateContour(ws.contours[i], original.size(), ws.quads[count], area, lastContours)) continue;
+            ws.quadAreas.push_back(area);
+            count++;
+        }
+        recordContourStats();
+
+        ws.quadOrder.resize(count);
+        for (size_t i = 0; i < count; i++) ws.quadOrder[i] = (int)i;
+        const std::vector<double>& areas = ws.quadAreas;
+        // Larger first; contour order breaks ties, as in findBestDocument()
+        auto larger = [&areas](int a, int b) { return areas[a] > areas[b] || (areas[a] == areas[b] && a < b); };
+
+        size_t limit = (size_t)std::max(maxDocuments, 0);
+        size_t sorted = std::min(count, limit * 2);
+        std::partial_sort(ws.quadOrder.begin(), ws.quadOrder.begin() + sorted, ws.quadOrder.end(), larger);
+
+        size_t kept = 0;
+        for (size_t i = 0; i < count && kept < limit; i++) {
+            if (i == sorted) {
+                std::sort(ws.quadOrder.begin() + sorted, ws.quadOrder.end(), larger);
+                sorted = count;
+            }
+            int c = ws.quadOrder[i];
+            bool overlaps = false;
+            for (size_t k = 0; k < kept && !overlaps; k++) {
+                overlaps = quadsOverlap(ws.quads[c], areas[c], documents[k], ws.overlapA, ws.overlapB, ws.overlap);
+            }
+            if (overlaps) continue;
+            if (documents.size() <= kept) documents.resize(kept + 1);
+            documents[kept].assign(ws.quads[c].begin(), ws.quads[c].end());
+            kept++;
+        }
+        documents.resize(kept);
+    }
+
+    // Full detection on one frame. With detectionPyramidLevel > 0 the whole
+    // search (CLAHE, bilateral, Canny, morphology, contours) runs on a
+    // pyrDown'ed copy; the corners are then scaled back and refined with
+    // cornerSubPix on the full-resolution gray frame.
+    // `combined` receives the search mask (at the detection level's size).
+    void detect(const cv::Mat& frame, std::vector<cv::Point>& document, cv::Mat& combined) {
+        DetectorCostScope charge(totalCost);
+        const cv::Mat& src = prepareSearch(frame, combined);
+
+        activeLevel = lastLevel;
+        {
+            ESP_DOC_TIME_STAGE(Contours);
+            findBestDocument(combined, src, document);
+        }
+        activeLevel = 0;
+
+        if (lastLevel > 0 && document.size() == 4) {
+            ESP_DOC_TIME_STAGE(Refine);
+            cv::cvtColor(frame, ws.fullGray, cv::COLOR_BGR2GRAY);
+            refineQuadCorners(ws.fullGray, lastLevel, document, ws.corners);
+        }
+    }
+
+    // detect() for multi-document mode: up to maxDocuments non-overlapping
+    // quads, largest first
+    void detectAll(const cv::Mat& frame, std::vector<std::vector<cv::Point> >& documents,
+        cv::Mat& combined, int maxDocuments) {
+        DetectorCostScope charge(totalCost);
+        const cv::Mat& src = prepareSearch(frame, combined);
+
+        activeLevel = lastLevel;
+        {
+            ESP_DOC_TIME_STAGE(Contours);
+            findDocuments(combined, src, documents, maxDocuments);
+        }
+        activeLevel = 0;
+
+        if (lastLevel > 0 && !documents.empty()) {
+            ESP_DOC_TIME_STAGE(Refine);
+            cv::cvtColor(frame, ws.fullGray, cv::COLOR_BGR2GRAY);
+            for (size_t i = 0; i < documents.size(); i++) {
+                refineQuadCorners(ws.fullGray, lastLevel, documents[i], ws.corners);
+            }
+        }
+    }
+
+private:
+    // Pyramid, preprocessing and paper mask shared by detect() and
+    // detectAll(). Returns the image the contours are searched in.
+    const cv::Mat& prepareSearch(const cv::Mat& frame, cv::Mat& combined) {
+        int level = std::min(std::max(config.detectionPyramidLevel, 0), kMaxDetectionLevel);
+        const cv::Mat* src = &frame;
+        for (int i = 0; i < level; i++) {
+            cv::pyrDown(*src, ws.pyramid[i]);
+            src = &ws.pyramid[i];
+        }
+
+        const cv::Mat* processed;
+        {
+            ESP_DOC_TIME_STAGE(Preprocess);
+            processed = &balancedPreprocess(*src);
+        }
+        if (config.useColorDetection) {
+            ESP_DOC_TIME_STAGE(Paper);
+            cv::bitwise_and(*processed, detectPaper(*src), combined);
+        }
+        else {
+            processed->copyTo(combined);
+        }
+
+        lastLevel = level;
+        return *src;
+    }
+
+    static bool reject(ContourStats& stats, ContourTest test) {
+        stats.rejected[(int)test]++;
+        return false;
+    }
+
+    // Adds the last search to the totals and the metrics counters
+    void recordContourStats() {
+        totalContours.add(lastContours);
+        ESP_DOC_COUNT_ADD(Contours, lastContours.contours);
+        ESP_DOC_COUNT_ADD(ContourRejectPoints, lastContours.rejected[(int)ContourTest::Points]);
+        ESP_DOC_COUNT_ADD(ContourRejectBox, lastContours.rejected[(int)ContourTest::Box]);
+        ESP_DOC_COUNT_ADD(ContourRejectArea, lastContours.rejected[(int)ContourTest::Area]);
+        ESP_DOC_COUNT_ADD(ContourRejectCorners, lastContours.rejected[(int)ContourTest::Corners]);
+        ESP_DOC_COUNT_ADD(ContourRejectAspect, lastContours.rejected[(int)ContourTest::Aspect]);
+        ESP_DOC_COUNT_ADD(ContourRejectMargin, lastContours.rejected[(int)ContourTest::Margin]);
+        ESP_DOC_COUNT_ADD(ContourRejectConvexity, lastContours.rejected[(int)ContourTest::Convexity]);
+    }
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <vector>
+
+#include "DetectorEngine.hpp"
+#include "WarpCache.hpp"
+#include "WorkspaceBuffer.hpp"
+
+// Reusable buffers for warpDocument(). One per thread that warps.
+struct WarpWorkspace {
+    cv::Mat warpBuffer, grayBuffer, enhancedBuffer, blurBuffer;
+    cv::Ptr<cv::CLAHE> clahe;
+    double homography[9];
+    WarpCache cache;                    // remap tables for the last quad
+
+    WarpWorkspace() {
+        clahe = cv::createCLAHE(3.0, cv::Size(8, 8));
+    }
+};
+
+// Document warper with good quality
+class BalancedDocumentWarper {
+public:
+    // Returns a view of the workspace; valid until the next call with it
+    static cv::Mat warpDocument(const cv::Mat& img, const std::vector<cv::Point>& points, WarpWorkspace& ws,
+        bool enhance = true, int interpolation = cv::INTER_CUBIC) {
+        if (points.size() != 4) return cv::Mat();
+
+        cv::Point ordered[4];
+        orderQuadCorners(points, ordered);
+
+        double w1 = cv::norm(ordered[1] - ordered[0]);
+        double w2 = cv::norm(ordered[3] - ordered[2]);
+        double h1 = cv::norm(ordered[2] - ordered[0]);
+        double h2 = cv::norm(ordered[3] - ordered[1]);
+
+        int maxW = (w1 > w2) ? (int)w1 : (int)w2;
+        int maxH = (h1 > h2) ? (int)h1 : (int)h2;
+
+        if (maxW < 300) maxW = 300;
+        if (maxH < 300) maxH = 300;
+
+        cv::Point2f src[4] = { ordered[0], ordered[1], ordered[2], ordered[3] };
+        cv::Mat warped;
+
+        if (ws.cache.enabled()) {
+            cv::Size size = ws.cache.prepare(src, cv::Size(maxW, maxH), interpolation);
+            if (size.width == 0) return cv::Mat();
+            warped = workspaceView(ws.warpBuffer, size, img.type());
+            ws.cache.remap(img, warped);
+        }
+        else {
+            cv::Point2f dst[4] = {
+                cv::Point2f(0, 0), cv::Point2f((float)maxW, 0),
+                cv::Point2f(0, (float)maxH), cv::Point2f((float)maxW, (float)maxH)
+            };
+
+            if (!computePerspective(src, dst, ws.homography)) return cv::Mat();
+            cv::Mat transform(3, 3, CV_64F, ws.homography);
+            warped = workspaceView(ws.warpBuffer, cv::Size(maxW, maxH), img.type());
+            cv::warpPerspective(img, warped, transform, cv::Size(maxW, maxH), interpolation);
+        }
+
+        if (enhance) {
+            return enhanceDocument(warped, ws);
+        }
+        return warped;
+    }
+
+    // Convenience overload for one-off warps; allocates its own buffers
+    static cv::Mat warpDocument(const cv::Mat& img, const std::vector<cv::Point>& points, bool enhance = true) {
+        WarpWorkspace ws;
+        ws.cache.setEpsilon(-1.0);      // nothing to reuse, plain warpPerspective
+        return warpDocument(img, points, ws, enhance);
+    }
+
+    // CLAHE + light blur on an already warped page. The result is always
+    // single-channel (a gray page saved as BGR is three identical planes);
+    // returns a workspace view.
+    static cv::Mat enhanceDocument(const cv::Mat& img, WarpWorkspace& ws) {
+        cv::Mat gray;
+
+        // Not a view: cv::CLAHE pads sizes that are not a multiple of its
+        // tile grid without BORDER_ISOLATED, which on a sub-matrix would pull
+        // in pixels of an earlier, larger page. Reallocates on a size change.
+        if (img.channels() == 3) {
+            ws.grayBuffer.create(img.size(), CV_8UC1);
+            cv::cvtColor(img, ws.grayBuffer, cv::COLOR_BGR2GRAY);
+            gray = ws.grayBuffer;
+        }
+        else if (img.isSubmatrix()) {
+            img.copyTo(ws.grayBuffer);
+            gray = ws.grayBuffer;
+        }
+        else {
+            gray = img;
+        }
+
+        cv::Mat enhanced = workspaceView(ws.enhancedBuffer, img.size(), CV_8UC1);
+        cv::Mat blurred = workspaceView(ws.blurBuffer, img.size(), CV_8UC1);
+        ws.clahe->apply(gray, enhanced);
+        // ISOLATED: the views are sub-matrices, never sample past their edge
+        cv::GaussianBlur(enhanced, blurred, cv::Size(3, 3), 0.5, 0, cv::BORDER_DEFAULT | cv::BORDER_ISOLATED);
+
+        return blurred;
+    }
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <string>
+
+// BALANCED Configuration - Fast + Good Detection
+struct Config {
+#ifdef _WIN32
+    std::string comPort = "COM6";
+    std::string saveFolder = "C:/Users/kbakhtiyar/Documents/document_tester/";
+#else
+    std::string comPort = "/dev/ttyUSB0";   // "pty" = built-in ESP32 stand-in on a pseudo-terminal
+    std::string saveFolder = "scans/";
+#endif
+    std::string streamUrl = "http://192.168.1.103:8080/video";
+    bool nativeMjpeg = true;         // Read http:// MJPEG with the built-in client: scaled JPEG decode, full decode only for saves
+
+    // ADJUSTED detection parameters for lower resolution
+    int minArea = 1500;              // REDUCED for 480x360 (was 3000)
+    int maxArea = 300000;            // REDUCED for 480x360 (was 500000)
+    double epsilonFactor = 0.02;
+    int detectionTimeSeconds = 5;    // Upper bound: save after this long even if never "stable"
+
+    // Early capture: save as soon as the page has been still and sharp for
+    // stableFrames processed frames (corners within stableMaxJitterPx of
+    // their mean, quality within stableQualityDrop of the recent best)
+    bool earlyCapture = true;
+    int stableFrames = 8;
+    double stableMaxJitterPx = 2.5;
+    int stableQualityDrop = 5;
+
+    // Multi-document mode: every non-overlapping page in view (up to
+    // maxDocuments) gets its own timer, stability check, save and serial
+    // events ("DOC_DETECTED 2"). Optical-flow tracking is single-page
+    // only and is not used in this mode.
+    bool multiDocument = false;
+    int maxDocuments = 4;            // page ids 1..maxDocuments, at most 31 (the ESP32's page mask)
+
+    // Multi-stream: when streamsFile names an INI file (see StreamConfig.hpp),
+    // one process scans every camera listed there, each with its own
+    // detection state, page timers, ESP32 and save folder. Detection for all
+    // of them runs on one work-stealing pool of detectionWorkers threads
+    // (0 = one per core); pinWorkers pins pool thread i to core i.
+    std::string streamsFile = "";
+    int detectionWorkers = 0;
+    bool pinWorkers = false;
+
+    // Headless (kiosks without a monitor): no windows, no overlay drawing
+    // and no HighGUI calls at all. previewPort serves the annotated frames
+    // as MJPEG and the keyboard controls as POST /capture and POST /quit on
+    // http://127.0.0.1:<previewPort>/ (0 = none; stop with Ctrl+C). The
+    // preview is drawn and encoded on its own thread, at most previewMaxFps
+    // and only while a client is watching.
+    bool headless = false;
+    int previewPort = 8090;
+    double previewMaxFps = 5.0;
+    int previewJpegQuality = 70;
+
+    // Session recording (FrameRecorder.hpp): every frame the capture stage
+    // decodes is appended to recordPath with its capture time, as the
+    // camera's JPEG or else as PNG ("" = off, single stream only).
+    // streamUrl = "replay:<file>" plays a recording back at its original
+    // timing; tools/replay.cpp runs one through detection and the page
+    // state machine frame by frame, as fast as possible, and writes a
+    // deterministic event log.
+    std::string recordPath = "";
+
+    // Detector engine. "contour": CLAHE, bilateral filter, Canny, paper
+    // mask and contours; robust on cluttered or dim scenes. "lines": line
+    // segments on a downscaled gray frame fitted into quads, several times
+    // cheaper and tolerant of a partly covered page edge; for well-lit
+    // desks. Both report their cost in the metrics (preprocess / paper /
+    // contours against segments / quad_fit).
+    std::string detectorEngine = "contour";
+
+    int cannyLow = 20;               // LOWERED for better edge detection
+    int cannyHigh = 100;             // LOWERED for better edge detection
+
+    bool autoEnhance = true;
+    bool showPreview = false;        // Keep disabled for speed
+    int qualityThreshold = 60;       // LOWERED threshold (was 70)
+    // true: score the quad in the gray frame and warp only when saving. Off
+    // until esp_doc_bench's quality_estimate check shows it agrees with the
+    // warped score on real inputs.
+    bool fastQualityEstimate = false;
+
+    // BALANCED camera settings
+    int frameWidth = 480;
+    int frameHeight = 360;
+    int fps = 30;                    // REDUCED from 60 for stability
+    int bufferSize = 1;              // Keep minimal for speed
+
+    // BALANCED processing
+    bool skipFrames = false;         // DISABLED - detect every frame
+    int processEveryNthFrame = 1;    // Process EVERY frame for detection
+    bool fastProcessing = false;     // DISABLED - full CLAHE + bilateral (true: FastPreprocess.hpp guided filter)
+    bool useColorDetection = true;   // ENABLED - better document detection
+
+    // Paper mask for useColorDetection (HSV, V and S are 0-255): white
+    // paper is bright and unsaturated, the second band admits light colored
+    // surfaces. Tune with tools/eval.cpp.
+    int paperMinValue = 180;
+    int paperMaxSaturation = 30;
+    int lightMinValue = 150;
+    int lightMaxSaturation = 50;
+
+    // Adaptive QoS: when detection overruns qosBudgetMs per frame, degrade
+    // step by step (stride, pyramid level, fastProcessing, no color
+    // detection) and recover when there is headroom. The settings above are
+    // the best level it returns to.
+    bool adaptiveQos = true;
+    double qosBudgetMs = 25.0;
+
+    // Coarse-to-fine: search on the frame pyrDown'ed this many times (0-3),
+    // then refine corners at full resolution. minArea/maxArea stay in capture
+    // pixels and are scaled automatically. For 1920x1080 capture, level 2
+    // searches a 480x270 image.
+    int detectionPyramidLevel = 0;
+
+    // Temporal tracking: once a document is found, follow its corners with
+    // optical flow instead of re-detecting. Full detection still runs when
+    // the track is lost and at least every trackerRedetectInterval frames.
+    bool trackDocument = true;
+    int trackerRedetectInterval = 10;
+    double trackerMaxError = 1.5;    // Forward-backward error limit (pixels)
+
+    // Background saving (warp + enhance + encode + write off the capture thread)
+    int saveWorkers = 2;
+    int saveQueueCapacity = 8;       // Saves are refused (retried) while the queue is full
+    int saveCooldownMs = 1500;       // Minimum pause after a save; the page re-arms once moved or swapped
+
+    // Output encoding (DocumentEncoder.hpp). Enhanced pages are gray and
+    // stay one channel. "jpeg", "png", "webp" or "bilevel" (1-bit PNG of an
+    // adaptive threshold, smallest for text-only pages).
+    std::string outputFormat = "jpeg";
+    int jpegQuality = 95;
+    bool jpegProgressive = false;
+    int pngCompression = 3;          // 0-9: higher is smaller and slower
+    int webpQuality = 90;
+
+    // Session PDF: append every saved page to one PDF per run
+    // (saveFolder/session_<timestamp>.pdf) instead of writing separate
+    // files. Pages are embedded as the encoded JPEG (jpegQuality), so
+    // outputFormat is ignored. A session cut short by a crash is repaired
+    // on the next start.
+    bool pdfSession = false;
+    double pdfDpi = 150.0;           // Page size in the PDF = pixels / pdfDpi inches
+
+    // Warps reuse cached remap tables while every corner stays within this
+    // many pixels of the cached quad (negative = always warpPerspective)
+    double warpCacheEpsilon = 1.0;
+
+    // Telemetry (see Metrics.hpp). Stage histograms and counters are
+    // written every metricsDumpIntervalMs to metricsDumpPath (.json =
+    // snapshot, anything else = appended CSV; empty = off) and served as
+    // Prometheus text on http://127.0.0.1:<metricsHttpPort>/metrics (0 = off).
+    std::string metricsDumpPath = "";
+    int metricsDumpIntervalMs = 10000;
+    int metricsHttpPort = 0;
+};
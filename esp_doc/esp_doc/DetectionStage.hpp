@@ -0,0 +1,199 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Config.hpp"
+#include "QualityMetrics.hpp"
+#include "DetectorFactory.hpp"
+#include "BalancedDocumentWarper.hpp"
+#include "DocumentTracker.hpp"
+#include "QosController.hpp"
+#include "FrameSource.hpp"
+#include "AllocationCounter.hpp"
+#include "Metrics.hpp"
+
+// One frame on its way through the scanner: capture, detection, display
+struct FrameSlot {
+    cv::Mat frame;                      // flipped camera frame
+    cv::Mat combined;                   // detector output for the "Processing" window
+    std::vector<std::vector<cv::Point> > documents;    // every page found, largest first
+    std::vector<QualityMetrics> qualities;              // zeroed when a page could not be scored
+    std::vector<cv::Point> document;    // documents[0], if any
+    EncodedFrame original;              // full-resolution JPEG when `frame` was decoded scaled
+    QualityMetrics quality;
+    bool hasQuality;
+    bool tracked;                       // document came from the tracker, not detect()
+    bool skipped;                       // not processed (QoS stride): result of an earlier frame
+    long long captureTime;
+    unsigned long long sequence;
+
+    FrameSlot() : hasQuality(false), tracked(false), skipped(false), captureTime(0), sequence(0) {}
+};
+
+// Detection state of one stream: detector, tracker, QoS controller and the
+// result handed on for QoS-skipped frames. One frame at a time.
+class DetectionStage {
+public:
+    DetectionStage(const Config& cfg, const std::string& name = "")
+        : config(cfg), label(name.empty() ? "" : "[" + name + "] "), detector(createDetectorEngine(cfg)), tracker(cfg), qos(cfg),
+          frameCounter(0), heldHasQuality(false), framesProcessed(0), framesSinceQosChange(0),
+          warmFingerprint(0), heapAllocs(0), matAllocs(0) {
+        warpWs.cache.setEpsilon(config.warpCacheEpsilon);
+        qos.configure(*detector);
+    }
+
+    // Finds and scores the documents in s.frame, or hands on the last
+    // result when the QoS stride skips the frame (s.skipped)
+    void process(FrameSlot& s) {
+        // QoS stride: hand on the last result without detecting
+        s.skipped = frameCounter++ % qos.settings().stride != 0;
+        if (s.skipped) {
+            s.documents = heldDocuments;
+            s.qualities = heldQualities;
+            setPrimary(s);
+            s.hasQuality = heldHasQuality;
+            s.tracked = false;
+            return;
+        }
+
+        AllocationScope frameAllocs;
+        auto frameStart = std::chrono::steady_clock::now();
+
+        {
+            ESP_DOC_TIME_STAGE(Detect);
+            // Follow a known document cheaply; FULL processing when there is
+            // none, the track is lost or the re-detect interval is up
+            // (on a pyramid level when detectionPyramidLevel > 0).
+            // Multi-document mode always detects: the tracker follows one page.
+            s.tracked = !config.multiDocument && config.trackDocument && tracker.canTrack() && tracker.track(s.frame, s.document);
+            if (config.multiDocument) {
+                detector->detectAll(s.frame, s.documents, s.combined, config.maxDocuments);
+            }
+            else if (s.tracked) {
+                // No mask this frame: show the tracked outline instead
+                if (s.combined.empty()) s.combined.create(s.frame.size(), CV_8UC1);
+                s.combined.setTo(cv::Scalar(0));
+                double scale = (double)s.combined.cols / s.frame.cols;
+                for (int i = 0; i < 4; i++) {
+                    cv::line(s.combined, s.document[i] * scale, s.document[(i + 1) % 4] * scale, cv::Scalar(255), 2);
+                }
+            }
+            else {
+                detector->detect(s.frame, s.document, s.combined);
+                if (config.trackDocument) {
+                    if (s.document.size() == 4) tracker.init(s.frame, s.document);
+                    else tracker.reset();
+                }
+            }
+
+            if (!config.multiDocument) {
+                s.documents.resize(s.document.size() == 4 ? 1 : 0);
+                if (!s.documents.empty()) s.documents[0].assign(s.document.begin(), s.document.end());
+            }
+
+            s.hasQuality = false;
+            s.qualities.resize(s.documents.size());
+            if (!s.documents.empty()) {
+                ESP_DOC_TIME_STAGE(Quality);
+                const cv::Mat& gray = s.tracked ? tracker.frameGray() : detector->frameGray();
+                for (size_t i = 0; i < s.documents.size(); i++) {
+                    bool scored = scoreDocument(s.frame, gray, s.documents[i], s.qualities[i]);
+                    if (!scored) s.qualities[i] = QualityMetrics();
+                    if (i == 0) s.hasQuality = scored;
+                }
+            }
+            setPrimary(s);
+        }
+        if (!s.documents.empty()) ESP_DOC_COUNT(Detections);
+        if (s.tracked) ESP_DOC_COUNT(TrackedFrames);
+        heldDocuments = s.documents;
+        heldQualities = s.qualities;
+        heldHasQuality = s.hasQuality;
+
+        double frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+        if (config.adaptiveQos && qos.update(frameMs)) {
+            qos.configure(*detector);
+            framesSinceQosChange = 0;
+            const QosSettings& q = qos.settings();
+            std::cout << label << "?? QoS level " << qos.level() << ": every " << q.stride << " frame(s), detection level "
+                << q.detectionLevel << (q.fastProcessing ? ", fast" : "") << (q.useColorDetection ? "" : ", no color") << std::endl;
+        }
+
+        framesProcessed++;
+        framesSinceQosChange++;
+        if (framesSinceQosChange == kWarmupFrames) {
+            warmFingerprint = detector->workspaceFingerprint();
+        }
+        else if (framesSinceQosChange > kWarmupFrames) {
+            // Fires if a stage started allocating per frame again
+            assert(detector->workspaceFingerprint() == warmFingerprint);
+        }
+        if (ESP_DOC_ALLOCATION_COUNTING) {
+            heapAllocs += frameAllocs.heapAllocations();
+            matAllocs += frameAllocs.matAllocations();
+            if (framesProcessed % 300 == 0) {
+                std::cout << label << "?? Detection allocations/frame: heap " << heapAllocs / 300.0
+                    << ", cv::Mat " << matAllocs / 300.0 << std::endl;
+                heapAllocs = matAllocs = 0;
+            }
+        }
+    }
+
+    // Frames actually detected (not skipped)
+    int processed() const { return framesProcessed; }
+
+private:
+    // Steady-state check: once warmed up, no workspace buffer may move
+    // (re-armed after a QoS change, which legitimately resizes buffers)
+    static const int kWarmupFrames = 30;
+
+    // documents[0] is also the slot's primary document (UI, tracker)
+    static void setPrimary(FrameSlot& s) {
+        if (s.documents.empty()) {
+            s.document.clear();
+            s.quality = QualityMetrics();
+        }
+        else {
+            s.document.assign(s.documents[0].begin(), s.documents[0].end());
+            s.quality = s.qualities[0];
+        }
+    }
+
+    // Quality of one page, from the gray frame (fast) or a trial warp,
+    // judged against config.qualityThreshold
+    bool scoreDocument(const cv::Mat& frame, const cv::Mat& gray, const std::vector<cv::Point>& document, QualityMetrics& out) {
+        if (config.fastQualityEstimate) {
+            out = assessQuadQuality(gray, document);
+        }
+        else {
+            cv::Mat warped = BalancedDocumentWarper::warpDocument(frame, document, warpWs, false);
+            if (warped.empty()) return false;
+            out = assessQuality(warped, qualityWs);
+        }
+        out.isGoodQuality = out.overallScore >= config.qualityThreshold;
+        return true;
+    }
+
+    Config config;
+    std::string label;                  // log prefix in multi-stream mode
+    std::unique_ptr<DetectorEngine> detector;
+    DocumentTracker tracker;
+    QosController qos;
+    WarpWorkspace warpWs;
+    QualityWorkspace qualityWs;
+    unsigned long long frameCounter;
+    std::vector<std::vector<cv::Point> > heldDocuments;
+    std::vector<QualityMetrics> heldQualities;
+    bool heldHasQuality;
+    int framesProcessed;
+    int framesSinceQosChange;
+    size_t warmFingerprint;
+    unsigned long long heapAllocs, matAllocs;
+};
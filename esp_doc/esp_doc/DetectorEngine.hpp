@@ -0,0 +1,143 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Deepest pyramid level detect() will run on (1/8 of the capture size)
+const int kMaxDetectionLevel = 3;
+
+// Candidates may share at most this fraction of the smaller quad's area
+const double kMaxDocumentOverlap = 0.1;
+
+// Selectable with Config::detectorEngine
+enum class DetectorEngineKind { Contour, Lines };
+
+inline bool parseDetectorEngine(const std::string& name, DetectorEngineKind& kind) {
+    if (name == "contour") kind = DetectorEngineKind::Contour;
+    else if (name == "lines") kind = DetectorEngineKind::Lines;
+    else return false;
+    return true;
+}
+
+// Work an engine has done since construction. `candidates` are what its
+// search scored: contours for the contour engine, quads built from line
+// pairs for the line engine.
+struct DetectorCost {
+    unsigned long long searches;        // detect() / detectAll() calls
+    double searchMs;                    // wall time in them
+    unsigned long long candidates;
+    unsigned long long accepted;
+
+    DetectorCost() : searches(0), searchMs(0.0), candidates(0), accepted(0) {}
+};
+
+// Charges the enclosing detect() call to a DetectorCost
+class DetectorCostScope {
+public:
+    explicit DetectorCostScope(DetectorCost& c) : cost(c), start(std::chrono::steady_clock::now()) {}
+    ~DetectorCostScope() {
+        cost.searches++;
+        cost.searchMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    DetectorCost& cost;
+    std::chrono::steady_clock::time_point start;
+};
+
+// A way of finding page quads in a camera frame. The detection stage, the
+// batch scanner and the tools only talk to this interface; Config picks
+// the engine (see DetectorFactory.hpp).
+class DetectorEngine {
+public:
+    virtual ~DetectorEngine() {}
+
+    virtual const char* name() const = 0;
+
+    // The largest page in `frame`, corners in frame pixels (cleared when
+    // none). `combined` receives what the engine searched, for the
+    // "Processing" window.
+    virtual void detect(const cv::Mat& frame, std::vector<cv::Point>& document, cv::Mat& combined) = 0;
+
+    // Up to maxDocuments non-overlapping pages, best first
+    virtual void detectAll(const cv::Mat& frame, std::vector<std::vector<cv::Point> >& documents,
+        cv::Mat& combined, int maxDocuments) = 0;
+
+    // Full-resolution gray of the last frame. Valid when that call found a
+    // document.
+    virtual const cv::Mat& frameGray() const = 0;
+
+    // Sum of the engine's buffer addresses; constant once warmed up
+    virtual size_t workspaceFingerprint() const = 0;
+
+    virtual DetectorCost cost() const = 0;
+
+    // Runtime knobs for the QoS controller; an engine ignores the ones it
+    // has no use for. Take effect on the next frame.
+    virtual void setDetectionLevel(int level) = 0;
+    virtual void setFastProcessing(bool) {}
+    virtual void setColorDetection(bool) {}
+};
+
+// Orders a quad as the warper expects: min(x+y), min(x-y), max(x-y), max(x+y)
+inline void orderQuadCorners(const std::vector<cv::Point>& pts, cv::Point ordered[4]) {
+    int minSum = 0, maxSum = 0, minDiff = 0, maxDiff = 0;
+    for (int i = 1; i < 4; i++) {
+        if (pts[i].x + pts[i].y < pts[minSum].x + pts[minSum].y) minSum = i;
+        if (pts[i].x + pts[i].y > pts[maxSum].x + pts[maxSum].y) maxSum = i;
+        if (pts[i].x - pts[i].y < pts[minDiff].x - pts[minDiff].y) minDiff = i;
+        if (pts[i].x - pts[i].y > pts[maxDiff].x - pts[maxDiff].y) maxDiff = i;
+    }
+    ordered[0] = pts[minSum];
+    ordered[1] = pts[minDiff];
+    ordered[2] = pts[maxDiff];
+    ordered[3] = pts[maxSum];
+}
+
+// `quad` (of `area`) shares more than kMaxDocumentOverlap of the smaller
+// area with `kept`. a, b and shared are scratch buffers.
+inline bool quadsOverlap(const std::vector<cv::Point>& quad, double area, const std::vector<cv::Point>& kept,
+    std::vector<cv::Point2f>& a, std::vector<cv::Point2f>& b, std::vector<cv::Point2f>& shared) {
+    a.assign(quad.begin(), quad.end());
+    b.assign(kept.begin(), kept.end());
+    float overlap = cv::intersectConvexConvex(a, b, shared, true);
+    double smaller = std::min(area, cv::contourArea(kept));
+    return overlap > kMaxDocumentOverlap * smaller;
+}
+
+// Scales a quad found on pyramid level `level` to full resolution and snaps
+// its corners with cornerSubPix on `fullGray`. `corners` is scratch.
+inline void refineQuadCorners(const cv::Mat& fullGray, int level, std::vector<cv::Point>& document,
+    std::vector<cv::Point2f>& corners) {
+    const int scale = 1 << level;
+    // The coarse corner is off by up to ~scale pixels
+    const int half = std::max(3, 2 * scale);
+
+    corners.clear();
+    for (size_t i = 0; i < document.size(); i++) {
+        // pyrDown maps pixel centers x -> x/2, so x_full = x_coarse * scale
+        float x = std::min(std::max((float)(document[i].x * scale), (float)half), (float)(fullGray.cols - 1 - half));
+        float y = std::min(std::max((float)(document[i].y * scale), (float)half), (float)(fullGray.rows - 1 - half));
+        corners.push_back(cv::Point2f(x, y));
+    }
+
+    cv::cornerSubPix(fullGray, corners, cv::Size(half, half), cv::Size(-1, -1),
+        cv::TermCriteria(cv::TermCriteria::COUNT | cv::TermCriteria::EPS, 20, 0.03));
+
+    for (size_t i = 0; i < document.size(); i++) {
+        cv::Point scaled(document[i].x * scale, document[i].y * scale);
+        cv::Point refined(cvRound(corners[i].x), cvRound(corners[i].y));
+        // Keep the scaled corner if the search drifted off to another structure
+        if (std::abs(refined.x - scaled.x) <= half && std::abs(refined.y - scaled.y) <= half) {
+            document[i] = refined;
+        }
+        else {
+            document[i] = scaled;
+        }
+    }
+}
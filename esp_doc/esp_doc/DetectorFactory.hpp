@@ -0,0 +1,17 @@
+#pragma once
+
+#include <memory>
+
+#include "Config.hpp"
+#include "DetectorEngine.hpp"
+#include "BalancedDocumentDetector.hpp"
+#include "LineQuadDetector.hpp"
+
+// The engine Config::detectorEngine names; unknown names fall back to the
+// contour engine
+inline std::unique_ptr<DetectorEngine> createDetectorEngine(const Config& cfg) {
+    DetectorEngineKind kind = DetectorEngineKind::Contour;
+    parseDetectorEngine(cfg.detectorEngine, kind);
+    if (kind == DetectorEngineKind::Lines) return std::unique_ptr<DetectorEngine>(new LineQuadDetector(cfg));
+    return std::unique_ptr<DetectorEngine>(new BalancedDocumentDetector(cfg));
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Config.hpp"
+
+enum class OutputFormat { Jpeg, Png, Webp, Bilevel };
+
+inline bool parseOutputFormat(const std::string& name, OutputFormat& format) {
+    if (name == "jpeg" || name == "jpg") format = OutputFormat::Jpeg;
+    else if (name == "png") format = OutputFormat::Png;
+    else if (name == "webp") format = OutputFormat::Webp;
+    else if (name == "bilevel") format = OutputFormat::Bilevel;
+    else return false;
+    return true;
+}
+
+// How saved pages are encoded
+struct EncoderSettings {
+    OutputFormat format;
+    int jpegQuality;                    // 0-100
+    bool jpegProgressive;
+    int pngCompression;                 // 0-9, also used for bilevel
+    int webpQuality;                    // 1-100
+
+    EncoderSettings()
+        : format(OutputFormat::Jpeg), jpegQuality(95), jpegProgressive(false), pngCompression(3), webpQuality(90) {}
+
+    // Unknown Config::outputFormat names fall back to JPEG
+    static EncoderSettings fromConfig(const Config& cfg) {
+        EncoderSettings s;
+        if (!parseOutputFormat(cfg.outputFormat, s.format)) s.format = OutputFormat::Jpeg;
+        s.jpegQuality = cfg.jpegQuality;
+        s.jpegProgressive = cfg.jpegProgressive;
+        s.pngCompression = cfg.pngCompression;
+        s.webpQuality = cfg.webpQuality;
+        return s;
+    }
+
+    std::string describe() const {
+        std::ostringstream oss;
+        switch (format) {
+        case OutputFormat::Jpeg: oss << "JPEG q" << jpegQuality << (jpegProgressive ? " progressive" : ""); break;
+        case OutputFormat::Png: oss << "PNG level " << pngCompression; break;
+        case OutputFormat::Webp: oss << "WebP q" << webpQuality; break;
+        default: oss << "bilevel PNG"; break;
+        }
+        return oss.str();
+    }
+};
+
+// Encodes finished pages into memory. Pages keep their channel count: an
+// enhanced (gray) page is a one-plane JPEG/PNG/WebP, not three identical
+// planes. Bilevel binarizes with an adaptive threshold and writes a 1-bit
+// PNG, for text pages where only legibility matters. One per thread.
+class DocumentEncoder {
+public:
+    explicit DocumentEncoder(const EncoderSettings& s = EncoderSettings()) : settings(s) {
+        switch (settings.format) {
+        case OutputFormat::Jpeg:
+            params.push_back(cv::IMWRITE_JPEG_QUALITY);
+            params.push_back(settings.jpegQuality);
+            params.push_back(cv::IMWRITE_JPEG_PROGRESSIVE);
+            params.push_back(settings.jpegProgressive ? 1 : 0);
+            break;
+        case OutputFormat::Png:
+            params.push_back(cv::IMWRITE_PNG_COMPRESSION);
+            params.push_back(settings.pngCompression);
+            break;
+        case OutputFormat::Webp:
+            params.push_back(cv::IMWRITE_WEBP_QUALITY);
+            params.push_back(settings.webpQuality);
+            break;
+        case OutputFormat::Bilevel:
+            params.push_back(cv::IMWRITE_PNG_COMPRESSION);
+            params.push_back(settings.pngCompression);
+            params.push_back(cv::IMWRITE_PNG_BILEVEL);
+            params.push_back(1);
+            break;
+        }
+    }
+
+    // File extension including the dot
+    const char* extension() const { return extensionFor(settings.format); }
+
+    static const char* extensionFor(OutputFormat format) {
+        switch (format) {
+        case OutputFormat::Jpeg: return ".jpg";
+        case OutputFormat::Webp: return ".webp";
+        default: return ".png";
+        }
+    }
+
+    bool encode(const cv::Mat& page, std::vector<uchar>& out) {
+        if (page.empty()) return false;
+        if (settings.format != OutputFormat::Bilevel) {
+            return cv::imencode(extension(), page, out, params);
+        }
+
+        const cv::Mat* source = &page;
+        if (page.channels() == 3) {
+            cv::cvtColor(page, gray, cv::COLOR_BGR2GRAY);
+            source = &gray;
+        }
+        // Block size ~ a few text line heights at capture resolution
+        cv::adaptiveThreshold(*source, binary, 255, cv::ADAPTIVE_THRESH_GAUSSIAN_C, cv::THRESH_BINARY, 25, 15);
+        return cv::imencode(".png", binary, out, params);
+    }
+
+private:
+    EncoderSettings settings;
+    std::vector<int> params;
+    cv::Mat gray, binary;
+};
+
+// Writes `bytes` to `path`; false on any I/O error
+inline bool writeFileBytes(const std::string& path, const std::vector<uchar>& bytes) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == NULL) return false;
+    bool ok = std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return std::fclose(file) == 0 && ok;
+}
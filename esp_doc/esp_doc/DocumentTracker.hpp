@@ -0,0 +1,136 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
+#include <cmath>
+#include <vector>
+
+#include "Config.hpp"
+#include "Metrics.hpp"
+
+// Follows the four document corners from frame to frame with pyramidal
+// Lucas-Kanade flow, so a held document does not pay for full detection
+// every frame. Each corner is tracked forward and back again; the track is
+// dropped when any corner fails that round trip, the quad stops being
+// convex, or its area jumps. The caller re-detects when track() returns
+// false and every trackerRedetectInterval frames regardless.
+class DocumentTracker {
+public:
+    DocumentTracker(const Config& cfg)
+        : config(cfg), tracking(false), framesTracked(0), lastConfidence(0.0), lastArea(0.0) {
+        prevPts.reserve(4);
+        nextPts.reserve(4);
+        backPts.reserve(4);
+        status.reserve(4);
+        backStatus.reserve(4);
+        err.reserve(4);
+        quad.reserve(4);
+    }
+
+    void reset() {
+        tracking = false;
+        framesTracked = 0;
+        lastConfidence = 0.0;
+    }
+
+    bool isTracking() const { return tracking; }
+
+    // Frames followed since the last full detection
+    int framesSinceDetection() const { return framesTracked; }
+
+    // 1.0 = perfect forward-backward agreement, 0.0 = at the error limit
+    double confidence() const { return lastConfidence; }
+
+    // Gray of the frame last passed to init() or track()
+    const cv::Mat& frameGray() const { return gray; }
+
+    // True when the next frame may be tracked instead of detected
+    bool canTrack() const {
+        return tracking && framesTracked < config.trackerRedetectInterval;
+    }
+
+    // Starts following a freshly detected quad (full-resolution corners)
+    void init(const cv::Mat& frame, const std::vector<cv::Point>& document) {
+        if (document.size() != 4) {
+            reset();
+            return;
+        }
+        cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+        cv::buildOpticalFlowPyramid(gray, prevPyramid, winSize(), kLevels);
+
+        prevPts.clear();
+        for (size_t i = 0; i < 4; i++) {
+            prevPts.push_back(cv::Point2f((float)document[i].x, (float)document[i].y));
+        }
+        lastArea = std::fabs(cv::contourArea(prevPts));
+        lastConfidence = 1.0;
+        framesTracked = 0;
+        tracking = true;
+    }
+
+    // Moves the corners into `frame`. Returns false (and stops tracking)
+    // when confidence drops; `document` is only written on success.
+    bool track(const cv::Mat& frame, std::vector<cv::Point>& document) {
+        if (!tracking) return false;
+        ESP_DOC_TIME_STAGE(Track);
+
+        cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+        cv::buildOpticalFlowPyramid(gray, nextPyramid, winSize(), kLevels);
+
+        const cv::TermCriteria criteria(cv::TermCriteria::COUNT | cv::TermCriteria::EPS, 20, 0.03);
+        cv::calcOpticalFlowPyrLK(prevPyramid, nextPyramid, prevPts, nextPts, status, err, winSize(), kLevels, criteria);
+        cv::calcOpticalFlowPyrLK(nextPyramid, prevPyramid, nextPts, backPts, backStatus, err, winSize(), kLevels, criteria);
+
+        double maxError = config.trackerMaxError;
+        double worst = 0.0;
+        for (size_t i = 0; i < 4; i++) {
+            if (!status[i] || !backStatus[i]) return lose();
+            double dx = backPts[i].x - prevPts[i].x;
+            double dy = backPts[i].y - prevPts[i].y;
+            double fb = std::sqrt(dx * dx + dy * dy);
+            if (fb > maxError) return lose();
+            if (fb > worst) worst = fb;
+            if (nextPts[i].x < 0 || nextPts[i].y < 0 || nextPts[i].x >= frame.cols || nextPts[i].y >= frame.rows) return lose();
+        }
+
+        quad.clear();
+        for (size_t i = 0; i < 4; i++) {
+            quad.push_back(cv::Point(cvRound(nextPts[i].x), cvRound(nextPts[i].y)));
+        }
+        if (!cv::isContourConvex(quad)) return lose();
+
+        double area = std::fabs(cv::contourArea(nextPts));
+        if (area < lastArea * 0.8 || area > lastArea * 1.25) return lose();
+
+        document.assign(quad.begin(), quad.end());
+        std::swap(prevPyramid, nextPyramid);
+        std::swap(prevPts, nextPts);
+        lastArea = area;
+        lastConfidence = 1.0 - worst / maxError;
+        framesTracked++;
+        return true;
+    }
+
+private:
+    static const int kLevels = 3;
+    static cv::Size winSize() { return cv::Size(21, 21); }
+
+    bool lose() {
+        reset();
+        return false;
+    }
+
+    Config config;
+    bool tracking;
+    int framesTracked;
+    double lastConfidence;
+    double lastArea;
+
+    cv::Mat gray;
+    std::vector<cv::Mat> prevPyramid, nextPyramid;
+    std::vector<cv::Point2f> prevPts, nextPts, backPts;
+    std::vector<uchar> status, backStatus;
+    std::vector<float> err;
+    std::vector<cv::Point> quad;
+};
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BalancedDocumentWarper.hpp"
+#include "DocumentEncoder.hpp"
+#include "FrameSource.hpp"
+#include "Metrics.hpp"
+#include "PdfSessionWriter.hpp"
+
+struct SaveJob {
+    unsigned long long id;
+    cv::Mat frame;                      // private copy, the pipeline slot is recycled
+    std::vector<cv::Point> document;
+    std::string filename;
+    bool enhance;
+    int qualityScore;
+    int docId;                          // page id in multi-document mode, else 0
+    int stream;                         // camera index in multi-stream mode, else 0
+    EncodedFrame original;              // full-resolution source, when `frame` was decoded scaled
+};
+
+struct SaveResult {
+    unsigned long long id;
+    std::string filename;
+    bool ok;
+    int qualityScore;
+    int docId;
+    int stream;
+    double elapsedMs;                   // warp + enhance + encode + write
+    double encodeMs;
+    size_t bytes;                       // file size
+};
+
+// One page of a frame for submitAll()
+struct SavePage {
+    std::vector<cv::Point> document;
+    std::string filename;
+    int qualityScore;
+    int docId;
+    int stream;
+
+    SavePage() : qualityScore(0), docId(0), stream(0) {}
+};
+
+// Background writer: warping, enhancement, encoding (DocumentEncoder) and
+// the disk write all happen on worker threads. The queue is bounded;
+// submit() refuses new work while it is full so the caller can retry
+// instead of stalling. Filenames should end in fileExtension(). With a
+// PDF session set, pages are appended to it (in job id order) instead of
+// being written as files, and the filename is unused.
+class AsyncDocumentWriter {
+public:
+    AsyncDocumentWriter(int workerCount, size_t queueCapacity, double warpCacheEpsilon = 1.0,
+        const EncoderSettings& encoding = EncoderSettings())
+        : capacity(queueCapacity < 1 ? 1 : queueCapacity), active(0), nextId(0), stopping(false),
+          cacheEpsilon(warpCacheEpsilon), encoderSettings(encoding), pdfSession(NULL), cacheHits(0), cacheMisses(0) {
+        if (workerCount < 1) workerCount = 1;
+        for (int i = 0; i < workerCount; i++) {
+            workers.emplace_back(&AsyncDocumentWriter::workerLoop, this);
+        }
+    }
+
+    ~AsyncDocumentWriter() {
+        shutdown();
+    }
+
+    // Non-blocking. Returns 0 when the queue is full, otherwise the job id.
+    // The frame is only copied once the job has been accepted.
+    unsigned long long submit(const cv::Mat& frame, const std::vector<cv::Point>& document,
+        const std::string& filename, bool enhance, int qualityScore, int docId = 0,
+        const EncodedFrame& original = EncodedFrame()) {
+        unsigned long long id;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping || queue.size() + active >= capacity) return 0;
+
+            SaveJob job;
+            job.id = id = ++nextId;
+            job.frame = frame.clone();
+            job.document = document;
+            job.filename = filename;
+            job.enhance = enhance;
+            job.qualityScore = qualityScore;
+            job.docId = docId;
+            job.stream = 0;
+            job.original = original;
+            queue.push_back(std::move(job));
+        }
+        hasWork.notify_one();
+        return id;
+    }
+
+    // Several pages of one frame, accepted together or not at all. They
+    // share one read-only copy of the frame and are spread over the
+    // workers, so the pages are warped, enhanced and written in parallel.
+    // Returns the first job id (the rest follow in order) or 0.
+    unsigned long long submitAll(const cv::Mat& frame, const std::vector<SavePage>& pages, bool enhance,
+        const EncodedFrame& original = EncodedFrame()) {
+        if (pages.empty()) return 0;
+        unsigned long long first;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping || queue.size() + active + pages.size() > capacity) return 0;
+
+            cv::Mat shared = frame.clone();
+            first = nextId + 1;
+            for (size_t i = 0; i < pages.size(); i++) {
+                SaveJob job;
+                job.id = ++nextId;
+                job.frame = shared;
+                job.document = pages[i].document;
+                job.filename = pages[i].filename;
+                job.enhance = enhance;
+                job.qualityScore = pages[i].qualityScore;
+                job.docId = pages[i].docId;
+                job.stream = pages[i].stream;
+                job.original = original;
+                queue.push_back(std::move(job));
+            }
+        }
+        hasWork.notify_all();
+        return first;
+    }
+
+    const char* fileExtension() const { return DocumentEncoder::extensionFor(encoderSettings.format); }
+
+    // Sends every page to `session` (open, JPEG encoding). Call before the
+    // first submit(): the session expects job ids from 1.
+    void setPdfSession(PdfSessionWriter* session) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pdfSession = session;
+    }
+
+    bool full() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queue.size() + active >= capacity;
+    }
+
+    size_t pending() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queue.size() + active;
+    }
+
+    // Warp cache totals over all workers
+    unsigned long long warpCacheHits() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return cacheHits;
+    }
+
+    unsigned long long warpCacheMisses() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return cacheMisses;
+    }
+
+    // Moves finished saves into `out` (appends); never blocks on a worker
+    void pollCompleted(std::vector<SaveResult>& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < completed.size(); i++) {
+            out.push_back(completed[i]);
+        }
+        completed.clear();
+    }
+
+    // Finishes every queued job, then stops the workers
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping && workers.empty()) return;
+            stopping = true;
+        }
+        hasWork.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+        workers.clear();
+    }
+
+private:
+    // Swaps the scaled capture frame for its full-resolution original and
+    // scales the quad to match. Keeps the scaled frame if decoding fails.
+    static void useOriginal(SaveJob& job) {
+        cv::Mat encoded(1, (int)job.original.jpeg->size(), CV_8UC1, (void*)job.original.jpeg->data());
+        cv::Mat full = cv::imdecode(encoded, cv::IMREAD_COLOR);
+        if (full.empty() || job.frame.empty()) return;
+        if (job.original.mirrored) cv::flip(full, full, 1);
+
+        double sx = (double)full.cols / job.frame.cols;
+        double sy = (double)full.rows / job.frame.rows;
+        for (size_t i = 0; i < job.document.size(); i++) {
+            // Pixel centers: x_full + 0.5 = (x + 0.5) * sx
+            job.document[i].x = cvRound((job.document[i].x + 0.5) * sx - 0.5);
+            job.document[i].y = cvRound((job.document[i].y + 0.5) * sy - 0.5);
+        }
+        job.frame = full;
+    }
+
+    void workerLoop() {
+        WarpWorkspace warpWs;
+        warpWs.cache.setEpsilon(cacheEpsilon);
+        DocumentEncoder encoder(encoderSettings);
+        std::vector<uchar> encoded;
+        while (true) {
+            SaveJob job;
+            PdfSessionWriter* pdf;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                hasWork.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                job = std::move(queue.front());
+                queue.pop_front();
+                active++;
+                pdf = pdfSession;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            unsigned long long hitsBefore = warpWs.cache.hits(), missesBefore = warpWs.cache.misses();
+            bool ok = false;
+            bool handedToPdf = false;
+            double encodeMs = 0.0;
+            encoded.clear();
+            try {
+                cv::Mat warped;
+                {
+                    ESP_DOC_TIME_STAGE(SaveWarp);
+                    if (job.original.jpeg) useOriginal(job);
+                    warped = BalancedDocumentWarper::warpDocument(job.frame, job.document, warpWs, job.enhance);
+                }
+                bool encodedOk = false;
+                if (!warped.empty()) {
+                    ESP_DOC_TIME_STAGE(SaveEncode);
+                    auto encodeStart = std::chrono::steady_clock::now();
+                    encodedOk = encoder.encode(warped, encoded);
+                    encodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encodeStart).count();
+                }
+                if (encodedOk) {
+                    ESP_DOC_TIME_STAGE(SaveWrite);
+                    if (pdf != NULL) {
+                        handedToPdf = true;
+                        ok = pdf->addPage(job.id, encoded);
+                    }
+                    else {
+                        ok = writeFileBytes(job.filename, encoded);
+                    }
+                }
+            }
+            catch (const cv::Exception&) {
+                ok = false;
+            }
+            if (pdf != NULL && !handedToPdf) pdf->skip(job.id);     // later pages must not wait for it
+            double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            SaveResult result;
+            result.id = job.id;
+            result.filename = pdf != NULL ? pdf->path() : job.filename;
+            result.ok = ok;
+            result.qualityScore = job.qualityScore;
+            result.docId = job.docId;
+            result.stream = job.stream;
+            result.elapsedMs = elapsedMs;
+            result.encodeMs = encodeMs;
+            result.bytes = ok ? encoded.size() : 0;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            completed.push_back(result);
+            cacheHits += warpWs.cache.hits() - hitsBefore;
+            cacheMisses += warpWs.cache.misses() - missesBefore;
+            active--;
+        }
+    }
+
+    mutable std::mutex mutex;
+    std::condition_variable hasWork;
+    std::deque<SaveJob> queue;
+    std::vector<SaveResult> completed;
+    std::vector<std::thread> workers;
+    size_t capacity;
+    size_t active;
+    unsigned long long nextId;
+    bool stopping;
+    double cacheEpsilon;
+    EncoderSettings encoderSettings;
+    PdfSessionWriter* pdfSession;
+    unsigned long long cacheHits, cacheMisses;
+};
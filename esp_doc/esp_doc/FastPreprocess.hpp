@@ -0,0 +1,222 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <vector>
+#include <algorithm>
+
+// A cheaper stand-in for the contour engine's bilateral filter, used by
+// balancedPreprocess() when Config::fastProcessing is set (or the QoS
+// controller degrades to it). Its cost per pixel does not depend on the
+// window radius (beyond the 2r rows that prime each pass), it only
+// allocates when the frame size changes, and it is plain row loops over
+// flat buffers. tools/bench.cpp measures it against
+// cv::bilateralFilter on its reference inputs.
+
+// BORDER_REFLECT_101 index, as cv::boxFilter pads
+inline int reflectIndex(int i, int n) {
+    if (n == 1) return 0;
+    while (i < 0 || i >= n) i = i < 0 ? -i : 2 * n - 2 - i;
+    return i;
+}
+
+// Edge-preserving smoothing with the image as its own guide (the fast
+// guided filter of He and Sun): every pixel becomes a * I + b, with a and b
+// fitted over the window around it and then averaged. Windows much flatter
+// than eps are averaged out, edges much stronger are kept. a and b are
+// fitted on the frame binned 2x2, a quarter of the pixels, and blended back
+// up row by row as they are applied. Window sums slide down the columns and
+// then along the row, so every pixel costs a few additions whatever the
+// radius. The sums are integers; a and b are fitted in float and kept in
+// fixed point. Radius 1 with eps = 16^2 stands in for bilateralFilter(5,
+// 50, 50); tools/bench.cpp reports how often both find the same quad.
+class GuidedSmoother {
+public:
+    GuidedSmoother(int radius = 1, float eps = 256.0f) : r(radius), eps(eps) {}
+
+    // src and dst are CV_8UC1 and may be the same Mat
+    void apply(const cv::Mat& src, cv::Mat& dst) {
+        CV_Assert(src.type() == CV_8UC1);
+        binHalf(src);
+        int w = half.cols, h = half.rows;
+        coefA.create(half.size(), CV_32SC1);
+        coefB.create(half.size(), CV_32SC1);
+        meanA.create(half.size(), CV_32SC1);
+        meanB.create(half.size(), CV_32SC1);
+        for (int i = 0; i < 2; i++) {
+            column[i].resize(w + 2 * r);
+            window[i].resize(w);
+            blended[i].resize(w + 2);
+            expanded[i].resize(2 * w);
+        }
+
+        // Pass 1: a and b of every window, from the sums of I and I^2
+        std::fill(column[0].begin(), column[0].end(), 0);
+        std::fill(column[1].begin(), column[1].end(), 0);
+        for (int y = -2 * r; y < h; y++) {
+            slideColumns(half.ptr<uchar>(reflectIndex(y + r, h)), y > 0 ? half.ptr<uchar>(reflectIndex(y - r - 1, h)) : 0, w);
+            if (y >= 0) fitRow(coefA.ptr<int>(y), coefB.ptr<int>(y), w);
+        }
+
+        // Pass 2: average a and b over the same windows
+        std::fill(column[0].begin(), column[0].end(), 0);
+        std::fill(column[1].begin(), column[1].end(), 0);
+        for (int y = -2 * r; y < h; y++) {
+            slideCoefficients(reflectIndex(y + r, h), y > 0 ? reflectIndex(y - r - 1, h) : -1, w);
+            if (y >= 0) averageRow(meanA.ptr<int>(y), meanB.ptr<int>(y), w);
+        }
+
+        dst.create(src.size(), CV_8UC1);
+        for (int y = 0; y < src.rows; y++) applyRow(src.ptr<uchar>(y), dst.ptr<uchar>(y), y, src.cols);
+    }
+
+    size_t fingerprint() const {
+        const cv::Mat* mats[] = { &half, &coefA, &coefB, &meanA, &meanB };
+        size_t sum = 0;
+        for (size_t i = 0; i < sizeof(mats) / sizeof(mats[0]); i++) sum += (size_t)mats[i]->data;
+        return sum;
+    }
+
+private:
+    static const int kABits = 12;       // a in 1/4096
+    static const int kBBits = 4;        // b in 1/16 gray levels
+
+    // Means of 2x2 blocks; an odd last row or column pairs with itself
+    void binHalf(const cv::Mat& src) {
+        half.create((src.rows + 1) / 2, (src.cols + 1) / 2, CV_8UC1);
+        int pairs = src.cols / 2;
+        for (int y = 0; y < half.rows; y++) {
+            const uchar* r0 = src.ptr<uchar>(2 * y);
+            const uchar* r1 = src.ptr<uchar>(std::min(2 * y + 1, src.rows - 1));
+            uchar* d = half.ptr<uchar>(y);
+            for (int x = 0; x < pairs; x++) {
+                d[x] = (uchar)((r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) >> 2);
+            }
+            if (pairs < half.cols) d[pairs] = (uchar)((r0[2 * pairs] + r1[2 * pairs] + 1) >> 1);
+        }
+    }
+
+    // Column sums are stored r cells in from the left; the r cells on each
+    // side are refilled by reflection for every row. `out` = 0 while the
+    // window is first filled.
+    void slideColumns(const uchar* in, const uchar* out, int w) {
+        int* s = column[0].data() + r;
+        int* sq = column[1].data() + r;
+        for (int x = 0; x < w; x++) {
+            int v = in[x];
+            s[x] += v;
+            sq[x] += v * v;
+        }
+        if (!out) return;
+        for (int x = 0; x < w; x++) {
+            int v = out[x];
+            s[x] -= v;
+            sq[x] -= v * v;
+        }
+    }
+
+    void slideCoefficients(int in, int out, int w) {
+        const int* ia = coefA.ptr<int>(in);
+        const int* ib = coefB.ptr<int>(in);
+        int* ca = column[0].data() + r;
+        int* cb = column[1].data() + r;
+        for (int x = 0; x < w; x++) {
+            ca[x] += ia[x];
+            cb[x] += ib[x];
+        }
+        if (out < 0) return;
+        const int* oa = coefA.ptr<int>(out);
+        const int* ob = coefB.ptr<int>(out);
+        for (int x = 0; x < w; x++) {
+            ca[x] -= oa[x];
+            cb[x] -= ob[x];
+        }
+    }
+
+    // window[i][x] = sum of the 2r + 1 column sums centered on x
+    void sumWindows(int w) {
+        for (int i = 0; i < 2; i++) {
+            int* col = column[i].data();
+            for (int k = 1; k <= r; k++) {
+                col[r - k] = col[r + reflectIndex(-k, w)];
+                col[r + w - 1 + k] = col[r + reflectIndex(w - 1 + k, w)];
+            }
+            int* sum = window[i].data();
+            int running = 0;
+            for (int k = 0; k <= 2 * r; k++) running += col[k];
+            sum[0] = running;
+            for (int x = 1; x < w; x++) {
+                running += col[x + 2 * r] - col[x - 1];
+                sum[x] = running;
+            }
+        }
+    }
+
+    // a = var / (var + eps), b = (1 - a) * mean, in fixed point
+    void fitRow(int* a, int* b, int w) {
+        sumWindows(w);
+        const int* sums = window[0].data();
+        const int* sqSums = window[1].data();
+        const int n = (2 * r + 1) * (2 * r + 1);
+        const float invN = 1.0f / n, invNN = invN * invN;
+        for (int x = 0; x < w; x++) {
+            float mean = sums[x] * invN;
+            // n * sum(I^2) passes INT_MAX from radius 7 on
+            float var = (float)((long long)sqSums[x] * n - (long long)sums[x] * sums[x]) * invNN;
+            float fa = var / (var + eps);
+            a[x] = (int)(fa * (1 << kABits) + 0.5f);
+            b[x] = (int)((mean - fa * mean) * (1 << kBBits) + 0.5f);
+        }
+    }
+
+    void averageRow(int* a, int* b, int w) {
+        sumWindows(w);
+        const int* sumA = window[0].data();
+        const int* sumB = window[1].data();
+        const float invN = 1.0f / ((2 * r + 1) * (2 * r + 1));
+        for (int x = 0; x < w; x++) {
+            a[x] = (int)(sumA[x] * invN + 0.5f);
+            b[x] = (int)(sumB[x] * invN + 0.5f);
+        }
+    }
+
+    // Bilinear from the half-size means (weights 1/4 and 3/4 both ways,
+    // 16 in total), then out = a * in + b
+    void applyRow(const uchar* in, uchar* out, int y, int width) {
+        int w = meanA.cols, h = meanA.rows;
+        int y0 = (y - 1) >> 1, wy1 = y & 1 ? 1 : 3;
+        int y1 = std::min(y0 + 1, h - 1);
+        y0 = std::max(y0, 0);
+        for (int i = 0; i < 2; i++) {
+            const cv::Mat& mean = i ? meanB : meanA;
+            const int* m0 = mean.ptr<int>(y0);
+            const int* m1 = mean.ptr<int>(y1);
+            int* v = blended[i].data() + 1;
+            for (int x = 0; x < w; x++) v[x] = m0[x] * (4 - wy1) + m1[x] * wy1;
+            v[-1] = v[0];
+            v[w] = v[w - 1];
+            int* e = expanded[i].data();
+            for (int x = 0; x < w; x++) {
+                e[2 * x] = v[x - 1] + 3 * v[x];
+                e[2 * x + 1] = 3 * v[x] + v[x + 1];
+            }
+        }
+
+        const int* a = expanded[0].data();
+        const int* b = expanded[1].data();
+        const int shift = kABits + 4;
+        for (int x = 0; x < width; x++) {
+            int q = (a[x] * in[x] + (b[x] << (kABits - kBBits)) + (1 << (shift - 1))) >> shift;
+            out[x] = (uchar)(q < 0 ? 0 : q > 255 ? 255 : q);
+        }
+    }
+
+    int r;
+    float eps;
+    cv::Mat half;                       // the frame binned 2x2, where a and b are fitted
+    cv::Mat coefA, coefB;               // CV_32SC1, fixed point
+    cv::Mat meanA, meanB;               // window averages of a and b
+    std::vector<int> column[2];         // sums down the window: I and I^2, then a and b
+    std::vector<int> window[2];
+    std::vector<int> blended[2];        // applyRow: means blended between two half rows
+    std::vector<int> expanded[2];       // ...and across to full width
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Building blocks for the capture -> detect -> display pipeline.
+// Frames live in a fixed pool of slots; only slot indices travel between
+// threads, so the cv::Mat buffers are allocated once and reused forever.
+
+// Bounded lock-free ring for exactly one producer and one consumer thread.
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    // Returns false when the queue is full (the caller decides what to drop)
+    bool push(const T& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity) return false;
+        items[t & (Capacity - 1)] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& out) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        out = items[h & (Capacity - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::array<T, Capacity> items;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+// Fixed set of reusable slots. Any thread may acquire or release a slot.
+template <typename Slot, size_t Count>
+class SlotPool {
+public:
+    SlotPool() {
+        for (size_t i = 0; i < Count; i++) {
+            inUse[i].store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns -1 when every slot is busy downstream
+    int acquire() {
+        for (size_t i = 0; i < Count; i++) {
+            bool expected = false;
+            if (!inUse[i].load(std::memory_order_relaxed) &&
+                inUse[i].compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+
+    void release(int index) {
+        if (index >= 0) inUse[index].store(false, std::memory_order_release);
+    }
+
+    Slot& operator[](int index) { return slots[index]; }
+    const Slot& operator[](int index) const { return slots[index]; }
+
+private:
+    std::array<Slot, Count> slots;
+    std::array<std::atomic<bool>, Count> inUse;
+};
+
+// Single-entry mailbox holding only the newest published slot.
+// The producer gets the previous, never-consumed slot back so it can be
+// recycled: stale frames are dropped instead of queued behind new ones.
+class LatestSlot {
+public:
+    LatestSlot() : slot(-1) {}
+
+    // Returns the stale slot that was replaced, or -1 if it was consumed
+    int publish(int index) { return slot.exchange(index, std::memory_order_acq_rel); }
+
+    // Returns the newest slot, or -1 if nothing new arrived
+    int take() { return slot.exchange(-1, std::memory_order_acq_rel); }
+
+private:
+    std::atomic<int> slot;
+};
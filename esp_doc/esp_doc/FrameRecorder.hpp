@@ -0,0 +1,555 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN     // keeps winsock.h out, HttpServer.hpp uses winsock2.h
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "FrameSource.hpp"
+#include "JpegHeader.hpp"
+#include "MjpegStreamSource.hpp"
+
+// Session recordings: the frames the capture stage decoded, exactly as the
+// detector got them (before the mirror flip), with their capture times.
+//
+// File layout (native byte order, i.e. little-endian on x86 and ARM):
+//   64-byte file header: "ESPDREC1", header size, format version
+//   one chunk per frame: 64-byte RecordedChunk header, the frame, the
+//                        full-resolution JPEG original if the frame was
+//                        decoded scaled and is not itself stored as that
+//                        JPEG, zero padding to a 64-byte boundary
+// A frame from an MJPEG stream is stored as the camera's JPEG; rows and cols
+// give the size it was decoded to, which replays the same scaled decode.
+// Other frames are stored as PNG (lossless). The file is only ever appended
+// to; a chunk cut short by a crash is ignored on reading. Version 1 files
+// (raw pixel rows) are still read.
+const char kRecordingMagic[8] = { 'E', 'S', 'P', 'D', 'R', 'E', 'C', '1' };
+const uint32_t kRecordingVersion = 2;
+const size_t kRecordingAlign = 64;
+
+// RecordedChunk::encoding
+const uint32_t kRecordedRaw = 0;        // pixel rows, no row padding
+const uint32_t kRecordedJpeg = 1;       // the JPEG the frame was decoded from
+const uint32_t kRecordedPng = 2;
+
+struct RecordedChunk {
+    char magic[4];                      // "FRME"
+    uint32_t headerSize;                // sizeof(RecordedChunk)
+    uint64_t sequence;                  // capture order; a gap = frames the recorder dropped
+    int64_t captureTimeMs;
+    int32_t rows;
+    int32_t cols;
+    int32_t type;                       // cv::Mat type, CV_8UC3 for camera frames
+    uint32_t encoding;                  // kRecorded*; version 1: bytes per row, always raw
+    uint64_t pixelBytes;                // the stored frame
+    uint64_t originalBytes;             // 0 = full size, or the frame is the original JPEG
+    uint64_t chunkBytes;                // header, payload and padding: the next chunk starts here
+};
+static_assert(sizeof(RecordedChunk) == 64, "RecordedChunk must stay 64 bytes");
+
+// Appends frames to a recording. record() keeps a reference to the frame's
+// JPEG or copies the frame into a reused buffer; PNG encoding and the disk
+// writes happen on the recorder's own thread. When
+// the disk falls behind by queueFrames frames, frames are left out of the
+// recording (counted, and visible as sequence gaps) rather than stalling
+// the capture stage.
+class FrameRecorder {
+public:
+    FrameRecorder() : file(NULL), capacity(8), running(false), nextSequence(0), recorded(0), dropped(0), failed(false) {
+        pngParams.push_back(cv::IMWRITE_PNG_COMPRESSION);
+        pngParams.push_back(1);         // the fastest level: encoded on the writer thread at frame rate
+    }
+
+    ~FrameRecorder() {
+        close();
+    }
+
+    bool open(const std::string& recordingPath, size_t queueFrames = 8) {
+        close();
+        file = std::fopen(recordingPath.c_str(), "wb");
+        if (file == NULL) return false;
+
+        char header[kRecordingAlign];
+        std::memset(header, 0, sizeof(header));
+        std::memcpy(header, kRecordingMagic, sizeof(kRecordingMagic));
+        uint32_t headerSize = (uint32_t)kRecordingAlign;
+        std::memcpy(header + 8, &headerSize, 4);
+        std::memcpy(header + 12, &kRecordingVersion, 4);
+        if (std::fwrite(header, 1, sizeof(header), file) != sizeof(header) || std::fflush(file) != 0) {
+            std::fclose(file);
+            file = NULL;
+            return false;
+        }
+
+        filePath = recordingPath;
+        capacity = queueFrames > 0 ? queueFrames : 1;
+        nextSequence = 0;
+        recorded = 0;
+        dropped = 0;
+        failed = false;
+        running = true;
+        writerThread = std::thread(&FrameRecorder::writeLoop, this);
+        return true;
+    }
+
+    // Capture thread. `compressed` is the JPEG `frame` was decoded from
+    // (FrameSource::compressedFrame()), stored instead of the pixels.
+    // false = left out of the recording (queue full or closed)
+    bool record(const cv::Mat& frame, long long captureTimeMs, const EncodedFrame& original,
+        const std::shared_ptr<const std::vector<uchar> >& compressed) {
+        Entry entry;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running) return false;
+            entry.sequence = nextSequence++;
+            if (queue.size() >= capacity) {
+                dropped++;
+                return false;
+            }
+            if (!compressed && !spare.empty()) {
+                entry.frame = spare.back();
+                spare.pop_back();
+            }
+        }
+        if (compressed) {
+            entry.jpeg = compressed;
+            entry.size = frame.size();
+            entry.type = frame.type();
+        }
+        else {
+            frame.copyTo(entry.frame);
+        }
+        entry.captureTime = captureTimeMs;
+        if (original.jpeg != compressed) entry.original = original.jpeg;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(entry);
+        }
+        wake.notify_one();
+        return true;
+    }
+
+    // Writes what is queued and closes the file
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wake.notify_one();
+        if (writerThread.joinable()) writerThread.join();
+        if (file != NULL) {
+            std::fclose(file);
+            file = NULL;
+        }
+    }
+
+    unsigned long long framesRecorded() const { return recorded; }
+    unsigned long long framesDropped() const { return dropped; }
+    bool writeFailed() const { return failed; }
+    const std::string& path() const { return filePath; }
+
+private:
+    struct Entry {
+        cv::Mat frame;                  // empty when stored as `jpeg`
+        std::shared_ptr<const std::vector<uchar> > jpeg;
+        cv::Size size;                  // of the frame decoded from `jpeg`
+        int type;
+        long long captureTime;
+        std::shared_ptr<const std::vector<uchar> > original;
+        uint64_t sequence;
+    };
+
+    void writeLoop() {
+        while (true) {
+            Entry entry;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return !queue.empty() || !running; });
+                if (queue.empty()) return;
+                entry = queue.front();
+                queue.pop_front();
+            }
+            if (!failed && writeChunk(entry)) recorded++;
+            else failed = true;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!entry.frame.empty()) spare.push_back(entry.frame);
+        }
+    }
+
+    bool writeChunk(const Entry& entry) {
+        const cv::Mat& frame = entry.frame;
+        RecordedChunk chunk;
+        std::memset(&chunk, 0, sizeof(chunk));
+        std::memcpy(chunk.magic, "FRME", 4);
+        chunk.headerSize = sizeof(RecordedChunk);
+        chunk.sequence = entry.sequence;
+        chunk.captureTimeMs = entry.captureTime;
+
+        // The frame's bytes: its JPEG, a PNG, or (PNG encoding failed) the rows
+        const uchar* stored = NULL;
+        size_t rowBytes = 0;
+        if (entry.jpeg) {
+            chunk.rows = entry.size.height;
+            chunk.cols = entry.size.width;
+            chunk.type = entry.type;
+            chunk.encoding = kRecordedJpeg;
+            stored = entry.jpeg->data();
+            chunk.pixelBytes = entry.jpeg->size();
+        }
+        else {
+            chunk.rows = frame.rows;
+            chunk.cols = frame.cols;
+            chunk.type = frame.type();
+            if (cv::imencode(".png", frame, encoded, pngParams)) {
+                chunk.encoding = kRecordedPng;
+                stored = encoded.data();
+                chunk.pixelBytes = encoded.size();
+            }
+            else {
+                chunk.encoding = kRecordedRaw;
+                rowBytes = frame.cols * frame.elemSize();
+                chunk.pixelBytes = (uint64_t)rowBytes * frame.rows;
+            }
+        }
+        chunk.originalBytes = entry.original ? entry.original->size() : 0;
+        uint64_t payload = chunk.pixelBytes + chunk.originalBytes;
+        uint64_t padding = (kRecordingAlign - payload % kRecordingAlign) % kRecordingAlign;
+        chunk.chunkBytes = sizeof(RecordedChunk) + payload + padding;
+
+        static const char zeros[kRecordingAlign] = {};
+        bool ok = std::fwrite(&chunk, sizeof(chunk), 1, file) == 1;
+        if (stored != NULL) {
+            ok = ok && std::fwrite(stored, 1, (size_t)chunk.pixelBytes, file) == chunk.pixelBytes;
+        }
+        for (int y = 0; ok && stored == NULL && y < frame.rows; y++) {
+            ok = std::fwrite(frame.ptr(y), 1, rowBytes, file) == rowBytes;
+        }
+        if (ok && chunk.originalBytes > 0) {
+            ok = std::fwrite(entry.original->data(), 1, entry.original->size(), file) == entry.original->size();
+        }
+        if (ok && padding > 0) ok = std::fwrite(zeros, 1, (size_t)padding, file) == padding;
+        // Complete chunks reach the OS, so a crash loses at most the one being written
+        return ok && std::fflush(file) == 0;
+    }
+
+    FILE* file;
+    std::string filePath;
+    size_t capacity;
+    std::thread writerThread;
+    std::mutex mutex;                   // queue, spare, running, nextSequence
+    std::condition_variable wake;
+    std::deque<Entry> queue;
+    std::vector<cv::Mat> spare;         // written frames' buffers, reused by record()
+    std::vector<int> pngParams;
+    std::vector<uchar> encoded;         // writer thread: the PNG being written
+    bool running;
+    uint64_t nextSequence;
+    std::atomic<unsigned long long> recorded;
+    std::atomic<unsigned long long> dropped;
+    std::atomic<bool> failed;
+};
+
+// Read-only memory map of a whole file
+class MappedFile {
+public:
+    MappedFile() : base(NULL), length(0) {}
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        HANDLE mapping = NULL;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+            mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        }
+        if (mapping != NULL) {
+            base = (const uchar*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            length = (size_t)size.QuadPart;
+            CloseHandle(mapping);       // the view keeps the mapping alive
+        }
+        CloseHandle(file);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                base = (const uchar*)mapped;
+                length = (size_t)st.st_size;
+                madvise(mapped, length, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);                    // the mapping stays valid
+#endif
+        if (base == NULL) length = 0;
+        return base != NULL;
+    }
+
+    void close() {
+        if (base == NULL) return;
+#ifdef _WIN32
+        UnmapViewOfFile(base);
+#else
+        munmap((void*)base, length);
+#endif
+        base = NULL;
+        length = 0;
+    }
+
+    const uchar* data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uchar* base;
+    size_t length;
+};
+
+// Random access to the frames of a mapped recording
+class RecordingReader {
+public:
+    RecordingReader() : version(0), incomplete(false) {}
+
+    // Maps the file and indexes its complete chunks
+    bool open(const std::string& path, std::string& error) {
+        close();
+        if (!map.open(path)) {
+            error = "cannot map " + path;
+            return false;
+        }
+        const uchar* data = map.data();
+        size_t size = map.size();
+        uint32_t headerSize = 0;
+        if (size >= kRecordingAlign) {
+            std::memcpy(&headerSize, data + 8, 4);
+            std::memcpy(&version, data + 12, 4);
+        }
+        if (size < kRecordingAlign || std::memcmp(data, kRecordingMagic, sizeof(kRecordingMagic)) != 0 ||
+            version < 1 || version > kRecordingVersion || headerSize < kRecordingAlign || headerSize % kRecordingAlign != 0) {
+            error = path + " is not an esp_doc recording";
+            close();
+            return false;
+        }
+
+        size_t offset = headerSize;
+        while (offset + sizeof(RecordedChunk) <= size) {
+            const RecordedChunk* chunk = (const RecordedChunk*)(data + offset);
+            uint64_t rowBytes = (uint64_t)chunk->cols * CV_ELEM_SIZE(chunk->type);
+            uint32_t encoding = version == 1 ? kRecordedRaw : chunk->encoding;
+            bool valid = std::memcmp(chunk->magic, "FRME", 4) == 0 && chunk->headerSize == sizeof(RecordedChunk) &&
+                chunk->rows > 0 && chunk->cols > 0 && encoding <= kRecordedPng &&
+                (version > 1 || chunk->encoding == rowBytes) &&
+                (encoding != kRecordedRaw || chunk->pixelBytes == rowBytes * chunk->rows) &&
+                chunk->chunkBytes >= sizeof(RecordedChunk) + chunk->pixelBytes + chunk->originalBytes &&
+                chunk->chunkBytes % kRecordingAlign == 0 && chunk->chunkBytes <= size - offset;
+            if (!valid) break;
+            chunks.push_back(chunk);
+            offset += (size_t)chunk->chunkBytes;
+        }
+        incomplete = offset != size;
+        return true;
+    }
+
+    void close() {
+        chunks.clear();
+        map.close();
+        version = 0;
+        incomplete = false;
+    }
+
+    size_t frameCount() const { return chunks.size(); }
+
+    // A partly written chunk (or garbage) after the last complete frame was ignored
+    bool truncated() const { return incomplete; }
+
+    // Decodes frame i into `dst` as the capture stage had it; `scratch`
+    // holds the intermediate image of a scaled JPEG decode between calls
+    bool frame(size_t i, cv::Mat& dst, cv::Mat& scratch) const {
+        const RecordedChunk* chunk = chunks[i];
+        cv::Size size(chunk->cols, chunk->rows);
+        uint32_t encoding = encodingOf(i);
+        if (encoding == kRecordedRaw) {
+            cv::Mat(size, chunk->type, (void*)(chunk + 1)).copyTo(dst);
+            return true;
+        }
+
+        cv::Mat stored(1, (int)chunk->pixelBytes, CV_8UC1, (void*)(chunk + 1));
+        cv::Size full;
+        int factor;
+        if (encoding == kRecordedJpeg && jpegDimensions((const uchar*)(chunk + 1), (size_t)chunk->pixelBytes, full) &&
+            (full.width > size.width || full.height > size.height)) {
+            if (!decodeJpegToSize(stored, full, size, dst, scratch, factor)) return false;
+        }
+        else {
+            cv::imdecode(stored, encoding == kRecordedJpeg ? cv::IMREAD_COLOR : cv::IMREAD_UNCHANGED, &dst);
+        }
+        return dst.size() == size && dst.type() == chunk->type;
+    }
+
+    // The JPEG frame i was decoded from (empty unless it was recorded from
+    // an MJPEG stream)
+    void compressed(size_t i, std::vector<uchar>& jpeg) const {
+        const RecordedChunk* chunk = chunks[i];
+        const uchar* begin = (const uchar*)(chunk + 1);
+        if (encodingOf(i) == kRecordedJpeg) jpeg.assign(begin, begin + chunk->pixelBytes);
+        else jpeg.clear();
+    }
+
+    long long captureTime(size_t i) const { return (long long)chunks[i]->captureTimeMs; }
+    unsigned long long sequence(size_t i) const { return (unsigned long long)chunks[i]->sequence; }
+
+    // Full-resolution JPEG recorded with frame i; empty when it was full size
+    void original(size_t i, std::vector<uchar>& jpeg) const {
+        const RecordedChunk* chunk = chunks[i];
+        if (chunk->originalBytes == 0 && hasOriginal(i)) {
+            compressed(i, jpeg);
+            return;
+        }
+        const uchar* begin = (const uchar*)(chunk + 1) + chunk->pixelBytes;
+        jpeg.assign(begin, begin + chunk->originalBytes);
+    }
+
+    // Frame i was decoded scaled: from its stored JPEG, or with the original appended
+    bool hasOriginal(size_t i) const {
+        const RecordedChunk* chunk = chunks[i];
+        if (chunk->originalBytes > 0) return true;
+        cv::Size full;
+        return encodingOf(i) == kRecordedJpeg &&
+            jpegDimensions((const uchar*)(chunk + 1), (size_t)chunk->pixelBytes, full) &&
+            (full.width > chunk->cols || full.height > chunk->rows);
+    }
+
+private:
+    uint32_t encodingOf(size_t i) const { return version == 1 ? kRecordedRaw : chunks[i]->encoding; }
+
+    MappedFile map;
+    std::vector<const RecordedChunk*> chunks;
+    uint32_t version;
+    bool incomplete;
+};
+
+// streamUrl = "replay:<file>" plays a recording instead of a camera
+inline bool parseReplayUrl(const std::string& url, std::string& path) {
+    const std::string scheme = "replay:";
+    if (url.compare(0, scheme.size(), scheme) != 0) return false;
+    path = url.substr(scheme.size());
+    return true;
+}
+
+// Plays a recording back as a camera: at the recorded frame times, or with
+// originalTiming off as fast as the caller reads
+class RecordingSource : public FrameSource {
+public:
+    RecordingSource() : next(0), current(0), originalTiming(true) {}
+
+    bool open(const std::string& path, bool atOriginalTiming, std::string& error) {
+        if (!reader.open(path, error)) return false;
+        if (reader.frameCount() == 0) {
+            error = path + " holds no frames";
+            reader.close();
+            return false;
+        }
+        name = path;
+        originalTiming = atOriginalTiming;
+        next = 0;
+        current = 0;
+        return true;
+    }
+
+    bool read(cv::Mat& frame) {
+        if (!advance()) return false;
+        if (!reader.frame(current, frame, scratch)) return false;
+        lastJpeg.reset();
+        lastOriginal.reset();
+        if (reader.hasOriginal(current)) {
+            std::shared_ptr<std::vector<uchar> > jpeg(new std::vector<uchar>());
+            reader.original(current, *jpeg);
+            lastOriginal = jpeg;
+        }
+        std::vector<uchar> stored;
+        reader.compressed(current, stored);
+        if (!stored.empty()) {
+            // Usually the original itself; shared so a re-recording stores it once
+            if (lastOriginal && *lastOriginal == stored) lastJpeg = lastOriginal;
+            else lastJpeg = std::make_shared<const std::vector<uchar> >(std::move(stored));
+        }
+        return true;
+    }
+
+    void grab() { advance(); }
+
+    EncodedFrame original() const {
+        EncodedFrame encoded;
+        encoded.jpeg = lastOriginal;
+        return encoded;
+    }
+
+    std::shared_ptr<const std::vector<uchar> > compressedFrame() const { return lastJpeg; }
+
+    std::string describe() const {
+        return "recording " + name + " (" + std::to_string(reader.frameCount()) + " frames" +
+            (originalTiming ? ", original timing)" : ", as fast as possible)");
+    }
+
+    bool finished() const { return next >= reader.frameCount(); }
+
+    // Index, recorded capture time and capture sequence of the last frame read
+    size_t frameIndex() const { return current; }
+    long long captureTime() const { return reader.captureTime(current); }
+    unsigned long long sequence() const { return reader.sequence(current); }
+
+    const RecordingReader& recording() const { return reader; }
+
+    void close() { reader.close(); }
+
+private:
+    // Steps to the next frame; with original timing, waits until its time
+    bool advance() {
+        if (next >= reader.frameCount()) return false;
+        if (originalTiming) {
+            if (next == 0) start = std::chrono::steady_clock::now();
+            std::this_thread::sleep_until(start + std::chrono::milliseconds(reader.captureTime(next) - reader.captureTime(0)));
+        }
+        current = next++;
+        return true;
+    }
+
+    RecordingReader reader;
+    std::string name;
+    size_t next;
+    size_t current;
+    bool originalTiming;
+    std::chrono::steady_clock::time_point start;
+    cv::Mat scratch;
+    std::shared_ptr<const std::vector<uchar> > lastOriginal;
+    std::shared_ptr<const std::vector<uchar> > lastJpeg;
+};
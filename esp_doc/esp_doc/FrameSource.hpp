@@ -0,0 +1,82 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Compressed full-resolution original of a capture frame that was decoded
+// at a reduced size. Only decoded again if the frame gets saved.
+struct EncodedFrame {
+    std::shared_ptr<const std::vector<uchar> > jpeg;   // empty when the frame is already full size
+    bool mirrored;                                      // the capture frame was flipped horizontally
+
+    EncodedFrame() : mirrored(false) {}
+};
+
+// Where the capture stage gets its frames from
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    // Newest frame at (or near) the capture size. false = nothing this time.
+    virtual bool read(cv::Mat& frame) = 0;
+
+    // Drops a frame without decoding it (all pipeline buffers are busy)
+    virtual void grab() = 0;
+
+    // Original of the frame the last read() returned
+    virtual EncodedFrame original() const { return EncodedFrame(); }
+
+    // The compressed data the last read() decoded its frame from (the
+    // camera's JPEG), if the source has one. Lets a recording keep the
+    // JPEG instead of the pixels.
+    virtual std::shared_ptr<const std::vector<uchar> > compressedFrame() const {
+        return std::shared_ptr<const std::vector<uchar> >();
+    }
+
+    // A finite source (a recording) has delivered its last frame
+    virtual bool finished() const { return false; }
+
+    virtual std::string describe() const = 0;
+};
+
+// cv::VideoCapture: FFMPEG for network streams, DirectShow/V4L for webcams
+class VideoCaptureSource : public FrameSource {
+public:
+    // Tries the stream first and falls back to the first webcam
+    bool open(const std::string& url, int width, int height, int fps, int bufferSize) {
+        if (!url.empty()) {
+            cap.open(url, cv::CAP_FFMPEG);
+            name = url;
+        }
+        if (!cap.isOpened()) {
+            if (!url.empty()) std::cout << "IP camera failed, trying webcam..." << std::endl;
+#ifdef _WIN32
+            cap.open(0, cv::CAP_DSHOW);
+#else
+            cap.open(0);
+#endif
+            name = "webcam 0";
+        }
+        if (!cap.isOpened()) return false;
+
+        cap.set(cv::CAP_PROP_FRAME_WIDTH, width);
+        cap.set(cv::CAP_PROP_FRAME_HEIGHT, height);
+        cap.set(cv::CAP_PROP_FPS, fps);
+        cap.set(cv::CAP_PROP_BUFFERSIZE, bufferSize);
+        return true;
+    }
+
+    bool read(cv::Mat& frame) { return cap.read(frame) && !frame.empty(); }
+    void grab() { cap.grab(); }
+    std::string describe() const { return "VideoCapture (" + name + ")"; }
+
+    void release() { cap.release(); }
+
+private:
+    cv::VideoCapture cap;
+    std::string name;
+};
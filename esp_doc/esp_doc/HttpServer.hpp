@@ -0,0 +1,286 @@
+#pragma once
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Minimal socket helpers shared by the local HTTP endpoints and clients
+namespace net {
+#ifdef _WIN32
+    typedef SOCKET Socket;
+    const Socket kInvalidSocket = INVALID_SOCKET;
+
+    inline bool startup() {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }
+    inline void cleanup() { WSACleanup(); }
+    inline void closeSocket(Socket s) { closesocket(s); }
+#else
+    typedef int Socket;
+    const Socket kInvalidSocket = -1;
+
+    inline bool startup() {
+        // A client hanging up mid-response must not kill the scanner
+        signal(SIGPIPE, SIG_IGN);
+        return true;
+    }
+    inline void cleanup() {}
+    inline void closeSocket(Socket s) { ::close(s); }
+#endif
+
+    // Sends everything or reports failure (client gone)
+    inline bool sendAll(Socket s, const char* data, size_t size) {
+        while (size > 0) {
+            int sent = (int)::send(s, data, (int)size, 0);
+            if (sent <= 0) return false;
+            data += sent;
+            size -= (size_t)sent;
+        }
+        return true;
+    }
+
+    // Blocking TCP connect to host:port (name or address); kInvalidSocket on failure
+    inline Socket connectTcp(const std::string& host, int port) {
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = 0;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0) return kInvalidSocket;
+
+        Socket s = kInvalidSocket;
+        for (addrinfo* ai = found; ai != 0 && s == kInvalidSocket; ai = ai->ai_next) {
+            s = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (s == kInvalidSocket) continue;
+            if (::connect(s, ai->ai_addr, (int)ai->ai_addrlen) != 0) {
+                closeSocket(s);
+                s = kInvalidSocket;
+            }
+        }
+        freeaddrinfo(found);
+        return s;
+    }
+
+    // Bounds how long a send to a stalled client may block
+    inline void setSendTimeout(Socket s, int timeoutMs) {
+#ifdef _WIN32
+        DWORD ms = (DWORD)timeoutMs;
+        setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char*)&ms, sizeof(ms));
+#else
+        timeval tv;
+        tv.tv_sec = timeoutMs / 1000;
+        tv.tv_usec = (timeoutMs % 1000) * 1000;
+        setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+#endif
+    }
+
+    // Waits up to timeoutMs for `s` to become readable
+    inline bool waitReadable(Socket s, int timeoutMs) {
+        fd_set set;
+        FD_ZERO(&set);
+        FD_SET(s, &set);
+        timeval tv;
+        tv.tv_sec = timeoutMs / 1000;
+        tv.tv_usec = (timeoutMs % 1000) * 1000;
+        return select((int)s + 1, &set, 0, 0, &tv) > 0;
+    }
+}
+
+// One accepted connection, handed to the request handler
+class HttpResponder {
+public:
+    explicit HttpResponder(net::Socket s) : sock(s), detached(false) {}
+
+    bool send(const char* data, size_t size) { return net::sendAll(sock, data, size); }
+    bool send(const std::string& text) { return send(text.data(), text.size()); }
+
+    // Complete response with Content-Length; the connection closes after it
+    bool respond(int status, const std::string& contentType, const std::string& body) {
+        std::string head = "HTTP/1.1 " + std::to_string(status) + (status == 200 ? " OK" : " Error") +
+            "\r\nContent-Type: " + contentType +
+            "\r\nContent-Length: " + std::to_string(body.size()) +
+            "\r\nConnection: close\r\n\r\n";
+        return send(head) && send(body);
+    }
+
+    net::Socket socket() const { return sock; }
+
+    // Hands the connection over to the caller, who must close it; the
+    // server then moves on without closing it (long-lived streams)
+    net::Socket detach() {
+        detached = true;
+        return sock;
+    }
+
+    bool isDetached() const { return detached; }
+
+private:
+    net::Socket sock;
+    bool detached;
+};
+
+// HTTP/1.1 server on 127.0.0.1 for local tooling (metrics scrapes and the
+// like). One accept thread; each request is handled on it in turn, so
+// handlers should answer quickly (or detach() the connection and serve it
+// elsewhere), and a client gets kRequestTimeoutMs in all to send its
+// headers. Only the request line is handed on. Loopback is not a boundary
+// for a browser: any page it shows may send us a simple cross-origin POST.
+// So requests carrying another site's Origin, and any request but GET or
+// HEAD without an X-Requested-With header (which a cross-origin page can
+// only add after a CORS preflight we never grant), get 403.
+class LocalHttpServer {
+public:
+    typedef std::function<void(const std::string& method, const std::string& path, HttpResponder& out)> Handler;
+
+    LocalHttpServer() : listener(net::kInvalidSocket), listenPort(0), running(false), netStarted(false) {}
+    ~LocalHttpServer() { stop(); }
+
+    static const int kRequestTimeoutMs = 250;
+
+    bool start(int port, Handler requestHandler) {
+        stop();
+        listenPort = port;
+        if (!netStarted && !(netStarted = net::startup())) return false;
+
+        listener = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listener == net::kInvalidSocket) return false;
+
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listener, (const sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 8) != 0) {
+            net::closeSocket(listener);
+            listener = net::kInvalidSocket;
+            return false;
+        }
+
+        handler = requestHandler;
+        running = true;
+        acceptThread = std::thread(&LocalHttpServer::acceptLoop, this);
+        return true;
+    }
+
+    void stop() {
+        running = false;
+        if (acceptThread.joinable()) acceptThread.join();
+        if (listener != net::kInvalidSocket) {
+            net::closeSocket(listener);
+            listener = net::kInvalidSocket;
+        }
+        if (netStarted) {
+            net::cleanup();
+            netStarted = false;
+        }
+    }
+
+    bool isRunning() const { return running; }
+
+private:
+    void acceptLoop() {
+        while (running) {
+            // Short waits so stop() is honoured promptly
+            if (!net::waitReadable(listener, 200)) continue;
+            net::Socket client = accept(listener, 0, 0);
+            if (client == net::kInvalidSocket) continue;
+
+            std::string request, method, path;
+            bool detached = false;
+            if (readRequest(client, request, method, path)) {
+                HttpResponder out(client);
+                if (isForeign(request, method)) {
+                    out.respond(403, "text/plain", "refused: foreign Origin, or a POST without X-Requested-With\n");
+                }
+                else {
+                    handler(method, path, out);
+                    detached = out.isDetached();
+                }
+            }
+            if (!detached) net::closeSocket(client);
+        }
+    }
+
+    // Reads until the end of the headers (or 4 KB, or kRequestTimeoutMs in
+    // all) and splits the request line
+    static bool readRequest(net::Socket client, std::string& request, std::string& method, std::string& path) {
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds((int)kRequestTimeoutMs);
+        char buf[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 4096) {
+            int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0 || !net::waitReadable(client, left)) return false;
+            int got = (int)recv(client, buf, sizeof(buf), 0);
+            if (got <= 0) return false;
+            request.append(buf, (size_t)got);
+        }
+        size_t sp1 = request.find(' ');
+        size_t sp2 = sp1 == std::string::npos ? sp1 : request.find(' ', sp1 + 1);
+        if (sp2 == std::string::npos) return false;
+        method = request.substr(0, sp1);
+        path = request.substr(sp1 + 1, sp2 - sp1 - 1);
+        return true;
+    }
+
+    // Value of header `name` (lower case), or "" when absent
+    static std::string headerValue(const std::string& request, const std::string& name) {
+        size_t line = request.find("\r\n");
+        while (line != std::string::npos) {
+            line += 2;
+            size_t end = request.find("\r\n", line);
+            if (end == std::string::npos || end == line) break;
+            size_t colon = request.find(':', line);
+            if (colon < end && colon - line == name.size()) {
+                bool match = true;
+                for (size_t i = 0; i < name.size() && match; i++) {
+                    match = std::tolower((unsigned char)request[line + i]) == name[i];
+                }
+                if (match) {
+                    size_t start = request.find_first_not_of(" \t", colon + 1);
+                    return start < end ? request.substr(start, end - start) : std::string();
+                }
+            }
+            line = end;
+        }
+        return std::string();
+    }
+
+    bool isForeign(const std::string& request, const std::string& method) const {
+        std::string origin = headerValue(request, "origin");
+        std::string port = ":" + std::to_string(listenPort);
+        if (!origin.empty() && origin != "http://127.0.0.1" + port && origin != "http://localhost" + port) return true;
+        return method != "GET" && method != "HEAD" && headerValue(request, "x-requested-with").empty();
+    }
+
+    net::Socket listener;
+    int listenPort;
+    std::atomic<bool> running;
+    bool netStarted;
+    Handler handler;
+    std::thread acceptThread;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <cstddef>
+
+// Width and height (and optionally the component count: 1 = gray, 3 =
+// YCbCr/RGB, 4 = CMYK) from a JPEG's SOF header; false if there is none
+inline bool jpegDimensions(const uchar* data, size_t size, cv::Size& dims, int* components = NULL) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) return false;
+        uchar marker = data[pos + 1];
+        if (marker == 0xFF) {               // fill byte
+            pos++;
+            continue;
+        }
+        if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            pos += 2;                       // no length field
+            continue;
+        }
+        size_t length = ((size_t)data[pos + 2] << 8) | data[pos + 3];
+        bool isFrameHeader = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (isFrameHeader) {
+            if (pos + 10 > size) return false;
+            dims.height = (data[pos + 5] << 8) | data[pos + 6];
+            dims.width = (data[pos + 7] << 8) | data[pos + 8];
+            if (components != NULL) *components = data[pos + 9];
+            return dims.width > 0 && dims.height > 0;
+        }
+        if (marker == 0xDA || marker == 0xD9) return false;    // scan data before any SOF
+        pos += 2 + length;
+    }
+    return false;
+}
@@ -0,0 +1,512 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Config.hpp"
+#include "DetectorEngine.hpp"
+#include "Metrics.hpp"
+
+// Line engine tuning; lengths in pixels of the searched image
+const double kLineMinLength = 0.06;         // segments shorter than this fraction of the short side are ignored
+const int kMaxQuadLines = 24;               // longest merged lines that are paired into quads
+const double kLineMergeSin = 0.05;          // segments within ~3 degrees...
+const double kLineMergeDistance = 1.5;      // ...and this far from a line extend it
+const double kMinOppositeCos = 0.82;        // opposite edges at most ~35 degrees apart
+const double kMaxCornerCos = 0.87;          // adjacent edges at least ~30 degrees apart
+const double kMinEdgeCoverage = 0.35;       // share of every edge covered by segments
+const double kMinMeanCoverage = 0.6;        // ... and of all four on average
+const double kOvershootGap = 0.15;          // a line continuing over half of this fraction of the
+                                            // edge past a corner is not a page edge there
+const double kMaxVanishingCos = 0.25;       // see vanishingSkew()
+
+// A line through one or more collinear segments
+struct QuadLine {
+    cv::Point2f origin;                 // midpoint of its longest segment
+    cv::Point2f dir;                    // unit direction, y >= 0
+    int polarity;                       // 1: the brighter side is at (dir.y, -dir.x), else -1
+    float support;                      // summed segment length
+    int firstSpan;                      // its segments in LineQuadWorkspace::spans
+    int spanCount;
+};
+
+// Two lines taken as opposite edges of a page
+struct LinePair {
+    int a, b;
+    cv::Point2f dir;                    // mean direction
+};
+
+// Corners run around the quad; corner i joins edge i and edge i + 1
+struct QuadCandidate {
+    cv::Point2f corners[4];
+    double area;
+    double score;
+};
+
+// What the line engine did in one or more searches
+struct LineQuadStats {
+    unsigned long long segments;        // line segments detected
+    unsigned long long lines;           // lines they merged into (at most kMaxQuadLines per search)
+    unsigned long long hypotheses;      // quads built from two pairs of lines
+    unsigned long long accepted;
+
+    LineQuadStats() { reset(); }
+
+    void reset() {
+        segments = lines = hypotheses = accepted = 0;
+    }
+
+    void add(const LineQuadStats& other) {
+        segments += other.segments;
+        lines += other.lines;
+        hypotheses += other.hypotheses;
+        accepted += other.accepted;
+    }
+};
+
+// Buffers of the line engine, reused from frame to frame. The segment
+// detector keeps its own scratch.
+struct LineQuadWorkspace {
+    cv::Mat gray;                           // full-resolution gray
+    cv::Mat pyramid[kMaxDetectionLevel];    // pyramid[i] = gray pyrDown'ed i + 1 times
+    cv::Ptr<cv::LineSegmentDetector> lsd;
+    std::vector<cv::Vec4f> segments;
+    std::vector<float> lengths;
+    std::vector<int> order;                 // usable segments, longest first
+    std::vector<int> segmentLine;           // line of each segment, -1 = none
+    std::vector<QuadLine> lines;
+    std::vector<cv::Vec2f> spans;           // segment extents along their line, grouped by line
+    std::vector<LinePair> pairs;
+    std::vector<QuadCandidate> candidates;
+    std::vector<int> candidateOrder;
+    std::vector<cv::Point> quad;
+    std::vector<cv::Point2f> corners;
+    std::vector<cv::Point2f> overlapA, overlapB, overlap;
+
+    LineQuadWorkspace() {
+        // The pyramid already smoothed the image, so no internal rescale
+        lsd = cv::createLineSegmentDetector(cv::LSD_REFINE_NONE, 1.0);
+        lines.reserve(kMaxQuadLines);
+        pairs.reserve(kMaxQuadLines * (kMaxQuadLines - 1) / 2);
+        quad.reserve(4);
+        corners.reserve(4);
+    }
+
+    size_t fingerprint() const {
+        const cv::Mat* mats[] = { &gray, &pyramid[0], &pyramid[1], &pyramid[2] };
+        size_t sum = 0;
+        for (size_t i = 0; i < sizeof(mats) / sizeof(mats[0]); i++) {
+            sum += (size_t)mats[i]->data;
+        }
+        return sum;
+    }
+};
+
+// The "lines" engine: line segments on a downscaled gray frame, merged
+// into lines and paired into quads. A quad needs its edges covered by
+// segments that stop at its corners, the same brightness step across all
+// four edges, and vanishing points that fit a rectangle seen through a
+// camera; the largest, best covered wins. No CLAHE, bilateral filter or color
+// mask, so it is several times cheaper than the contour engine; meant for
+// well-lit desks. A page edge that is partly covered (a hand, a stapler)
+// still yields its line, where the contour breaks open.
+//
+// Searches one pyramid level below detectionPyramidLevel (a 480x360
+// capture at 240x180); corners are refined at full resolution.
+class LineQuadDetector : public DetectorEngine {
+public:
+    LineQuadDetector(const Config& cfg) : config(cfg), level(1) {}
+
+    const char* name() const { return "lines"; }
+
+    const cv::Mat& frameGray() const { return ws.gray; }
+    size_t workspaceFingerprint() const { return ws.fingerprint(); }
+
+    // Counts of the last search, and since construction
+    const LineQuadStats& lastStats() const { return lastSearch; }
+    const LineQuadStats& stats() const { return totalStats; }
+
+    DetectorCost cost() const {
+        DetectorCost c = totalCost;
+        c.candidates = totalStats.hypotheses;
+        c.accepted = totalStats.accepted;
+        return c;
+    }
+
+    void setDetectionLevel(int detectionLevel) { config.detectionPyramidLevel = detectionLevel; }
+
+    void detect(const cv::Mat& frame, std::vector<cv::Point>& document, cv::Mat& combined) {
+        DetectorCostScope charge(totalCost);
+        search(frame, combined);
+
+        // Best score wins; the first one on ties
+        int best = -1;
+        for (size_t i = 0; i < ws.candidates.size(); i++) {
+            if (best < 0 || ws.candidates[i].score > ws.candidates[best].score) best = (int)i;
+        }
+        document.clear();
+        if (best < 0) return;
+
+        toPoints(ws.candidates[best], document);
+        ESP_DOC_TIME_STAGE(Refine);
+        refineQuadCorners(ws.gray, level, document, ws.corners);
+    }
+
+    void detectAll(const cv::Mat& frame, std::vector<std::vector<cv::Point> >& documents,
+        cv::Mat& combined, int maxDocuments) {
+        DetectorCostScope charge(totalCost);
+        search(frame, combined);
+
+        const std::vector<QuadCandidate>& candidates = ws.candidates;
+        ws.candidateOrder.resize(candidates.size());
+        for (size_t i = 0; i < candidates.size(); i++) ws.candidateOrder[i] = (int)i;
+        std::sort(ws.candidateOrder.begin(), ws.candidateOrder.end(), [&candidates](int a, int b) {
+            return candidates[a].score > candidates[b].score || (candidates[a].score == candidates[b].score && a < b);
+        });
+
+        // Greedy: a quad overlapping a better one is the same page, or none
+        size_t limit = (size_t)std::max(maxDocuments, 0);
+        size_t kept = 0;
+        for (size_t i = 0; i < ws.candidateOrder.size() && kept < limit; i++) {
+            const QuadCandidate& c = candidates[ws.candidateOrder[i]];
+            toPoints(c, ws.quad);
+            bool overlaps = false;
+            for (size_t k = 0; k < kept && !overlaps; k++) {
+                overlaps = quadsOverlap(ws.quad, c.area, documents[k], ws.overlapA, ws.overlapB, ws.overlap);
+            }
+            if (overlaps) continue;
+            if (documents.size() <= kept) documents.resize(kept + 1);
+            documents[kept].assign(ws.quad.begin(), ws.quad.end());
+            kept++;
+        }
+        documents.resize(kept);
+
+        if (!documents.empty()) {
+            ESP_DOC_TIME_STAGE(Refine);
+            for (size_t i = 0; i < documents.size(); i++) {
+                refineQuadCorners(ws.gray, level, documents[i], ws.corners);
+            }
+        }
+    }
+
+private:
+    // Gray pyramid, segments, lines and quads of one frame. The accepted
+    // quads are left in ws.candidates, in the searched image's pixels;
+    // `combined` shows the segments that made it into lines.
+    void search(const cv::Mat& frame, cv::Mat& combined) {
+        level = std::min(std::max(config.detectionPyramidLevel, 0) + 1, kMaxDetectionLevel);
+        lastSearch.reset();
+
+        const cv::Mat* src = &ws.gray;
+        {
+            ESP_DOC_TIME_STAGE(Segments);
+            cv::cvtColor(frame, ws.gray, cv::COLOR_BGR2GRAY);
+            for (int i = 0; i < level; i++) {
+                cv::pyrDown(*src, ws.pyramid[i]);
+                src = &ws.pyramid[i];
+            }
+            ws.lsd->detect(*src, ws.segments);
+        }
+        {
+            ESP_DOC_TIME_STAGE(QuadFit);
+            mergeSegments(src->size());
+            drawLines(src->size(), combined);
+            fitQuads(src->size());
+        }
+
+        totalStats.add(lastSearch);
+        ESP_DOC_COUNT_ADD(LineSegments, lastSearch.segments);
+        ESP_DOC_COUNT_ADD(QuadHypotheses, lastSearch.hypotheses);
+    }
+
+    // Groups the segments into lines, longest first: a segment joins the
+    // first line it is collinear with, otherwise it starts a new one while
+    // there is room. A line keeps the position of its longest segment.
+    void mergeSegments(const cv::Size& size) {
+        const float minLength = (float)(kLineMinLength * std::min(size.width, size.height));
+        const size_t count = ws.segments.size();
+        ws.lengths.resize(count);
+        ws.order.clear();
+        for (size_t i = 0; i < count; i++) {
+            const cv::Vec4f& s = ws.segments[i];
+            ws.lengths[i] = std::sqrt((s[2] - s[0]) * (s[2] - s[0]) + (s[3] - s[1]) * (s[3] - s[1]));
+            if (ws.lengths[i] >= minLength) ws.order.push_back((int)i);
+        }
+        const std::vector<float>& lengths = ws.lengths;
+        std::sort(ws.order.begin(), ws.order.end(), [&lengths](int a, int b) {
+            return lengths[a] > lengths[b] || (lengths[a] == lengths[b] && a < b);
+        });
+
+        ws.lines.clear();
+        ws.segmentLine.assign(count, -1);
+        for (size_t k = 0; k < ws.order.size(); k++) {
+            int i = ws.order[k];
+            const cv::Vec4f& s = ws.segments[i];
+            cv::Point2f p(s[0], s[1]), q(s[2], s[3]);
+            // LSD orients a segment so that its brighter side is at (dy, -dx)
+            cv::Point2f dir((q.x - p.x) / lengths[i], (q.y - p.y) / lengths[i]);
+            int polarity = 1;
+            if (dir.y < 0 || (dir.y == 0 && dir.x < 0)) {
+                dir = cv::Point2f(-dir.x, -dir.y);
+                polarity = -1;
+            }
+
+            // The two sides of a stroke have opposite polarity and stay apart
+            int line = -1;
+            for (size_t l = 0; l < ws.lines.size() && line < 0; l++) {
+                const QuadLine& L = ws.lines[l];
+                if (L.polarity == polarity && std::abs(cross(dir, L.dir)) < kLineMergeSin &&
+                    std::abs(cross(p - L.origin, L.dir)) < kLineMergeDistance &&
+                    std::abs(cross(q - L.origin, L.dir)) < kLineMergeDistance) {
+                    line = (int)l;
+                }
+            }
+            if (line < 0) {
+                if ((int)ws.lines.size() == kMaxQuadLines) continue;
+                QuadLine L;
+                L.origin = cv::Point2f((p.x + q.x) * 0.5f, (p.y + q.y) * 0.5f);
+                L.dir = dir;
+                L.polarity = polarity;
+                L.support = 0.0f;
+                L.firstSpan = 0;
+                L.spanCount = 0;
+                ws.lines.push_back(L);
+                line = (int)ws.lines.size() - 1;
+            }
+            ws.lines[line].support += lengths[i];
+            ws.lines[line].spanCount++;
+            ws.segmentLine[i] = line;
+        }
+
+        // Extents of each line's segments, stored line by line
+        int first = 0;
+        for (size_t l = 0; l < ws.lines.size(); l++) {
+            ws.lines[l].firstSpan = first;
+            first += ws.lines[l].spanCount;
+            ws.lines[l].spanCount = 0;
+        }
+        ws.spans.resize(first);
+        for (size_t k = 0; k < ws.order.size(); k++) {
+            int i = ws.order[k];
+            if (ws.segmentLine[i] < 0) continue;
+            QuadLine& L = ws.lines[ws.segmentLine[i]];
+            const cv::Vec4f& s = ws.segments[i];
+            float t0 = along(L, cv::Point2f(s[0], s[1]));
+            float t1 = along(L, cv::Point2f(s[2], s[3]));
+            ws.spans[L.firstSpan + L.spanCount++] = cv::Vec2f(std::min(t0, t1), std::max(t0, t1));
+        }
+
+        lastSearch.segments = count;
+        lastSearch.lines = ws.lines.size();
+    }
+
+    void drawLines(const cv::Size& size, cv::Mat& combined) const {
+        combined.create(size, CV_8UC1);
+        combined.setTo(cv::Scalar(0));
+        for (size_t k = 0; k < ws.order.size(); k++) {
+            int i = ws.order[k];
+            if (ws.segmentLine[i] < 0) continue;
+            const cv::Vec4f& s = ws.segments[i];
+            cv::line(combined, cv::Point(cvRound(s[0]), cvRound(s[1])), cv::Point(cvRound(s[2]), cvRound(s[3])), cv::Scalar(255), 1);
+        }
+    }
+
+    // Pairs near-parallel lines as opposite edges, then every two pairs
+    // crossing at a real angle as a quad
+    void fitQuads(const cv::Size& size) {
+        ws.pairs.clear();
+        for (size_t i = 0; i < ws.lines.size(); i++) {
+            for (size_t j = i + 1; j < ws.lines.size(); j++) {
+                const cv::Point2f& u = ws.lines[i].dir;
+                const cv::Point2f& v = ws.lines[j].dir;
+                double cosine = u.x * v.x + u.y * v.y;
+                if (std::abs(cosine) < kMinOppositeCos) continue;
+                float sign = cosine < 0 ? -1.0f : 1.0f;
+                cv::Point2f mean(u.x + sign * v.x, u.y + sign * v.y);
+                float norm = std::sqrt(mean.x * mean.x + mean.y * mean.y);
+                LinePair pair;
+                pair.a = (int)i;
+                pair.b = (int)j;
+                pair.dir = cv::Point2f(mean.x / norm, mean.y / norm);
+                ws.pairs.push_back(pair);
+            }
+        }
+
+        ws.candidates.clear();
+        for (size_t p = 0; p < ws.pairs.size(); p++) {
+            for (size_t q = p + 1; q < ws.pairs.size(); q++) {
+                const LinePair& P = ws.pairs[p];
+                const LinePair& Q = ws.pairs[q];
+                if (std::abs(P.dir.x * Q.dir.x + P.dir.y * Q.dir.y) > kMaxCornerCos) continue;
+                if (P.a == Q.a || P.a == Q.b || P.b == Q.a || P.b == Q.b) continue;
+                evaluateQuad(P, Q, size);
+            }
+        }
+    }
+
+    // The quad bounded by P.a, Q.a, P.b, Q.b, tested cheapest first:
+    // corners inside the frame, convex, one brightness polarity, area,
+    // aspect, edge coverage and vanishing geometry. Kept in ws.candidates
+    // when it passes.
+    void evaluateQuad(const LinePair& P, const LinePair& Q, const cv::Size& size) {
+        lastSearch.hypotheses++;
+        const QuadLine* edges[4] = { &ws.lines[P.a], &ws.lines[Q.a], &ws.lines[P.b], &ws.lines[Q.b] };
+        QuadCandidate c;
+
+        // Same margin as the contour engine
+        const float margin = (float)std::max(1, 10 >> level);
+        for (int i = 0; i < 4; i++) {
+            if (!intersect(*edges[i], *edges[(i + 1) % 4], c.corners[i])) return;
+            const cv::Point2f& corner = c.corners[i];
+            if (corner.x < margin || corner.y < margin || corner.x > size.width - 1 - margin || corner.y > size.height - 1 - margin) return;
+        }
+
+        double turn = 0.0, twiceArea = 0.0;
+        for (int i = 0; i < 4; i++) {
+            const cv::Point2f& a = c.corners[i];
+            const cv::Point2f& b = c.corners[(i + 1) % 4];
+            const cv::Point2f& d = c.corners[(i + 2) % 4];
+            double t = cross(b - a, d - b);
+            if (i > 0 && (t > 0) != (turn > 0)) return;        // not convex
+            turn = t;
+            twiceArea += (double)a.x * b.y - (double)b.x * a.y;
+        }
+
+        // A page is brighter (or darker) than the desk along all its edges
+        cv::Point2f center((c.corners[0].x + c.corners[1].x + c.corners[2].x + c.corners[3].x) * 0.25f,
+            (c.corners[0].y + c.corners[1].y + c.corners[2].y + c.corners[3].y) * 0.25f);
+        int brighterInside = 0;
+        for (int i = 0; i < 4; i++) {
+            const QuadLine& e = *edges[i];
+            double side = (center.x - e.origin.x) * e.dir.y - (center.y - e.origin.y) * e.dir.x;
+            brighterInside += (side > 0) == (e.polarity > 0) ? 1 : 0;
+        }
+        if (brighterInside != 0 && brighterInside != 4) return;
+
+        double levelArea = (double)(1 << (2 * level));
+        c.area = std::abs(twiceArea) * 0.5;
+        if (c.area < config.minArea / levelArea || c.area > config.maxArea / levelArea) return;
+
+        float minX = c.corners[0].x, maxX = minX, minY = c.corners[0].y, maxY = minY;
+        for (int i = 1; i < 4; i++) {
+            minX = std::min(minX, c.corners[i].x);
+            maxX = std::max(maxX, c.corners[i].x);
+            minY = std::min(minY, c.corners[i].y);
+            maxY = std::max(maxY, c.corners[i].y);
+        }
+        double aspectRatio = (maxX - minX) / std::max(maxY - minY, 1.0f);
+        if (aspectRatio < 0.2 || aspectRatio > 5.0) return;
+
+        // Edge i runs from corner i - 1 to corner i on its line
+        double coverageSum = 0.0;
+        for (int i = 0; i < 4; i++) {
+            double coverage = edgeCoverage(*edges[i], c.corners[(i + 3) % 4], c.corners[i]);
+            if (coverage < kMinEdgeCoverage) return;
+            coverageSum += coverage;
+        }
+        double coverage = coverageSum / 4.0;
+        if (coverage < kMinMeanCoverage) return;
+
+        double skew = vanishingSkew(*edges[0], *edges[2], *edges[1], *edges[3], size);
+        if (skew > kMaxVanishingCos) return;
+
+        // Large, well-supported and rectangular wins
+        c.score = c.area * coverage * (1.0 - 0.5 * skew / kMaxVanishingCos);
+        ws.candidates.push_back(c);
+        lastSearch.accepted++;
+    }
+
+    // Share of the edge from a to b (both on `line`) covered by the line's
+    // segments; 0 when the line runs on past a or b, as a line through a
+    // cluttered desk does and the edge of a page does not
+    double edgeCoverage(const QuadLine& line, const cv::Point2f& a, const cv::Point2f& b) const {
+        float ta = along(line, a), tb = along(line, b);
+        float lo = std::min(ta, tb), hi = std::max(ta, tb);
+        if (hi - lo < 1.0f) return 0.0;
+        float gap = std::max(3.0f, (float)kOvershootGap * (hi - lo));
+        float covered = 0.0f, before = 0.0f, after = 0.0f;
+        for (int k = 0; k < line.spanCount; k++) {
+            const cv::Vec2f& span = ws.spans[line.firstSpan + k];
+            covered += std::max(0.0f, std::min(hi, span[1]) - std::max(lo, span[0]));
+            before += std::max(0.0f, std::min(lo, span[1]) - std::max(lo - gap, span[0]));
+            after += std::max(0.0f, std::min(hi + gap, span[1]) - std::max(hi, span[0]));
+        }
+        if (before > 0.5f * gap || after > 0.5f * gap) return 0.0;
+        return std::min(1.0, (double)covered / (hi - lo));
+    }
+
+    // Opposite edges of a rectangle meet in vanishing points (at infinity
+    // when they are parallel in the image) whose viewing rays are
+    // perpendicular. Returns the smallest |cos| between the two rays over
+    // focal lengths from wide webcam to narrow zoom lenses, with the
+    // principal point at the image center: 0 for a rectangle in
+    // perspective, large for a trapezoid no rectangle projects to.
+    static double vanishingSkew(const QuadLine& a, const QuadLine& b, const QuadLine& c, const QuadLine& d, const cv::Size& size) {
+        cv::Point2f center(size.width * 0.5f, size.height * 0.5f);
+        double la[3], lb[3], lc[3], ld[3], v1[3], v2[3];
+        homogeneous(a, center, la);
+        homogeneous(b, center, lb);
+        homogeneous(c, center, lc);
+        homogeneous(d, center, ld);
+        cross3(la, lb, v1);
+        cross3(lc, ld, v2);
+
+        static const double focal[] = { 0.6, 1.0, 1.6 };  // x the image width
+        double best = 1.0;
+        for (size_t i = 0; i < sizeof(focal) / sizeof(focal[0]); i++) {
+            double f = focal[i] * size.width;
+            double r1[3] = { v1[0], v1[1], v1[2] * f };
+            double r2[3] = { v2[0], v2[1], v2[2] * f };
+            double norms = std::sqrt(r1[0] * r1[0] + r1[1] * r1[1] + r1[2] * r1[2]) *
+                std::sqrt(r2[0] * r2[0] + r2[1] * r2[1] + r2[2] * r2[2]);
+            if (norms <= 0.0) continue;
+            best = std::min(best, std::abs(r1[0] * r2[0] + r1[1] * r2[1] + r1[2] * r2[2]) / norms);
+        }
+        return best;
+    }
+
+    // n.x * x + n.y * y + w = 0 for the line, in coordinates around `center`
+    static void homogeneous(const QuadLine& line, const cv::Point2f& center, double out[3]) {
+        double nx = -line.dir.y, ny = line.dir.x;
+        out[0] = nx;
+        out[1] = ny;
+        out[2] = -(nx * (line.origin.x - center.x) + ny * (line.origin.y - center.y));
+    }
+
+    static void cross3(const double a[3], const double b[3], double out[3]) {
+        out[0] = a[1] * b[2] - a[2] * b[1];
+        out[1] = a[2] * b[0] - a[0] * b[2];
+        out[2] = a[0] * b[1] - a[1] * b[0];
+    }
+
+    static double cross(const cv::Point2f& a, const cv::Point2f& b) {
+        return (double)a.x * b.y - (double)a.y * b.x;
+    }
+
+    static float along(const QuadLine& line, const cv::Point2f& p) {
+        return (p.x - line.origin.x) * line.dir.x + (p.y - line.origin.y) * line.dir.y;
+    }
+
+    static bool intersect(const QuadLine& a, const QuadLine& b, cv::Point2f& at) {
+        double denominator = cross(a.dir, b.dir);
+        if (std::abs(denominator) < 1e-3) return false;
+        double t = cross(b.origin - a.origin, b.dir) / denominator;
+        at = cv::Point2f((float)(a.origin.x + t * a.dir.x), (float)(a.origin.y + t * a.dir.y));
+        return true;
+    }
+
+    static void toPoints(const QuadCandidate& c, std::vector<cv::Point>& quad) {
+        quad.resize(4);
+        for (int i = 0; i < 4; i++) quad[i] = cv::Point(cvRound(c.corners[i].x), cvRound(c.corners[i].y));
+    }
+
+    Config config;
+    LineQuadWorkspace ws;
+    int level;                          // pyramid level of the last search
+    LineQuadStats lastSearch;
+    LineQuadStats totalStats;
+    DetectorCost totalCost;
+};
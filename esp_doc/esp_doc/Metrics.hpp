@@ -0,0 +1,357 @@
+#pragma once
+
+// Runtime telemetry: per-stage latency histograms and event counters,
+// dumped periodically to CSV/JSON and optionally served as Prometheus text
+// on 127.0.0.1.
+//
+// Recording is lock-free (relaxed atomics) and costs two clock reads per
+// timed scope. Build with ESP_DOC_DISABLE_METRICS to compile every
+// ESP_DOC_TIME_STAGE / ESP_DOC_COUNT site to nothing.
+
+#include <atomic>
+#include <string>
+
+namespace metrics {
+    enum class Stage {
+        Decode,         // capture read + decode
+        Preprocess,     // balancedPreprocess
+        Paper,          // detectPaper
+        Contours,       // findBestDocument
+        Segments,       // line engine: gray pyramid + line segment detection
+        QuadFit,        // line engine: merging segments and scoring quads
+        Refine,         // full-resolution corner refinement
+        Track,          // optical-flow tracking
+        Detect,         // whole detection stage for one frame
+        Quality,        // quality estimate
+        Display,        // drawUI + imshow
+        SaveWarp,       // warp + enhance in the writer
+        SaveEncode,     // DocumentEncoder
+        SaveWrite,      // disk write
+        Count
+    };
+
+    enum class Counter {
+        FramesCaptured,
+        FramesDropped,
+        ResultsDropped,
+        Detections,
+        TrackedFrames,
+        SavesOk,
+        SavesFailed,
+        SerialFailures,
+        SerialDropped,
+        Contours,               // contours evaluated by the candidate cascade
+        ContourRejectPoints,    // per-test rejections, in ContourTest order
+        ContourRejectBox,
+        ContourRejectArea,
+        ContourRejectCorners,
+        ContourRejectAspect,
+        ContourRejectMargin,
+        ContourRejectConvexity,
+        LineSegments,           // segments the line engine detected
+        QuadHypotheses,         // quads the line engine built from line pairs
+        Count
+    };
+
+    inline const char* stageName(Stage s) {
+        static const char* names[] = { "decode", "preprocess", "paper", "contours", "segments", "quad_fit",
+                                       "refine", "track", "detect", "quality", "display", "save_warp",
+                                       "save_encode", "save_write" };
+        return names[(int)s];
+    }
+
+    inline const char* counterName(Counter c) {
+        static const char* names[] = { "frames_captured", "frames_dropped", "results_dropped", "detections",
+                                       "tracked_frames", "saves_ok", "saves_failed", "serial_failures",
+                                       "serial_dropped", "contours", "contour_reject_points", "contour_reject_box",
+                                       "contour_reject_area", "contour_reject_corners", "contour_reject_aspect",
+                                       "contour_reject_margin", "contour_reject_convexity", "line_segments",
+                                       "quad_hypotheses" };
+        return names[(int)c];
+    }
+}
+
+#ifndef ESP_DOC_DISABLE_METRICS
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "HttpServer.hpp"
+
+namespace metrics {
+    // Log-linear latency histogram in microseconds: values below 8 us get
+    // their own bucket, above that every power of two is split into 8
+    // linear sub-buckets (<= 12.5% relative error). Covers up to ~2^30 us.
+    class LatencyHistogram {
+    public:
+        static const int kSubBits = 3;
+        static const int kSub = 1 << kSubBits;
+        static const int kMaxExponent = 30;
+        static const int kBuckets = (kMaxExponent - kSubBits + 2) * kSub;
+
+        LatencyHistogram() : total(0), sumUs(0), maxUs(0) {
+            for (int i = 0; i < kBuckets; i++) buckets[i].store(0, std::memory_order_relaxed);
+        }
+
+        static int bucketFor(unsigned long long us) {
+            if (us < (unsigned long long)kSub) return (int)us;
+            int exponent = 63 - countLeadingZeros(us);
+            if (exponent > kMaxExponent) return kBuckets - 1;
+            int sub = (int)((us >> (exponent - kSubBits)) & (kSub - 1));
+            return (exponent - kSubBits + 1) * kSub + sub;
+        }
+
+        // Largest value (us) that lands in bucket i
+        static unsigned long long upperBound(int i) {
+            if (i < kSub) return (unsigned long long)i;
+            int exponent = i / kSub + kSubBits - 1;
+            unsigned long long sub = (unsigned long long)(i % kSub);
+            return ((kSub + sub + 1) << (exponent - kSubBits)) - 1;
+        }
+
+        void record(unsigned long long us) {
+            buckets[bucketFor(us)].fetch_add(1, std::memory_order_relaxed);
+            total.fetch_add(1, std::memory_order_relaxed);
+            sumUs.fetch_add(us, std::memory_order_relaxed);
+            unsigned long long prev = maxUs.load(std::memory_order_relaxed);
+            while (us > prev && !maxUs.compare_exchange_weak(prev, us, std::memory_order_relaxed)) {}
+        }
+
+        unsigned long long count() const { return total.load(std::memory_order_relaxed); }
+        unsigned long long sum() const { return sumUs.load(std::memory_order_relaxed); }
+        unsigned long long max() const { return maxUs.load(std::memory_order_relaxed); }
+        unsigned long long bucketCount(int i) const { return buckets[i].load(std::memory_order_relaxed); }
+
+        // Upper bound of the bucket holding quantile q (0..1), in us
+        unsigned long long quantile(double q) const {
+            unsigned long long n = count();
+            if (n == 0) return 0;
+            unsigned long long rank = (unsigned long long)(q * (n - 1)) + 1;
+            unsigned long long seen = 0;
+            for (int i = 0; i < kBuckets; i++) {
+                seen += bucketCount(i);
+                if (seen >= rank) return std::min(upperBound(i), max());
+            }
+            return max();
+        }
+
+    private:
+        static int countLeadingZeros(unsigned long long v) {
+            int n = 0;
+            for (unsigned long long bit = 1ULL << 63; bit && !(v & bit); bit >>= 1) n++;
+            return n;
+        }
+
+        std::atomic<unsigned long long> buckets[kBuckets];
+        std::atomic<unsigned long long> total;
+        std::atomic<unsigned long long> sumUs;
+        std::atomic<unsigned long long> maxUs;
+    };
+
+    struct Registry {
+        LatencyHistogram stages[(int)Stage::Count];
+        std::atomic<unsigned long long> counters[(int)Counter::Count];
+
+        Registry() {
+            for (int i = 0; i < (int)Counter::Count; i++) counters[i].store(0, std::memory_order_relaxed);
+        }
+    };
+
+    inline Registry& registry() {
+        static Registry r;
+        return r;
+    }
+
+    inline void record(Stage s, unsigned long long us) { registry().stages[(int)s].record(us); }
+    inline void increment(Counter c, unsigned long long n = 1) { registry().counters[(int)c].fetch_add(n, std::memory_order_relaxed); }
+    // For totals kept elsewhere (e.g. the serial notifier's failure count)
+    inline void set(Counter c, unsigned long long v) { registry().counters[(int)c].store(v, std::memory_order_relaxed); }
+
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(Stage s) : stage(s), start(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer() {
+            record(stage, (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+
+    private:
+        Stage stage;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // Prometheus text exposition format (cumulative since start). Buckets
+    // are reported on a fixed set of boundaries; each log-linear bucket is
+    // counted under the first boundary at or above its upper bound.
+    inline std::string renderPrometheus() {
+        static const double bounds[] = { 0.0005, 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1.0, 2.0, 5.0 };
+        const int boundCount = sizeof(bounds) / sizeof(bounds[0]);
+        std::ostringstream out;
+        Registry& r = registry();
+
+        out << "# HELP esp_doc_stage_seconds Pipeline stage latency.\n";
+        out << "# TYPE esp_doc_stage_seconds histogram\n";
+        for (int s = 0; s < (int)Stage::Count; s++) {
+            const LatencyHistogram& h = r.stages[s];
+            const char* name = stageName((Stage)s);
+            unsigned long long cumulative = 0;
+            int bucket = 0;
+            for (int b = 0; b < boundCount; b++) {
+                unsigned long long limitUs = (unsigned long long)(bounds[b] * 1e6);
+                for (; bucket < LatencyHistogram::kBuckets && LatencyHistogram::upperBound(bucket) <= limitUs; bucket++) {
+                    cumulative += h.bucketCount(bucket);
+                }
+                out << "esp_doc_stage_seconds_bucket{stage=\"" << name << "\",le=\"" << bounds[b] << "\"} " << cumulative << "\n";
+            }
+            out << "esp_doc_stage_seconds_bucket{stage=\"" << name << "\",le=\"+Inf\"} " << h.count() << "\n";
+            out << "esp_doc_stage_seconds_sum{stage=\"" << name << "\"} " << h.sum() / 1e6 << "\n";
+            out << "esp_doc_stage_seconds_count{stage=\"" << name << "\"} " << h.count() << "\n";
+        }
+        for (int c = 0; c < (int)Counter::Count; c++) {
+            const char* name = counterName((Counter)c);
+            out << "# TYPE esp_doc_" << name << "_total counter\n";
+            out << "esp_doc_" << name << "_total " << r.counters[c].load(std::memory_order_relaxed) << "\n";
+        }
+        return out.str();
+    }
+
+    inline std::string renderJson() {
+        std::ostringstream out;
+        Registry& r = registry();
+        out << "{\"stages\": {";
+        for (int s = 0; s < (int)Stage::Count; s++) {
+            const LatencyHistogram& h = r.stages[s];
+            out << (s ? ", " : "") << "\"" << stageName((Stage)s) << "\": {\"count\": " << h.count()
+                << ", \"p50_us\": " << h.quantile(0.5) << ", \"p90_us\": " << h.quantile(0.9)
+                << ", \"p99_us\": " << h.quantile(0.99) << ", \"max_us\": " << h.max()
+                << ", \"sum_us\": " << h.sum() << "}";
+        }
+        out << "}, \"counters\": {";
+        for (int c = 0; c < (int)Counter::Count; c++) {
+            out << (c ? ", " : "") << "\"" << counterName((Counter)c) << "\": " << r.counters[c].load(std::memory_order_relaxed);
+        }
+        out << "}}\n";
+        return out.str();
+    }
+
+    // One row per stage and counter: time_ms,kind,name,count,p50_us,p90_us,p99_us,max_us,value
+    inline void appendCsv(std::ostream& out, long long timeMs) {
+        Registry& r = registry();
+        for (int s = 0; s < (int)Stage::Count; s++) {
+            const LatencyHistogram& h = r.stages[s];
+            out << timeMs << ",stage," << stageName((Stage)s) << "," << h.count() << "," << h.quantile(0.5) << ","
+                << h.quantile(0.9) << "," << h.quantile(0.99) << "," << h.max() << ",\n";
+        }
+        for (int c = 0; c < (int)Counter::Count; c++) {
+            out << timeMs << ",counter," << counterName((Counter)c) << ",,,,,," << r.counters[c].load(std::memory_order_relaxed) << "\n";
+        }
+    }
+
+    // Writes a snapshot every intervalMs (JSON when the path ends in .json,
+    // otherwise appended CSV rows) and serves GET /metrics when httpPort > 0
+    class MetricsReporter {
+    public:
+        MetricsReporter() : running(false) {}
+        ~MetricsReporter() { stop(); }
+
+        void start(const std::string& dumpPath, int intervalMs, int httpPort) {
+            if (httpPort > 0) {
+                bool ok = server.start(httpPort, [](const std::string& method, const std::string& path, HttpResponder& out) {
+                    if (method == "GET" && (path == "/metrics" || path == "/")) {
+                        out.respond(200, "text/plain; version=0.0.4", renderPrometheus());
+                    }
+                    else {
+                        out.respond(404, "text/plain", "not found\n");
+                    }
+                });
+                std::cout << (ok ? "?? Metrics at http://127.0.0.1:" : "?? Metrics endpoint failed to bind port ") << httpPort
+                    << (ok ? "/metrics" : "") << std::endl;
+            }
+            if (dumpPath.empty() || intervalMs <= 0) return;
+
+            path = dumpPath;
+            interval = intervalMs;
+            running = true;
+            dumpThread = std::thread(&MetricsReporter::dumpLoop, this);
+        }
+
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!running && !dumpThread.joinable()) {
+                    server.stop();
+                    return;
+                }
+                running = false;
+            }
+            wake.notify_all();
+            if (dumpThread.joinable()) dumpThread.join();
+            server.stop();
+            dump();     // final snapshot
+        }
+
+    private:
+        void dumpLoop() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (running) {
+                if (wake.wait_for(lock, std::chrono::milliseconds(interval), [this]() { return !running; })) break;
+                lock.unlock();
+                dump();
+                lock.lock();
+            }
+        }
+
+        void dump() {
+            bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+            if (json) {
+                std::ofstream out(path.c_str(), std::ios::trunc);
+                out << renderJson();
+                return;
+            }
+            std::ifstream existing(path.c_str());
+            bool header = !existing.good() || existing.peek() == std::ifstream::traits_type::eof();
+            existing.close();
+            std::ofstream out(path.c_str(), std::ios::app);
+            if (header) out << "time_ms,kind,name,count,p50_us,p90_us,p99_us,max_us,value\n";
+            appendCsv(out, std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+        }
+
+        std::string path;
+        int interval;
+        bool running;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::thread dumpThread;
+        LocalHttpServer server;
+    };
+}
+
+#define ESP_DOC_METRICS_CONCAT_(a, b) a##b
+#define ESP_DOC_METRICS_CONCAT(a, b) ESP_DOC_METRICS_CONCAT_(a, b)
+#define ESP_DOC_TIME_STAGE(stage) metrics::ScopedTimer ESP_DOC_METRICS_CONCAT(espDocStageTimer, __LINE__)(metrics::Stage::stage)
+#define ESP_DOC_COUNT(counter) metrics::increment(metrics::Counter::counter)
+#define ESP_DOC_COUNT_ADD(counter, n) metrics::increment(metrics::Counter::counter, (n))
+#define ESP_DOC_COUNT_SET(counter, value) metrics::set(metrics::Counter::counter, (value))
+#define ESP_DOC_METRICS_ENABLED 1
+#else
+
+namespace metrics {
+    class MetricsReporter {
+    public:
+        void start(const std::string&, int, int) {}
+        void stop() {}
+    };
+}
+
+#define ESP_DOC_TIME_STAGE(stage) ((void)0)
+#define ESP_DOC_COUNT(counter) ((void)0)
+#define ESP_DOC_COUNT_ADD(counter, n) ((void)0)
+#define ESP_DOC_COUNT_SET(counter, value) ((void)0)
+#define ESP_DOC_METRICS_ENABLED 0
+#endif
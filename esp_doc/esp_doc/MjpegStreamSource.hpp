@@ -0,0 +1,354 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FrameSource.hpp"
+#include "HttpServer.hpp"
+#include "JpegHeader.hpp"
+
+// IMREAD_REDUCED_* flag that decodes a `full` JPEG to the smallest size
+// still covering `target` (libjpeg scales in the DCT domain: 1/2, 1/4, 1/8)
+inline int reducedDecodeFlag(const cv::Size& full, const cv::Size& target, int& factor) {
+    factor = 1;
+    while (factor < 8 && full.width / (factor * 2) >= target.width && full.height / (factor * 2) >= target.height) {
+        factor *= 2;
+    }
+    switch (factor) {
+    case 8: return cv::IMREAD_REDUCED_COLOR_8;
+    case 4: return cv::IMREAD_REDUCED_COLOR_4;
+    case 2: return cv::IMREAD_REDUCED_COLOR_2;
+    default: return cv::IMREAD_COLOR;
+    }
+}
+
+// Decodes a JPEG of size `full` to `size` (at most full size):
+// DCT-scaled decode first, INTER_AREA for the remainder. `scratch` holds
+// the intermediate image between calls.
+inline bool decodeJpegToSize(const cv::Mat& encoded, const cv::Size& full, const cv::Size& size,
+    cv::Mat& dst, cv::Mat& scratch, int& factor) {
+    cv::imdecode(encoded, reducedDecodeFlag(full, size, factor), &scratch);
+    if (scratch.empty()) return false;
+    if (scratch.cols > size.width || scratch.rows > size.height) {
+        cv::resize(scratch, dst, size, 0, 0, cv::INTER_AREA);
+    }
+    else {
+        std::swap(scratch, dst);
+    }
+    return true;
+}
+
+// Decodes a JPEG of size `full` to the smallest size with the same aspect
+// ratio that covers `target` (a 1920x1080 frame becomes 640x360 for
+// 480x360)
+inline bool decodeScaledJpeg(const cv::Mat& encoded, const cv::Size& full, const cv::Size& target,
+    cv::Mat& dst, cv::Mat& scratch, int& factor) {
+    double scale = std::max((double)target.width / full.width, (double)target.height / full.height);
+    cv::Size fitted(cvRound(full.width * scale), cvRound(full.height * scale));
+    return decodeJpegToSize(encoded, full, fitted, dst, scratch, factor);
+}
+
+// MJPEG over HTTP (multipart/x-mixed-replace, e.g. IP Webcam's /video).
+// A reader thread parses the stream and keeps only the newest JPEG, so a
+// slow consumer skips frames without decoding them. read() decodes that
+// JPEG scaled to the capture size (decodeScaledJpeg); the compressed
+// original is kept so a saved page can be warped from the full-resolution
+// frame.
+class MjpegStreamSource : public FrameSource {
+public:
+    MjpegStreamSource()
+        : port(0), running(false), connected(false), sock(net::kInvalidSocket), readPos(0), sequence(0), taken(0),
+          lastFactor(1), lastDecodeMs(0.0), framesReceived(0) {}
+    ~MjpegStreamSource() { close(); }
+
+    // Starts reading `url` (http://host[:port]/path). Returns false when
+    // the URL is not http or no frame arrives within timeoutMs.
+    bool open(const std::string& url, const cv::Size& captureSize, int timeoutMs = 3000) {
+        close();
+        if (!parseUrl(url, host, port, path)) return false;
+        target = captureSize;
+        name = url;
+        running = true;
+        reader = std::thread(&MjpegStreamSource::run, this);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!newFrame.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() { return sequence > 0; })) {
+            lock.unlock();
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        running = false;
+        newFrame.notify_all();
+        if (reader.joinable()) reader.join();
+    }
+
+    bool read(cv::Mat& frame) {
+        std::shared_ptr<const std::vector<uchar> > jpeg;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            newFrame.wait_for(lock, std::chrono::milliseconds(500), [this]() { return sequence > taken || !running; });
+            if (sequence == taken) return false;
+            taken = sequence;
+            jpeg = latest;
+        }
+        lastJpeg = jpeg;
+
+        auto start = std::chrono::steady_clock::now();
+        bool ok = decode(*jpeg, frame);
+        lastDecodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return ok;
+    }
+
+    // The reader thread already drops everything but the newest frame
+    void grab() {
+        std::lock_guard<std::mutex> lock(mutex);
+        taken = sequence;
+    }
+
+    EncodedFrame original() const {
+        EncodedFrame out;
+        out.jpeg = lastOriginal;
+        return out;
+    }
+
+    std::shared_ptr<const std::vector<uchar> > compressedFrame() const { return lastJpeg; }
+
+    std::string describe() const {
+        return "MJPEG stream (" + name + ")";
+    }
+
+    bool isConnected() const { return connected; }
+    unsigned long long received() const { return framesReceived; }
+    int decodeFactor() const { return lastFactor; }
+
+    // Time the last read() spent decoding, without the wait for the frame
+    double decodeMs() const { return lastDecodeMs; }
+
+    static bool parseUrl(const std::string& url, std::string& host, int& port, std::string& path) {
+        const std::string scheme = "http://";
+        if (url.compare(0, scheme.size(), scheme) != 0) return false;
+        size_t hostStart = scheme.size();
+        size_t slash = url.find('/', hostStart);
+        std::string authority = url.substr(hostStart, slash == std::string::npos ? std::string::npos : slash - hostStart);
+        path = slash == std::string::npos ? "/" : url.substr(slash);
+
+        size_t colon = authority.find(':');
+        host = authority.substr(0, colon);
+        port = colon == std::string::npos ? 80 : atoi(authority.c_str() + colon + 1);
+        return !host.empty() && port > 0 && port < 65536;
+    }
+
+private:
+    // Scaled to the capture size unless the frame is already that small
+    bool decode(const std::vector<uchar>& jpeg, cv::Mat& frame) {
+        cv::Mat encoded(1, (int)jpeg.size(), CV_8UC1, (void*)jpeg.data());
+        cv::Size full;
+        if (!jpegDimensions(jpeg.data(), jpeg.size(), full) || (full.width <= target.width && full.height <= target.height)) {
+            // Already small enough (or no readable header): plain decode
+            lastFactor = 1;
+            lastOriginal.reset();
+            cv::imdecode(encoded, cv::IMREAD_COLOR, &frame);
+            return !frame.empty();
+        }
+
+        if (!decodeScaledJpeg(encoded, full, target, frame, scaled, lastFactor)) return false;
+        lastOriginal = lastJpeg;
+        return true;
+    }
+
+    // Connects, streams until an error or close(), reconnects after a pause
+    void run() {
+        if (!net::startup()) return;
+        while (running) {
+            net::Socket s = net::connectTcp(host, port);
+            if (s != net::kInvalidSocket) {
+                sock = s;
+                buffered.clear();
+                readPos = 0;
+                if (sendRequest()) readStream();
+                connected = false;
+                net::closeSocket(s);
+            }
+            for (int i = 0; i < 10 && running; i++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        }
+        net::cleanup();
+    }
+
+    bool sendRequest() {
+        std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host +
+            "\r\nAccept: multipart/x-mixed-replace\r\nConnection: close\r\n\r\n";
+        return net::sendAll(sock, request.data(), request.size());
+    }
+
+    void readStream() {
+        std::string line;
+        if (!readLine(line) || line.compare(0, 5, "HTTP/") != 0 || line.find(" 200") == std::string::npos) return;
+
+        std::string boundary;
+        while (readLine(line) && !line.empty()) {
+            std::string value;
+            if (headerValue(line, "content-type", value)) {
+                size_t b = value.find("boundary=");
+                if (b != std::string::npos) {
+                    boundary = value.substr(b + 9);
+                    size_t end = boundary.find(';');
+                    if (end != std::string::npos) boundary.erase(end);
+                    if (!boundary.empty() && boundary[0] == '"') boundary = boundary.substr(1, boundary.find('"', 1) - 1);
+                }
+            }
+        }
+        if (boundary.empty()) return;
+        // Some servers put the leading dashes into the parameter already
+        std::string delimiter = "\r\n" + (boundary.compare(0, 2, "--") == 0 ? boundary : "--" + boundary);
+        connected = true;
+
+        while (running) {
+            // Part headers: skip the boundary line (and blank lines) first
+            size_t contentLength = 0;
+            bool inHeaders = false;
+            while (readLine(line)) {
+                if (!inHeaders) {
+                    if (line.compare(0, 2, "--") == 0) inHeaders = true;
+                    continue;
+                }
+                if (line.empty()) break;
+                std::string value;
+                if (headerValue(line, "content-length", value)) contentLength = (size_t)atol(value.c_str());
+            }
+            if (!running || !inHeaders) return;
+
+            std::shared_ptr<std::vector<uchar> > jpeg = std::make_shared<std::vector<uchar> >();
+            bool ok = contentLength > 0 ? readExact(contentLength, *jpeg) : readUntil(delimiter, *jpeg);
+            if (!ok) return;
+            if (jpeg->size() < 4) continue;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                latest = jpeg;
+                sequence++;
+            }
+            framesReceived++;
+            newFrame.notify_one();
+        }
+    }
+
+    static bool headerValue(const std::string& line, const char* name, std::string& value) {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || colon != strlen(name)) return false;
+        for (size_t i = 0; i < colon; i++) {
+            if (tolower((unsigned char)line[i]) != name[i]) return false;
+        }
+        size_t start = line.find_first_not_of(" \t", colon + 1);
+        value = start == std::string::npos ? "" : line.substr(start);
+        return true;
+    }
+
+    // Buffered socket reads; all return false on error, EOF or close().
+    // fill() drops the consumed part of the buffer first.
+    bool fill() {
+        if (readPos > 0) {
+            buffered.erase(buffered.begin(), buffered.begin() + readPos);
+            readPos = 0;
+        }
+        char chunk[16384];
+        while (running) {
+            if (!net::waitReadable(sock, 200)) continue;
+            int got = (int)recv(sock, chunk, sizeof(chunk), 0);
+            if (got <= 0) return false;
+            buffered.insert(buffered.end(), chunk, chunk + got);
+            return true;
+        }
+        return false;
+    }
+
+    bool readLine(std::string& line) {
+        while (true) {
+            for (size_t i = readPos; i < buffered.size(); i++) {
+                if (buffered[i] == '\n') {
+                    size_t end = i > readPos && buffered[i - 1] == '\r' ? i - 1 : i;
+                    line.assign(buffered.begin() + readPos, buffered.begin() + end);
+                    readPos = i + 1;
+                    return true;
+                }
+            }
+            if (buffered.size() - readPos > 8192) return false;    // not a header line
+            if (!fill()) return false;
+        }
+    }
+
+    bool readExact(size_t count, std::vector<uchar>& out) {
+        if (count > kMaxFrameBytes) return false;
+        out.reserve(count);
+        while (out.size() < count) {
+            if (readPos == buffered.size() && !fill()) return false;
+            size_t take = std::min(count - out.size(), buffered.size() - readPos);
+            out.insert(out.end(), buffered.begin() + readPos, buffered.begin() + readPos + take);
+            readPos += take;
+        }
+        return true;
+    }
+
+    // Everything up to `delimiter`, which is left in the buffer
+    bool readUntil(const std::string& delimiter, std::vector<uchar>& out) {
+        size_t scanned = 0;                 // bytes after readPos known not to start a match
+        while (true) {
+            const char* begin = buffered.data() + readPos;
+            const char* end = buffered.data() + buffered.size();
+            const char* found = std::search(begin + scanned, end, delimiter.begin(), delimiter.end());
+            if (found != end) {
+                out.assign(begin, found);
+                readPos += (found - begin) + 2;    // keep the "--boundary" line
+                return true;
+            }
+            size_t available = buffered.size() - readPos;
+            if (available > kMaxFrameBytes) return false;
+            scanned = available >= delimiter.size() ? available - delimiter.size() + 1 : 0;
+            if (!fill()) return false;
+        }
+    }
+
+    static const size_t kMaxFrameBytes = 16 * 1024 * 1024;
+
+    std::string host, path, name;
+    int port;
+    cv::Size target;
+
+    std::thread reader;
+    std::atomic<bool> running;
+    std::atomic<bool> connected;
+    net::Socket sock;
+    std::vector<char> buffered;
+    size_t readPos;
+
+    std::mutex mutex;
+    std::condition_variable newFrame;
+    std::shared_ptr<const std::vector<uchar> > latest;
+    unsigned long long sequence;
+    unsigned long long taken;
+
+    cv::Mat scaled;
+    std::shared_ptr<const std::vector<uchar> > lastOriginal;
+    std::shared_ptr<const std::vector<uchar> > lastJpeg;
+    int lastFactor;
+    double lastDecodeMs;
+    std::atomic<unsigned long long> framesReceived;
+};
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "JpegHeader.hpp"
+
+// One PDF per scanning session, written while the session runs. Each page
+// is appended as soon as it is saved: the JPEG bytes go in unchanged as a
+// DCTDecode image (no decode, no re-encode), followed by an incremental
+// update - a new Pages object, an xref section for just the new objects
+// and a trailer pointing back at the previous one. The file is a complete
+// PDF after every page; a crash can only leave a partly written page
+// behind the last %%EOF, which recover() cuts off.
+//
+// Pages are ordered by the caller's sequence numbers (AsyncDocumentWriter
+// job ids 1, 2, 3...). Save workers finish out of order, so a page waits
+// in a reorder buffer until every earlier number has been added or
+// skipped. Thread-safe.
+class PdfSessionWriter {
+public:
+    PdfSessionWriter()
+        : file(NULL), offset(0), lastXref(0), nextObject(3), nextSequence(1), dpi(150.0), failed(false) {}
+
+    ~PdfSessionWriter() {
+        close();
+    }
+
+    // Creates `path` and writes the empty document. While the session is
+    // open, `markerPath` (if given) holds its path so that the next start
+    // can find and repair it after a crash (recoverFromMarker()).
+    bool open(const std::string& sessionPath, double pageDpi = 150.0, const std::string& markerPath = "",
+        unsigned long long firstSequence = 1) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (file != NULL) return false;
+        file = std::fopen(sessionPath.c_str(), "wb");
+        if (file == NULL) return false;
+
+        filePath = sessionPath;
+        marker = markerPath;
+        offset = 0;
+        lastXref = 0;
+        nextObject = 3;
+        nextSequence = firstSequence;
+        dpi = pageDpi > 0.0 ? pageDpi : 150.0;
+        failed = false;
+        pages.clear();
+        pending.clear();
+
+        put("%PDF-1.4\n%\xE2\xE3\xCF\xD3\n");
+        beginObject(1);
+        put("<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+        commitUpdate();
+        if (!marker.empty()) writeMarker();
+        return !failed;
+    }
+
+    // Adds the page for `sequence`; it is written once all earlier
+    // sequences are in. Out of order it is buffered (the JPEG is copied) and
+    // true only means it was accepted, not written: a failed write shows up
+    // as false from the addPage() that flushes it. false if the data is not a gray or color
+    // JPEG (the sequence then counts as skipped) or the file can't be
+    // written.
+    bool addPage(unsigned long long sequence, const std::vector<uchar>& jpeg) {
+        Page page;
+        int components = 0;
+        page.present = jpegDimensions(jpeg.data(), jpeg.size(), page.size, &components) && (components == 1 || components == 3);
+        page.gray = components == 1;
+        bool present = page.present;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (file == NULL) return false;
+        bool added = false;
+        if (sequence == nextSequence) {
+            if (page.present) {
+                writePage(page, jpeg);
+                added = true;
+            }
+            nextSequence++;
+        }
+        else {
+            if (page.present) page.jpeg = jpeg;
+            pending[sequence] = std::move(page);
+        }
+        writeReady(added);
+        return present && !failed;
+    }
+
+    // The job with this sequence produced no page
+    void skip(unsigned long long sequence) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (file == NULL) return;
+        pending[sequence] = Page();
+        writeReady(false);
+    }
+
+    // Writes pages still waiting behind a missing sequence and closes the
+    // file. A session without pages is deleted.
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (file == NULL) return;
+
+        bool added = false;
+        for (std::map<unsigned long long, Page>::iterator it = pending.begin(); it != pending.end(); ++it) {
+            if (it->second.present) {
+                writePage(it->second, it->second.jpeg);
+                added = true;
+            }
+        }
+        pending.clear();
+        if (added) commitUpdate();
+
+        std::fclose(file);
+        file = NULL;
+        if (pages.empty()) std::remove(filePath.c_str());
+        if (!marker.empty()) std::remove(marker.c_str());
+    }
+
+    bool isOpen() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return file != NULL;
+    }
+
+    int pageCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (int)pages.size();
+    }
+
+    const std::string& path() const { return filePath; }
+
+    // Cuts off anything after the last complete update of a session file.
+    // Returns its page count (a session without pages is deleted), or -1
+    // if `path` is not a readable PDF with a complete update.
+    static int recover(const std::string& path) {
+        std::string data;
+        if (!readFile(path, data)) return -1;
+
+        size_t end = std::string::npos;
+        for (size_t pos = data.rfind("%%EOF"); pos != std::string::npos && pos > 0; pos = data.rfind("%%EOF", pos - 1)) {
+            // Only a trailer's %%EOF counts; the bytes could also occur inside image data
+            size_t start = data.rfind("startxref\n", pos);
+            if (start != std::string::npos && pos - start < 32 && pos - start > 11) {
+                end = pos + 5;
+                if (end < data.size() && data[end] == '\n') end++;
+                break;
+            }
+        }
+        if (end == std::string::npos) return -1;
+
+        if (end < data.size()) {
+            if (!truncateFile(path, (long long)end)) return -1;
+            data.resize(end);
+        }
+
+        // The newest Pages object holds the count
+        size_t pagesObject = data.rfind("\n2 0 obj\n");
+        if (pagesObject == std::string::npos) return -1;
+        size_t count = data.find("/Count ", pagesObject);
+        if (count == std::string::npos) return -1;
+        int pageTotal = std::atoi(data.c_str() + count + 7);
+        if (pageTotal == 0) std::remove(path.c_str());
+        return pageTotal;
+    }
+
+    // Repairs the session named in `markerPath`, left there by a run that
+    // did not close() it, and removes the marker. Returns recover()'s
+    // result, or -1 if there was no marker.
+    static int recoverFromMarker(const std::string& markerPath, std::string& sessionPath) {
+        if (!readFile(markerPath, sessionPath)) return -1;
+        while (!sessionPath.empty() && (sessionPath.back() == '\n' || sessionPath.back() == '\r')) sessionPath.pop_back();
+        int result = sessionPath.empty() ? -1 : recover(sessionPath);
+        std::remove(markerPath.c_str());
+        return result;
+    }
+
+private:
+    struct Page {
+        bool present;
+        bool gray;
+        cv::Size size;
+        std::vector<uchar> jpeg;        // only while buffered
+
+        Page() : present(false), gray(false) {}
+    };
+
+    // Writes every buffered page whose predecessors are all in, then one
+    // update for them and any page the caller already `added`
+    void writeReady(bool added) {
+        std::map<unsigned long long, Page>::iterator it;
+        while ((it = pending.find(nextSequence)) != pending.end()) {
+            if (it->second.present) {
+                writePage(it->second, it->second.jpeg);
+                added = true;
+            }
+            pending.erase(it);
+            nextSequence++;
+        }
+        if (added) commitUpdate();
+    }
+
+    // Image XObject, content stream and page object; the Pages object and
+    // xref follow in commitUpdate()
+    void writePage(const Page& page, const std::vector<uchar>& jpeg) {
+        int image = nextObject++;
+        int content = nextObject++;
+        int pageObject = nextObject++;
+        double width = page.size.width * 72.0 / dpi;
+        double height = page.size.height * 72.0 / dpi;
+        char buffer[256];
+
+        beginObject(image);
+        std::snprintf(buffer, sizeof(buffer),
+            "<< /Type /XObject /Subtype /Image /Width %d /Height %d /ColorSpace /%s /BitsPerComponent 8 "
+            "/Filter /DCTDecode /Length %lu >>\nstream\n",
+            page.size.width, page.size.height, page.gray ? "DeviceGray" : "DeviceRGB", (unsigned long)jpeg.size());
+        put(buffer);
+        put((const char*)jpeg.data(), jpeg.size());
+        put("\nendstream\nendobj\n");
+
+        char drawing[96];
+        int drawingLength = std::snprintf(drawing, sizeof(drawing), "q\n%.2f 0 0 %.2f 0 0 cm\n/Im0 Do\nQ\n", width, height);
+        beginObject(content);
+        std::snprintf(buffer, sizeof(buffer), "<< /Length %d >>\nstream\n", drawingLength);
+        put(buffer);
+        put(drawing, (size_t)drawingLength);
+        put("endstream\nendobj\n");
+
+        beginObject(pageObject);
+        std::snprintf(buffer, sizeof(buffer),
+            "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 %.2f %.2f] /Resources << /XObject << /Im0 %d 0 R >> >> "
+            "/Contents %d 0 R >>\nendobj\n",
+            width, height, image, content);
+        put(buffer);
+        pages.push_back(pageObject);
+    }
+
+    // New Pages object, xref section for the objects written since the
+    // last update, trailer and %%EOF, then flushed to the OS
+    void commitUpdate() {
+        beginObject(2);
+        std::string kids = "<< /Type /Pages /Kids [";
+        for (size_t i = 0; i < pages.size(); i++) {
+            kids += (i == 0 ? "" : " ") + std::to_string(pages[i]) + " 0 R";
+        }
+        kids += "] /Count " + std::to_string(pages.size()) + " >>\nendobj\n";
+        put(kids);
+
+        long long xref = offset;
+        std::string table = "xref\n";
+        if (lastXref == 0) written.insert(written.begin(), std::make_pair(0, -1LL));
+        std::sort(written.begin(), written.end());
+        char entry[32];
+        for (size_t i = 0; i < written.size();) {
+            size_t run = i + 1;
+            while (run < written.size() && written[run].first == written[run - 1].first + 1) run++;
+            table += std::to_string(written[i].first) + " " + std::to_string(run - i) + "\n";
+            for (; i < run; i++) {
+                if (written[i].second < 0) std::snprintf(entry, sizeof(entry), "0000000000 65535 f \n");
+                else std::snprintf(entry, sizeof(entry), "%010lld 00000 n \n", written[i].second);
+                table += entry;
+            }
+        }
+        table += "trailer\n<< /Size " + std::to_string(nextObject) + " /Root 1 0 R";
+        if (lastXref != 0) table += " /Prev " + std::to_string(lastXref);
+        table += " >>\nstartxref\n" + std::to_string(xref) + "\n%%EOF\n";
+        put(table);
+
+        written.clear();
+        lastXref = xref;
+        if (std::fflush(file) != 0) failed = true;
+    }
+
+    void beginObject(int number) {
+        written.push_back(std::make_pair(number, offset));
+        put(std::to_string(number) + " 0 obj\n");
+    }
+
+    void put(const char* data, size_t size) {
+        if (std::fwrite(data, 1, size, file) != size) failed = true;
+        offset += (long long)size;
+    }
+
+    void put(const char* text) { put(text, std::strlen(text)); }
+    void put(const std::string& text) { put(text.data(), text.size()); }
+
+    void writeMarker() {
+        FILE* out = std::fopen(marker.c_str(), "wb");
+        if (out == NULL) return;
+        std::fputs((filePath + "\n").c_str(), out);
+        std::fclose(out);
+    }
+
+    static bool readFile(const std::string& path, std::string& data) {
+        FILE* in = std::fopen(path.c_str(), "rb");
+        if (in == NULL) return false;
+        data.clear();
+        char buffer[65536];
+        size_t n;
+        while ((n = std::fread(buffer, 1, sizeof(buffer), in)) > 0) data.append(buffer, n);
+        std::fclose(in);
+        return true;
+    }
+
+    static bool truncateFile(const std::string& path, long long size) {
+#ifdef _WIN32
+        int fd = -1;
+        if (_sopen_s(&fd, path.c_str(), _O_RDWR | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE) != 0) return false;
+        bool ok = _chsize_s(fd, size) == 0;
+        _close(fd);
+        return ok;
+#else
+        return ::truncate(path.c_str(), (off_t)size) == 0;
+#endif
+    }
+
+    mutable std::mutex mutex;
+    FILE* file;
+    std::string filePath;
+    std::string marker;
+    long long offset;                   // bytes written so far
+    long long lastXref;                 // 0 until the first update
+    int nextObject;                     // 1 = catalog, 2 = pages
+    unsigned long long nextSequence;
+    double dpi;
+    bool failed;
+    std::vector<int> pages;             // page object numbers in order
+    std::vector<std::pair<int, long long> > written;   // objects since the last update
+    std::map<unsigned long long, Page> pending;
+};
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "HttpServer.hpp"
+
+const char* const kPreviewBoundary = "esp_doc_preview";
+
+// Live preview and remote controls for headless operation, served on
+// http://127.0.0.1:<port>:
+//   GET  /             page with every feed and Capture / Quit buttons
+//   GET  /stream/<i>   MJPEG (multipart/x-mixed-replace) of feed i
+//   POST /capture      what the 'c' key does
+//   POST /quit         what the 'q' key does
+// POSTs need an X-Requested-With header (LocalHttpServer refuses them
+// otherwise, so other web pages cannot press the buttons).
+// The publishing thread only copies the frame, and only when a client is
+// watching and the rate cap allows one. The overlay is drawn and the JPEG
+// encoded on the server's own thread. One publishing thread per feed.
+class PreviewServer {
+public:
+    // Draws the overlay on the preview's copy of the frame (preview thread)
+    typedef std::function<void(cv::Mat& canvas)> Render;
+
+    PreviewServer()
+        : running(false), jpegQuality(70), interval(std::chrono::milliseconds(200)), captureRequests(0), quit(false) {}
+
+    ~PreviewServer() {
+        stop();
+    }
+
+    // Before start(); returns the index publish() takes
+    int addFeed(const std::string& name) {
+        feeds.push_back(std::unique_ptr<Feed>(new Feed(name)));
+        return (int)feeds.size() - 1;
+    }
+
+    bool start(int port, double maxFps, int quality) {
+        stop();
+        jpegQuality = quality;
+        interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1.0 / (maxFps > 0.0 ? maxFps : 5.0)));
+        running = true;
+        renderThread = std::thread(&PreviewServer::renderLoop, this);
+        if (!server.start(port, [this](const std::string& method, const std::string& path, HttpResponder& out) {
+                handle(method, path, out);
+            })) {
+            stop();
+            return false;
+        }
+        return true;
+    }
+
+    void stop() {
+        server.stop();
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            running = false;
+        }
+        wake.notify_all();
+        if (renderThread.joinable()) renderThread.join();
+
+        for (size_t i = 0; i < feeds.size(); i++) {
+            Feed& feed = *feeds[i];
+            std::lock_guard<std::mutex> lock(feed.mutex);
+            for (size_t k = 0; k < feed.joining.size(); k++) net::closeSocket(feed.joining[k]);
+            for (size_t k = 0; k < feed.clients.size(); k++) net::closeSocket(feed.clients[k]);
+            feed.joining.clear();
+            feed.clients.clear();
+            feed.clientCount = 0;
+        }
+    }
+
+    // Someone watches `feed`, the rate cap allows a frame and the last one
+    // has been sent. Cheap enough to ask every frame.
+    bool wantsFrame(int feed) {
+        Feed& f = *feeds[feed];
+        return f.clientCount > 0 && !f.pending && std::chrono::steady_clock::now() - f.lastPublish >= interval;
+    }
+
+    // Copies `frame`; `render` runs later on the preview thread
+    void publish(int feed, const cv::Mat& frame, Render render) {
+        Feed& f = *feeds[feed];
+        {
+            std::lock_guard<std::mutex> lock(f.mutex);
+            frame.copyTo(f.staged);
+            f.render = std::move(render);
+            f.pending = true;
+        }
+        f.lastPublish = std::chrono::steady_clock::now();
+        {
+            // The preview thread checks `pending` under this lock; taking it
+            // here means the wake-up cannot fall between check and wait
+            std::lock_guard<std::mutex> lock(wakeMutex);
+        }
+        wake.notify_one();
+    }
+
+    // Capture requests since the last call, reported once each
+    bool takeCaptureRequest() {
+        int pending = captureRequests.load();
+        while (pending > 0 && !captureRequests.compare_exchange_weak(pending, pending - 1)) {}
+        return pending > 0;
+    }
+
+    bool quitRequested() const { return quit; }
+
+private:
+    struct Feed {
+        std::string name;
+        std::mutex mutex;                       // staged, render, joining
+        cv::Mat staged;
+        Render render;
+        std::vector<net::Socket> joining;       // accepted, not yet streaming
+        std::atomic<bool> pending;              // staged holds an unsent frame
+        std::atomic<int> clientCount;
+        std::chrono::steady_clock::time_point lastPublish;     // publishing thread only
+        std::vector<net::Socket> clients;       // preview thread only
+        cv::Mat canvas;
+        std::vector<uchar> jpeg;
+
+        explicit Feed(const std::string& feedName) : name(feedName), pending(false), clientCount(0) {}
+    };
+
+    // Accept thread: answers at once, streams are handed to the preview thread
+    void handle(const std::string& method, const std::string& path, HttpResponder& out) {
+        const std::string streamPrefix = "/stream/";
+        if (path == "/capture" || path == "/quit") {
+            if (method != "POST") {
+                out.respond(405, "text/plain", "use POST\n");
+                return;
+            }
+            if (path == "/quit") quit = true;
+            else captureRequests++;
+            out.respond(200, "text/plain", "ok\n");
+        }
+        else if (method == "GET" && (path == "/" || path == "/index.html")) {
+            out.respond(200, "text/html", indexPage());
+        }
+        else if (method == "GET" && path.compare(0, streamPrefix.size(), streamPrefix) == 0) {
+            int index = std::atoi(path.c_str() + streamPrefix.size());
+            if (path.size() == streamPrefix.size() || index < 0 || index >= (int)feeds.size()) {
+                out.respond(404, "text/plain", "no such feed\n");
+                return;
+            }
+            if (!out.send("HTTP/1.1 200 OK\r\nContent-Type: multipart/x-mixed-replace; boundary=" + std::string(kPreviewBoundary) +
+                    "\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n")) {
+                return;
+            }
+            net::setSendTimeout(out.socket(), 2000);
+            Feed& feed = *feeds[index];
+            std::lock_guard<std::mutex> lock(feed.mutex);
+            feed.joining.push_back(out.detach());
+            feed.clientCount++;
+        }
+        else {
+            out.respond(404, "text/plain", "not found\n");
+        }
+    }
+
+    std::string indexPage() const {
+        std::string page =
+            "<!doctype html><html><head><title>esp_doc preview</title></head>"
+            "<body style=\"background:#222;color:#eee;font-family:sans-serif\">"
+            "<script>function post(p){fetch(p,{method:'POST',headers:{'X-Requested-With':'esp_doc'}});}</script>"
+            "<button onclick=\"post('/capture')\">Capture</button> "
+            "<button onclick=\"post('/quit')\">Quit</button>";
+        for (size_t i = 0; i < feeds.size(); i++) {
+            page += "<h3>" + feeds[i]->name + "</h3><img src=\"/stream/" + std::to_string(i) + "\">";
+        }
+        return page + "</body></html>\n";
+    }
+
+    void renderLoop() {
+        std::vector<int> params;
+        params.push_back(cv::IMWRITE_JPEG_QUALITY);
+        params.push_back(jpegQuality);
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(wakeMutex);
+                wake.wait_for(lock, std::chrono::milliseconds(500), [this]() { return !running || anyPending(); });
+                if (!running) return;
+            }
+            for (size_t i = 0; i < feeds.size(); i++) {
+                sendFrame(*feeds[i], params);
+            }
+        }
+    }
+
+    bool anyPending() const {
+        for (size_t i = 0; i < feeds.size(); i++) {
+            if (feeds[i]->pending) return true;
+        }
+        return false;
+    }
+
+    // Draws, encodes and sends the feed's staged frame to its clients;
+    // a client whose send fails (gone or stalled) is dropped
+    void sendFrame(Feed& feed, const std::vector<int>& params) {
+        Render render;
+        {
+            std::lock_guard<std::mutex> lock(feed.mutex);
+            feed.clients.insert(feed.clients.end(), feed.joining.begin(), feed.joining.end());
+            feed.joining.clear();
+            if (!feed.pending) return;
+            std::swap(feed.canvas, feed.staged);
+            render.swap(feed.render);
+        }
+
+        if (render) render(feed.canvas);
+        cv::imencode(".jpg", feed.canvas, feed.jpeg, params);
+        std::string head = std::string("--") + kPreviewBoundary + "\r\nContent-Type: image/jpeg\r\nContent-Length: " +
+            std::to_string(feed.jpeg.size()) + "\r\n\r\n";
+
+        for (size_t k = 0; k < feed.clients.size();) {
+            net::Socket client = feed.clients[k];
+            if (net::sendAll(client, head.data(), head.size()) &&
+                net::sendAll(client, (const char*)feed.jpeg.data(), feed.jpeg.size()) &&
+                net::sendAll(client, "\r\n", 2)) {
+                k++;
+                continue;
+            }
+            net::closeSocket(client);
+            feed.clients.erase(feed.clients.begin() + k);
+            feed.clientCount--;
+        }
+        feed.pending = false;
+    }
+
+    std::vector<std::unique_ptr<Feed> > feeds;
+    LocalHttpServer server;
+    std::thread renderThread;
+    std::mutex wakeMutex;                       // guards running for the preview thread's wait
+    std::condition_variable wake;
+    bool running;
+    int jpegQuality;
+    std::chrono::steady_clock::duration interval;
+    std::atomic<int> captureRequests;
+    std::atomic<bool> quit;
+};
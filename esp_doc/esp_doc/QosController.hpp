@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+
+#include "Config.hpp"
+#include "DetectorEngine.hpp"
+
+// What the detection stage should do at the current QoS level
+struct QosSettings {
+    int stride;                         // run detection on every Nth frame
+    int detectionLevel;                 // pyramid level for detect()
+    bool fastProcessing;                // guided filter instead of the bilateral
+    bool useColorDetection;
+};
+
+// Keeps the detection stage inside a per-frame time budget on a shared CPU.
+// Feeds an EWMA of the processing time (amortized over the stride) and
+// steps through cumulative degradation levels:
+//   1: detect every 2nd frame   2: one more pyramid level
+//   3: fastProcessing           4: no color detection   5: every 3rd frame
+// Steps down after a short run over budget, back up only after a long run
+// below half the budget, and ignores the first frames after any change, so
+// it settles instead of oscillating. Level 0 is the Config as written.
+class QosController {
+public:
+    static const int kMaxLevel = 5;
+
+    QosController(const Config& cfg) : config(cfg), current(0), averageMs(0.0), overCount(0), underCount(0), settle(0) {
+        apply();
+    }
+
+    int level() const { return current; }
+    const QosSettings& settings() const { return active; }
+    double averageFrameMs() const { return averageMs; }
+
+    // Pushes the settings into the detector
+    void configure(DetectorEngine& detector) const {
+        detector.setDetectionLevel(active.detectionLevel);
+        detector.setFastProcessing(active.fastProcessing);
+        detector.setColorDetection(active.useColorDetection);
+    }
+
+    // Reports one processed frame. Returns true when the level changed.
+    bool update(double processingMs) {
+        double amortized = processingMs / active.stride;
+        averageMs = averageMs <= 0.0 ? amortized : averageMs + 0.2 * (amortized - averageMs);
+
+        if (settle > 0) {
+            settle--;
+            return false;
+        }
+
+        double budget = config.qosBudgetMs;
+        overCount = averageMs > budget ? overCount + 1 : 0;
+        underCount = averageMs < budget * 0.5 ? underCount + 1 : 0;
+
+        if (overCount >= kDegradeAfter && current < kMaxLevel) {
+            current++;
+        }
+        else if (underCount >= kRecoverAfter && current > 0) {
+            current--;
+        }
+        else {
+            return false;
+        }
+
+        apply();
+        overCount = underCount = 0;
+        settle = kSettleFrames;
+        averageMs = 0.0;                // re-learn the cost at the new level
+        return true;
+    }
+
+private:
+    static const int kDegradeAfter = 10;
+    static const int kRecoverAfter = 90;
+    static const int kSettleFrames = 15;
+
+    void apply() {
+        int baseStride = config.skipFrames ? std::max(1, config.processEveryNthFrame) : 1;
+        active.stride = baseStride * (current >= 5 ? 3 : current >= 1 ? 2 : 1);
+        active.detectionLevel = std::min(config.detectionPyramidLevel + (current >= 2 ? 1 : 0), kMaxDetectionLevel);
+        active.fastProcessing = config.fastProcessing || current >= 3;
+        active.useColorDetection = config.useColorDetection && current < 4;
+    }
+
+    Config config;
+    QosSettings active;
+    int current;
+    double averageMs;
+    int overCount;
+    int underCount;
+    int settle;
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "WorkspaceBuffer.hpp"
+
+struct QualityMetrics {
+    double sharpness;
+    double brightness;
+    double contrast;
+    int overallScore;
+    bool isGoodQuality;
+};
+
+struct QualityWorkspace {
+    cv::Mat grayBuffer;
+    cv::Mat laplacianBuffer;
+};
+
+// Turns sharpness/brightness/contrast into overallScore and isGoodQuality
+inline void scoreQuality(QualityMetrics& metrics) {
+    double sharpnessScore = (metrics.sharpness > 100.0) ? 100.0 : (metrics.sharpness / 100.0 * 100.0);
+    double brightnessScore = 100.0 - (metrics.brightness > 128.0 ? (metrics.brightness - 128.0) : (128.0 - metrics.brightness)) / 128.0 * 100.0;
+    double contrastScore = (metrics.contrast > 50.0) ? 100.0 : (metrics.contrast / 50.0 * 100.0);
+
+    metrics.overallScore = (int)((sharpnessScore * 0.4 + brightnessScore * 0.3 + contrastScore * 0.3));
+    metrics.isGoodQuality = metrics.overallScore >= 60; // Lowered threshold
+}
+
+// RESTORED: Proper quality assessment
+inline QualityMetrics assessQuality(const cv::Mat& img, QualityWorkspace& ws) {
+    QualityMetrics metrics;
+    cv::Mat gray;
+
+    if (img.channels() == 3) {
+        gray = workspaceView(ws.grayBuffer, img.size(), CV_8UC1);
+        cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    }
+    else {
+        gray = img;
+    }
+
+    // Sharpness (Laplacian variance). The 3x3 aperture on 8-bit input stays
+    // within +-1020, so CV_16S gives exactly the statistics CV_64F did.
+    cv::Mat laplacian = workspaceView(ws.laplacianBuffer, gray.size(), CV_16SC1);
+    cv::Laplacian(gray, laplacian, CV_16S, 1, 1, 0, cv::BORDER_DEFAULT | cv::BORDER_ISOLATED);
+    cv::Scalar mean, stddev;
+    cv::meanStdDev(laplacian, mean, stddev);
+    metrics.sharpness = stddev[0] * stddev[0];
+
+    // Brightness
+    cv::meanStdDev(gray, mean, stddev);
+    metrics.brightness = mean[0];
+
+    // Contrast
+    metrics.contrast = stddev[0];
+
+    scoreQuality(metrics);
+    return metrics;
+}
+
+inline QualityMetrics assessQuality(const cv::Mat& img) {
+    QualityWorkspace ws;
+    return assessQuality(img, ws);
+}
+
+// Same metrics as assessQuality(), estimated on the unwarped quad inside a
+// full-resolution 8-bit gray frame. Walks the quad row by row (it is convex)
+// and accumulates gray values and the 4-neighbour Laplacian (what
+// cv::Laplacian computes with ksize 1) in integers. Large quads are sampled
+// on a grid so the cost stays around 64K pixels whatever the resolution.
+// The warp scales the page up to at least 300 px a side, which flattens the
+// Laplacian: its variance is divided by the square of the warp/quad area
+// ratio. Perspective and the cubic resampling are otherwise ignored.
+// esp_doc_bench reports how often it agrees with assessQuality() on the
+// qualityThreshold decision, per input (quality_estimate).
+inline QualityMetrics assessQuadQuality(const cv::Mat& gray, const std::vector<cv::Point>& quad) {
+    QualityMetrics metrics = { 0.0, 0.0, 0.0, 0, false };
+    if (quad.size() != 4 || gray.type() != CV_8UC1 || gray.rows < 3 || gray.cols < 3) return metrics;
+
+    int top = quad[0].y, bottom = quad[0].y;
+    for (int i = 1; i < 4; i++) {
+        top = std::min(top, quad[i].y);
+        bottom = std::max(bottom, quad[i].y);
+    }
+    top = std::max(top, 1);
+    bottom = std::min(bottom, gray.rows - 2);
+
+    double area = std::fabs(cv::contourArea(quad));
+    int step = std::max(1, (int)std::sqrt(area / 65536.0));
+
+    long long count = 0, graySum = 0, lapSum = 0;
+    unsigned long long graySq = 0, lapSq = 0;
+
+    for (int y = top; y <= bottom; y += step) {
+        // Span of the convex quad on this row
+        double xMin = gray.cols, xMax = -1.0;
+        for (int i = 0; i < 4; i++) {
+            const cv::Point& a = quad[i];
+            const cv::Point& b = quad[(i + 1) % 4];
+            if ((y < a.y && y < b.y) || (y > a.y && y > b.y)) continue;
+            if (a.y == b.y) {
+                xMin = std::min(xMin, (double)std::min(a.x, b.x));
+                xMax = std::max(xMax, (double)std::max(a.x, b.x));
+                continue;
+            }
+            double x = a.x + (double)(y - a.y) * (b.x - a.x) / (b.y - a.y);
+            xMin = std::min(xMin, x);
+            xMax = std::max(xMax, x);
+        }
+        int xs = std::max((int)std::ceil(xMin), 1);
+        int xe = std::min((int)std::floor(xMax), gray.cols - 2);
+
+        const uchar* up = gray.ptr<uchar>(y - 1);
+        const uchar* row = gray.ptr<uchar>(y);
+        const uchar* down = gray.ptr<uchar>(y + 1);
+        for (int x = xs; x <= xe; x += step) {
+            int v = row[x];
+            int lap = up[x] + down[x] + row[x - 1] + row[x + 1] - 4 * v;
+            graySum += v;
+            graySq += (unsigned long long)(v * v);
+            lapSum += lap;
+            lapSq += (unsigned long long)(lap * lap);
+            count++;
+        }
+    }
+    if (count == 0) return metrics;
+
+    double grayMean = (double)graySum / count;
+    double lapMean = (double)lapSum / count;
+    metrics.sharpness = std::max(0.0, (double)lapSq / count - lapMean * lapMean);
+
+    // Page size warpDocument() would produce (opposite sides, at least 300)
+    double w = std::max(cv::norm(quad[1] - quad[0]), cv::norm(quad[3] - quad[2]));
+    double h = std::max(cv::norm(quad[2] - quad[1]), cv::norm(quad[0] - quad[3]));
+    double upscale = std::max(1.0, std::max((int)w, 300) * (double)std::max((int)h, 300) / std::max(area, 1.0));
+    metrics.sharpness /= upscale * upscale;
+    metrics.brightness = grayMean;
+    metrics.contrast = std::sqrt(std::max(0.0, (double)graySq / count - grayMean * grayMean));
+
+    scoreQuality(metrics);
+    return metrics;
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include "Config.hpp"
+#include "DetectorEngine.hpp"
+#include "StabilityDetector.hpp"
+
+// One page held under the camera
+struct ScanTrack {
+    int id;                             // 1..maxDocuments, the same while the page is in view
+    std::vector<cv::Point> quad;        // latest outline
+    int qualityScore;
+    long long detectedAt;
+    bool saved;
+    long long cooldownUntil;
+    cv::Point savedCorners[4];          // ordered outline at the save
+    int savedScore;
+    bool changed;                       // moved or swapped since the save
+    bool seen;                          // matched in the current update()
+    StabilityDetector stability;
+
+    ScanTrack(const Config& cfg, int trackId, long long now)
+        : id(trackId), qualityScore(0), detectedAt(now), saved(false), cooldownUntil(0), savedScore(0), changed(false),
+          seen(true), stability(cfg) {}
+};
+
+enum class ScanEventType { Detected, Lost, SaveDue };
+
+struct ScanEvent {
+    ScanEventType type;
+    int id;
+    long long elapsedMs;                // since the page was detected
+    bool early;                         // SaveDue because the page is stable
+};
+
+// Detection timers for every page in view. Each frame's good-quality quads
+// are matched to the known pages (a quad belongs to the page whose outline
+// contains its center; with multiDocument off there is only one page and
+// every quad is it); unmatched quads start new pages, taking the smallest
+// free id in 1..maxDocuments, and pages without a quad are lost. A page is
+// due for saving once it is stable or after detectionTimeSeconds. A saved
+// page stays saved while it lies still; it re-arms (no sooner than
+// saveCooldownMs after the save) once a corner moves or the quality score
+// shifts by more than twice the stability tolerances, e.g. the next sheet
+// of a stack going on top.
+// Time is passed in by the caller, so the same inputs give the same events.
+class ScanStateMachine {
+public:
+    // Page ids travel as bits of a 32-bit mask on the ESP32 ("DOC_DETECTED
+    // 2"), bit 0 being the single-page protocol
+    static const int kMaxPageId = 31;
+
+    ScanStateMachine(const Config& cfg) : config(cfg) {}
+
+    // `quads` and `scores` are this frame's valid documents. `processed` is
+    // false for a repeated result (QoS stride), which must not count as a
+    // still frame. Appends what happened to `events`.
+    void update(long long now, const std::vector<std::vector<cv::Point> >& quads, const std::vector<int>& scores,
+        bool processed, std::vector<ScanEvent>& events) {
+        for (size_t t = 0; t < tracks.size(); t++) tracks[t].seen = false;
+
+        unmatched.clear();
+        for (size_t q = 0; q < quads.size(); q++) {
+            ScanTrack* track = match(quads[q]);
+            if (track == NULL) unmatched.push_back(q);
+            else see(*track, quads[q], scores[q], processed);
+        }
+
+        // Lost and re-armed pages go first, so their ids are free again
+        for (size_t t = 0; t < tracks.size();) {
+            ScanTrack& track = tracks[t];
+            if (!track.seen) {
+                pushEvent(events, ScanEventType::Lost, track, now, false);
+                tracks.erase(tracks.begin() + t);
+                continue;
+            }
+            if (track.saved && track.changed && now >= track.cooldownUntil) {
+                // Re-arm: the page is detected afresh on the next frame
+                tracks.erase(tracks.begin() + t);
+                continue;
+            }
+            t++;
+        }
+
+        for (size_t i = 0; i < unmatched.size(); i++) {
+            int id = freeId();
+            if (id == 0) break;         // more quads than maxDocuments
+            tracks.push_back(ScanTrack(config, id, now));
+            pushEvent(events, ScanEventType::Detected, tracks.back(), now, false);
+            see(tracks.back(), quads[unmatched[i]], scores[unmatched[i]], processed);
+        }
+
+        for (size_t t = 0; t < tracks.size(); t++) {
+            const ScanTrack& track = tracks[t];
+            if (track.saved) continue;
+            long long elapsed = now - track.detectedAt;
+            bool timeUp = elapsed >= config.detectionTimeSeconds * 1000LL;
+            bool stable = config.earlyCapture && track.stability.isStable();
+            if (stable || timeUp) pushEvent(events, ScanEventType::SaveDue, track, now, !timeUp);
+        }
+    }
+
+    // The page's save was accepted; otherwise SaveDue repeats next frame
+    void markSaved(int id, long long now) {
+        ScanTrack* track = find(id);
+        if (track == NULL) return;
+        track->saved = true;
+        track->cooldownUntil = now + config.saveCooldownMs;
+        orderQuadCorners(track->quad, track->savedCorners);
+        track->savedScore = track->qualityScore;
+        track->changed = false;
+    }
+
+    ScanTrack* find(int id) {
+        for (size_t t = 0; t < tracks.size(); t++) {
+            if (tracks[t].id == id) return &tracks[t];
+        }
+        return NULL;
+    }
+
+    // Pages in view, oldest first
+    const std::vector<ScanTrack>& pages() const { return tracks; }
+
+private:
+    void see(ScanTrack& track, const std::vector<cv::Point>& quad, int score, bool processed) {
+        track.seen = true;
+        track.quad.assign(quad.begin(), quad.end());
+        track.qualityScore = score;
+        if (processed) track.stability.add(quad, score);
+        if (track.saved && !track.changed) track.changed = changedSinceSave(track);
+    }
+
+    // Smallest id no page in view holds, 1..maxDocuments (1 in single-page
+    // mode), or 0 when all are taken. Ids are reused so they stay within
+    // the ESP32's page mask.
+    int freeId() const {
+        int limit = config.multiDocument ? std::min(std::max(config.maxDocuments, 1), (int)kMaxPageId) : 1;
+        for (int id = 1; id <= limit; id++) {
+            bool taken = false;
+            for (size_t t = 0; t < tracks.size() && !taken; t++) taken = tracks[t].id == id;
+            if (!taken) return id;
+        }
+        return 0;
+    }
+
+    ScanTrack* match(const std::vector<cv::Point>& quad) {
+        // Single-page mode: whatever is in view is the same page
+        if (!config.multiDocument) return tracks.empty() || tracks[0].seen ? NULL : &tracks[0];
+
+        cv::Point2f center(0.0f, 0.0f);
+        for (size_t i = 0; i < quad.size(); i++) {
+            center.x += quad[i].x / (float)quad.size();
+            center.y += quad[i].y / (float)quad.size();
+        }
+        for (size_t t = 0; t < tracks.size(); t++) {
+            if (!tracks[t].seen && cv::pointPolygonTest(tracks[t].quad, center, false) >= 0) return &tracks[t];
+        }
+        return NULL;
+    }
+
+    // Beyond what a still page does between frames: each corner stays within
+    // stableMaxJitterPx of its mean and the score within stableQualityDrop
+    bool changedSinceSave(const ScanTrack& track) const {
+        if (std::abs(track.qualityScore - track.savedScore) > 2 * config.stableQualityDrop) return true;
+        cv::Point ordered[4];
+        orderQuadCorners(track.quad, ordered);
+        for (int i = 0; i < 4; i++) {
+            if (cv::norm(ordered[i] - track.savedCorners[i]) > 2 * config.stableMaxJitterPx) return true;
+        }
+        return false;
+    }
+
+    static void pushEvent(std::vector<ScanEvent>& events, ScanEventType type, const ScanTrack& track, long long now, bool early) {
+        ScanEvent ev;
+        ev.type = type;
+        ev.id = track.id;
+        ev.elapsedMs = now - track.detectedAt;
+        ev.early = early;
+        events.push_back(ev);
+    }
+
+    Config config;
+    std::vector<ScanTrack> tracks;
+    std::vector<size_t> unmatched;      // this frame's quads without a page
+};
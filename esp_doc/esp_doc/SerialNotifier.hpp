@@ -0,0 +1,476 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN     // keeps winsock.h out, HttpServer.hpp uses winsock2.h
+#endif
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+// Raw serial line to the ESP32. Only the notifier thread touches it.
+class SerialPort {
+public:
+#ifdef _WIN32
+    SerialPort() : hSerial(INVALID_HANDLE_VALUE) {}
+#else
+    SerialPort() : fd(-1) {}
+#endif
+
+    ~SerialPort() { close(); }
+
+#ifdef _WIN32
+    bool open(const std::string& portName, int baud = 115200) {
+        close();
+
+        std::string full = "\\\\.\\" + portName;
+        hSerial = CreateFileA(full.c_str(), GENERIC_WRITE | GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hSerial == INVALID_HANDLE_VALUE) return false;
+
+        DCB dcb;
+        SecureZeroMemory(&dcb, sizeof(dcb));
+        dcb.DCBlength = sizeof(dcb);
+
+        if (!GetCommState(hSerial, &dcb)) {
+            close();
+            return false;
+        }
+
+        dcb.BaudRate = (DWORD)baud;
+        dcb.ByteSize = 8;
+        dcb.Parity = NOPARITY;
+        dcb.StopBits = ONESTOPBIT;
+        dcb.fDtrControl = DTR_CONTROL_ENABLE;
+        dcb.fRtsControl = RTS_CONTROL_ENABLE;
+
+        if (!SetCommState(hSerial, &dcb)) {
+            close();
+            return false;
+        }
+
+        COMMTIMEOUTS timeouts = { 0 };
+        timeouts.ReadIntervalTimeout = 10;
+        timeouts.ReadTotalTimeoutConstant = 10;
+        timeouts.WriteTotalTimeoutConstant = 10;
+        SetCommTimeouts(hSerial, &timeouts);
+        return true;
+    }
+
+    void close() {
+        if (hSerial != INVALID_HANDLE_VALUE) {
+            CloseHandle(hSerial);
+            hSerial = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    bool isOpen() const { return hSerial != INVALID_HANDLE_VALUE; }
+
+    bool write(const std::string& msg) {
+        if (!isOpen()) return false;
+        DWORD bytesWritten = 0;
+        BOOL ok = WriteFile(hSerial, msg.c_str(), (DWORD)msg.size(), &bytesWritten, NULL);
+        FlushFileBuffers(hSerial);
+        return ok && bytesWritten == msg.size();
+    }
+#else
+    bool open(const std::string& portName, int baud = 115200) {
+        close();
+
+        fd = ::open(portName.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (fd < 0) return false;
+
+        termios tty;
+        if (tcgetattr(fd, &tty) != 0) {
+            close();
+            return false;
+        }
+
+        // 8N1, raw bytes, modem lines ignored (DTR stays asserted while open)
+        cfmakeraw(&tty);
+        tty.c_cflag |= CLOCAL | CREAD;
+        tty.c_cflag &= ~(PARENB | CSTOPB | CSIZE);
+        tty.c_cflag |= CS8;
+        speed_t speed = toSpeed(baud);
+        cfsetispeed(&tty, speed);
+        cfsetospeed(&tty, speed);
+
+        if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    bool isOpen() const { return fd >= 0; }
+
+    // Same 10 ms write budget as the Win32 COMMTIMEOUTS
+    bool write(const std::string& msg) {
+        if (!isOpen()) return false;
+        size_t sent = 0;
+        while (sent < msg.size()) {
+            ssize_t n = ::write(fd, msg.data() + sent, msg.size() - sent);
+            if (n > 0) {
+                sent += (size_t)n;
+                continue;
+            }
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return false;
+
+            pollfd p = { fd, POLLOUT, 0 };
+            if (poll(&p, 1, 10) <= 0 || (p.revents & (POLLERR | POLLHUP | POLLNVAL))) return false;
+        }
+
+        // The device echoes every command; discard it so the input queue never fills
+        char scratch[256];
+        while (::read(fd, scratch, sizeof(scratch)) > 0) {}
+        return true;
+    }
+
+private:
+    static speed_t toSpeed(int baud) {
+        switch (baud) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 230400: return B230400;
+        default: return B115200;
+        }
+    }
+#endif
+
+private:
+#ifdef _WIN32
+    HANDLE hSerial;
+#else
+    int fd;
+#endif
+};
+
+// Commands understood by esp_doc_notifier.ino
+enum class NotifierEvent { DocDetected, DocLost, DocSaved, ScannerOff };
+
+// One queued notification. docId 0 is the single-page protocol; in
+// multi-document mode each page has its own id ("DOC_DETECTED 2").
+struct NotifierMessage {
+    NotifierEvent event;
+    int docId;
+};
+
+inline std::string notifierCommand(const NotifierMessage& msg) {
+    std::string command;
+    switch (msg.event) {
+    case NotifierEvent::DocDetected: command = "DOC_DETECTED"; break;
+    case NotifierEvent::DocLost: command = "DOC_LOST"; break;
+    case NotifierEvent::DocSaved: command = "DOC_SAVED"; break;
+    default: command = "SCANNER_OFF"; break;
+    }
+    if (msg.docId > 0) command += " " + std::to_string(msg.docId);
+    return command + "\n";
+}
+
+inline bool isStateEvent(NotifierEvent ev) {
+    return ev == NotifierEvent::DocDetected || ev == NotifierEvent::DocLost;
+}
+
+// LED states of the single-page protocol, which the notifier deduplicates
+// and restores. Per-page states are passed through as they come.
+inline bool isLedState(const NotifierMessage& msg) {
+    return msg.docId == 0 && isStateEvent(msg.event);
+}
+
+// Sends ESP32 notifications from its own thread. post() never blocks on I/O.
+// DETECTED/LOST are LED states: consecutive ones collapse to the newest, and
+// a state the device already shows is not re-sent. Reconnects back off
+// exponentially and the current LED state is restored after a reconnect.
+// Per-page events (docId > 0) only collapse with the same page's last
+// queued state. An empty port name disables the notifier.
+class SerialNotifier {
+public:
+    SerialNotifier(const std::string& port, int baud = 115200)
+        : portName(port), baudRate(baud), connected(false), failures(0), dropped(0),
+          stopping(false), hasState(false), currentState(NotifierEvent::DocLost) {
+        if (!portName.empty()) worker = std::thread(&SerialNotifier::run, this);
+    }
+
+    ~SerialNotifier() { stop(); }
+
+    void post(NotifierEvent ev, int docId = 0) {
+        NotifierMessage msg = { ev, docId };
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping || portName.empty()) return;
+            if (isLedState(msg)) {
+                hasState = true;
+                currentState = ev;
+            }
+            if (isStateEvent(ev) && !pending.empty() && isStateEvent(pending.back().event) && pending.back().docId == docId) {
+                pending.back() = msg;
+                return;
+            }
+            if (pending.size() >= kMaxPending) {
+                pending.pop_front();
+                dropped++;
+            }
+            pending.push_back(msg);
+        }
+        wake.notify_one();
+    }
+
+    // Flushes what is queued (best effort, bounded) and joins the thread
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping && !worker.joinable()) return;
+            stopping = true;
+        }
+        wake.notify_one();
+        if (worker.joinable()) worker.join();
+    }
+
+    bool isConnected() const { return connected; }
+    unsigned long long failureCount() const { return failures; }
+    unsigned long long droppedCount() const { return dropped; }
+
+private:
+    static const size_t kMaxPending = 16;
+
+    void run() {
+        using Clock = std::chrono::steady_clock;
+        const auto minBackoff = std::chrono::milliseconds(100);
+        const auto maxBackoff = std::chrono::milliseconds(5000);
+        const auto flushBudget = std::chrono::milliseconds(1000);
+
+        SerialPort port;
+        auto backoff = minBackoff;
+        auto nextAttempt = Clock::now();
+        Clock::time_point stopDeadline;
+        bool deviceStateKnown = false;
+        NotifierEvent deviceState = NotifierEvent::DocLost;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            if (stopping) {
+                if (stopDeadline == Clock::time_point()) stopDeadline = Clock::now() + flushBudget;
+                if (pending.empty() || Clock::now() >= stopDeadline) break;
+            }
+            else if (pending.empty()) {
+                wake.wait(lock);
+                continue;
+            }
+
+            if (!connected) {
+                auto now = Clock::now();
+                if (now < nextAttempt) {
+                    wake.wait_until(lock, stopping ? std::min(nextAttempt, stopDeadline) : nextAttempt);
+                    continue;
+                }
+
+                lock.unlock();
+                bool ok = port.open(portName, baudRate);
+                if (ok) {
+                    // The ESP32 resets when DTR is asserted; give it time to boot
+                    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                }
+                lock.lock();
+
+                if (!ok) {
+                    failures++;
+                    nextAttempt = Clock::now() + backoff;
+                    backoff = std::min(backoff * 2, maxBackoff);
+                    continue;
+                }
+
+                connected = true;
+                backoff = minBackoff;
+                deviceStateKnown = false;
+                // Restore the LED unless a newer state is already on its way
+                bool stateQueued = false;
+                for (size_t i = 0; i < pending.size(); i++) {
+                    if (isLedState(pending[i])) stateQueued = true;
+                }
+                if (hasState && !stateQueued) {
+                    NotifierMessage restore = { currentState, 0 };
+                    pending.push_front(restore);
+                }
+                continue;
+            }
+
+            NotifierMessage msg = pending.front();
+            pending.pop_front();
+            if (isLedState(msg) && deviceStateKnown && msg.event == deviceState) continue;
+
+            lock.unlock();
+            bool ok = port.write(notifierCommand(msg));
+            lock.lock();
+
+            if (ok) {
+                if (isLedState(msg)) {
+                    deviceStateKnown = true;
+                    deviceState = msg.event;
+                }
+                continue;
+            }
+
+            // Lost the device: keep the event unless a newer state replaced it
+            port.close();
+            connected = false;
+            failures++;
+            const NotifierMessage* next = pending.empty() ? NULL : &pending.front();
+            if (!(isStateEvent(msg.event) && next && isStateEvent(next->event) && next->docId == msg.docId)) {
+                pending.push_front(msg);
+            }
+            nextAttempt = Clock::now() + backoff;
+            backoff = std::min(backoff * 2, maxBackoff);
+        }
+    }
+
+    std::string portName;
+    int baudRate;
+    std::atomic<bool> connected;
+    std::atomic<unsigned long long> failures;
+    std::atomic<unsigned long long> dropped;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<NotifierMessage> pending;
+    bool stopping;
+    bool hasState;
+    NotifierEvent currentState;
+    std::thread worker;
+};
+
+#ifndef _WIN32
+// Stand-in for esp_doc_notifier.ino on a pseudo-terminal pair, so the
+// notifier can be exercised on Linux without an ESP32 attached.
+// Set comPort to "pty" and the scanner talks to devicePath().
+class PtyNotifierDevice {
+public:
+    PtyNotifierDevice() : master(-1), running(false), ledOn(false), docCount(0), pagesInView(0) {}
+
+    ~PtyNotifierDevice() { stop(); }
+
+    bool start() {
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master < 0) return false;
+        if (grantpt(master) != 0 || unlockpt(master) != 0) {
+            ::close(master);
+            master = -1;
+            return false;
+        }
+        const char* name = ptsname(master);
+        slavePath = name ? name : "";
+
+        running = true;
+        reader = std::thread(&PtyNotifierDevice::run, this);
+        return true;
+    }
+
+    void stop() {
+        running = false;
+        if (reader.joinable()) reader.join();
+        if (master >= 0) {
+            ::close(master);
+            master = -1;
+        }
+    }
+
+    const std::string& devicePath() const { return slavePath; }
+    bool isLedOn() const { return ledOn; }
+    int savedCount() const { return docCount; }
+
+private:
+    void run() {
+        std::string line;
+        char buf[128];
+        while (running) {
+            pollfd p = { master, POLLIN, 0 };
+            if (poll(&p, 1, 50) <= 0) continue;
+            ssize_t n = ::read(master, buf, sizeof(buf));
+            // EIO just means no one has the slave side open right now
+            if (n <= 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                continue;
+            }
+            for (ssize_t i = 0; i < n; i++) {
+                if (buf[i] == '\n') {
+                    handleCommand(line);
+                    line.clear();
+                }
+                else if (buf[i] != '\r') {
+                    line += buf[i];
+                }
+            }
+        }
+    }
+
+    // Mirrors handleCommand() in esp_doc_notifier.ino
+    void handleCommand(const std::string& line) {
+        std::string reply = "Received: " + line + "\n";
+        // Optional page id after the command (multi-document mode)
+        size_t space = line.find(' ');
+        std::string command = line.substr(0, space);
+        int docId = space == std::string::npos ? 0 : atoi(line.c_str() + space + 1);
+        // Same range as MAX_PAGE_ID in the sketch: the bits of a 32-bit mask
+        bool validId = docId >= 0 && docId <= 31;
+        uint32_t bit = validId ? 1u << docId : 0u;
+        if (!validId) {
+            reply += "Invalid page id: " + line + "\n";
+        }
+        else if (command == "DOC_DETECTED") {
+            pagesInView |= bit;
+            ledOn = true;
+        }
+        else if (command == "DOC_SAVED") {
+            ledOn = true;
+            docCount++;
+        }
+        else if (command == "DOC_LOST") {
+            // The LED stays on while another page is in view
+            pagesInView &= ~bit;
+            ledOn = pagesInView != 0;
+        }
+        else if (command == "SCANNER_OFF") {
+            pagesInView = 0;
+            ledOn = false;
+        }
+        else {
+            reply += "Unknown command: " + line + "\n";
+        }
+        std::cout << "[esp32 stub] " << line << " (LED " << (ledOn ? "ON" : "OFF") << ", saved " << docCount << ")" << std::endl;
+        ssize_t written = ::write(master, reply.data(), reply.size());
+        (void)written;
+    }
+
+    int master;
+    std::string slavePath;
+    std::thread reader;
+    std::atomic<bool> running;
+    std::atomic<bool> ledOn;
+    std::atomic<int> docCount;
+    uint32_t pagesInView;               // bit per page id, bit 0 = single-page protocol
+};
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "DetectorEngine.hpp"
+#include "Config.hpp"
+
+// Decides when a held page is ready to save. Keeps the last
+// stableFrames quads and quality scores; the page is stable once every
+// corner has stayed within stableMaxJitterPx of its mean over that window
+// and the newest score is within stableQualityDrop of the window's best
+// (still sharp, not smearing). Feed only frames that were actually
+// processed, a repeated result would look perfectly still.
+class StabilityDetector {
+public:
+    StabilityDetector(const Config& cfg)
+        : window(std::max(2, cfg.stableFrames)), maxJitter(cfg.stableMaxJitterPx),
+          qualityDrop(cfg.stableQualityDrop), corners(window * 4), scores(window), next(0), count(0), lastJitter(0.0) {}
+
+    void reset() {
+        next = 0;
+        count = 0;
+        lastJitter = 0.0;
+    }
+
+    void add(const std::vector<cv::Point>& quad, int qualityScore) {
+        if (quad.size() != 4) {
+            reset();
+            return;
+        }
+        cv::Point ordered[4];
+        orderQuadCorners(quad, ordered);
+        for (int i = 0; i < 4; i++) corners[next * 4 + i] = ordered[i];
+        scores[next] = qualityScore;
+        next = (next + 1) % window;
+        if (count < window) count++;
+        lastJitter = measureJitter();
+    }
+
+    bool isStable() const {
+        if (count < window || lastJitter > maxJitter) return false;
+        int best = *std::max_element(scores.begin(), scores.end());
+        int newest = scores[(next + window - 1) % window];
+        return newest >= best - qualityDrop;
+    }
+
+    // Largest corner distance from its window mean (capture pixels)
+    double jitter() const { return lastJitter; }
+    int frames() const { return count; }
+
+private:
+    double measureJitter() const {
+        double worst = 0.0;
+        for (int c = 0; c < 4; c++) {
+            double mx = 0.0, my = 0.0;
+            for (int i = 0; i < count; i++) {
+                mx += corners[i * 4 + c].x;
+                my += corners[i * 4 + c].y;
+            }
+            mx /= count;
+            my /= count;
+            for (int i = 0; i < count; i++) {
+                double dx = corners[i * 4 + c].x - mx;
+                double dy = corners[i * 4 + c].y - my;
+                worst = std::max(worst, std::sqrt(dx * dx + dy * dy));
+            }
+        }
+        return worst;
+    }
+
+    int window;
+    double maxJitter;
+    int qualityDrop;
+    std::vector<cv::Point> corners;     // window x 4, ring buffer
+    std::vector<int> scores;
+    int next;
+    int count;
+    double lastJitter;
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Config.hpp"
+
+// One camera of the multi-stream mode
+struct StreamSettings {
+    std::string name;
+    std::string url;                    // stream URL, or "" for the first webcam
+    std::string comPort;                // "" = no ESP32 for this stream, "pty" = stand-in
+    std::string saveFolder;
+    int priority;                       // higher is detected first when the pool is saturated
+
+    StreamSettings() : priority(0) {}
+};
+
+inline std::string trimmed(const std::string& text) {
+    size_t begin = 0, end = text.size();
+    while (begin < end && std::isspace((unsigned char)text[begin])) begin++;
+    while (end > begin && std::isspace((unsigned char)text[end - 1])) end--;
+    return text.substr(begin, end - begin);
+}
+
+// Reads the stream list from an INI file, one [section] per camera:
+//
+//   [desk1]
+//   url = http://192.168.1.103:8080/video
+//   comPort = COM6
+//   saveFolder = scans/desk1/        ; default: <Config::saveFolder><name>/
+//   priority = 1                     ; default 0
+//
+// ';' or '#' at the start of a line or after a space starts a comment.
+// false with `error` set on an unknown key, a malformed line or a file
+// without sections.
+inline bool loadStreamSettings(const std::string& path, const Config& defaults,
+    std::vector<StreamSettings>& streams, std::string& error) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    streams.clear();
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        for (size_t i = 0; i < line.size(); i++) {
+            if ((line[i] == ';' || line[i] == '#') && (i == 0 || std::isspace((unsigned char)line[i - 1]))) {
+                line.erase(i);
+                break;
+            }
+        }
+        line = trimmed(line);
+        if (line.empty()) continue;
+
+        if (line[0] == '[') {
+            if (line[line.size() - 1] != ']' || line.size() < 3) {
+                error = path + ":" + std::to_string(lineNumber) + ": bad section header";
+                return false;
+            }
+            StreamSettings stream;
+            stream.name = trimmed(line.substr(1, line.size() - 2));
+            stream.saveFolder = defaults.saveFolder + stream.name + "/";
+            streams.push_back(stream);
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if (equals == std::string::npos || streams.empty()) {
+            error = path + ":" + std::to_string(lineNumber) + ": expected key = value inside a [section]";
+            return false;
+        }
+        std::string key = trimmed(line.substr(0, equals));
+        std::string value = trimmed(line.substr(equals + 1));
+        StreamSettings& stream = streams.back();
+        if (key == "url") stream.url = value;
+        else if (key == "comPort") stream.comPort = value;
+        else if (key == "saveFolder") {
+            stream.saveFolder = value;
+            char last = value.empty() ? '/' : value[value.size() - 1];
+            if (last != '/' && last != '\\') stream.saveFolder += "/";
+        }
+        else if (key == "priority") stream.priority = std::atoi(value.c_str());
+        else {
+            error = path + ":" + std::to_string(lineNumber) + ": unknown key \"" + key + "\"";
+            return false;
+        }
+    }
+
+    if (streams.empty()) {
+        error = path + ": no [stream] sections";
+        return false;
+    }
+    return true;
+}
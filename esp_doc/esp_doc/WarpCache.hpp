@@ -0,0 +1,152 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <cmath>
+
+// Solves the 8x8 system for the homography mapping src[i] -> dst[i]
+// (same result as cv::getPerspectiveTransform, without allocating).
+inline bool computePerspective(const cv::Point2f src[4], const cv::Point2f dst[4], double H[9]) {
+    double a[8][9];
+    for (int i = 0; i < 4; i++) {
+        double x = src[i].x, y = src[i].y, u = dst[i].x, v = dst[i].y;
+        double r0[9] = { x, y, 1, 0, 0, 0, -x * u, -y * u, u };
+        double r1[9] = { 0, 0, 0, x, y, 1, -x * v, -y * v, v };
+        for (int j = 0; j < 9; j++) {
+            a[i][j] = r0[j];
+            a[i + 4][j] = r1[j];
+        }
+    }
+
+    // Gaussian elimination with partial pivoting
+    for (int col = 0; col < 8; col++) {
+        int pivot = col;
+        for (int r = col + 1; r < 8; r++) {
+            if (std::fabs(a[r][col]) > std::fabs(a[pivot][col])) pivot = r;
+        }
+        if (std::fabs(a[pivot][col]) < 1e-12) return false;
+        if (pivot != col) {
+            for (int j = 0; j < 9; j++) std::swap(a[col][j], a[pivot][j]);
+        }
+        for (int r = col + 1; r < 8; r++) {
+            double f = a[r][col] / a[col][col];
+            for (int j = col; j < 9; j++) a[r][j] -= f * a[col][j];
+        }
+    }
+    for (int r = 7; r >= 0; r--) {
+        double v = a[r][8];
+        for (int j = r + 1; j < 8; j++) v -= a[r][j] * H[j];
+        H[r] = v / a[r][r];
+    }
+    H[8] = 1.0;
+    return true;
+}
+
+// Remap tables for the last warped quad. While the ordered corners stay
+// within `epsilon` pixels of the cached ones (same interpolation), warps are
+// a cv::remap over precomputed fixed-point maps, i.e. table lookups. When
+// the quad moves the tables are rebuilt in place, one incremental pass
+// (adds along each row, one divide per pixel), in the CV_16SC2 + CV_16UC1
+// format cv::convertMaps produces. Not thread-safe: one per thread, it
+// lives in WarpWorkspace.
+class WarpCache {
+public:
+    explicit WarpCache(double eps = 1.0) : epsilon(eps), valid(false), cachedInterpolation(-1), hitCount(0), missCount(0) {}
+
+    // Negative disables caching; 0 only reuses exactly repeated quads
+    void setEpsilon(double eps) {
+        epsilon = eps;
+        valid = false;
+    }
+    bool enabled() const { return epsilon >= 0.0; }
+
+    unsigned long long hits() const { return hitCount; }
+    unsigned long long misses() const { return missCount; }
+
+    // Makes the tables match `src` (ordered like the warper's corners) and
+    // returns the output size they produce. On a hit that is the cached
+    // size, which may differ from `size` by the epsilon movement.
+    // Returns an empty size for a degenerate quad.
+    cv::Size prepare(const cv::Point2f src[4], cv::Size size, int interpolation) {
+        if (valid && interpolation == cachedInterpolation && near(src)) {
+            hitCount++;
+            return cachedSize;
+        }
+        missCount++;
+        valid = false;
+
+        cv::Point2f dst[4] = {
+            cv::Point2f(0, 0), cv::Point2f((float)size.width, 0),
+            cv::Point2f(0, (float)size.height), cv::Point2f((float)size.width, (float)size.height)
+        };
+        double Hinv[9];
+        if (!computePerspective(dst, src, Hinv)) return cv::Size();
+
+        buildMaps(Hinv, size, interpolation == cv::INTER_NEAREST);
+        for (int i = 0; i < 4; i++) quad[i] = src[i];
+        cachedSize = size;
+        cachedInterpolation = interpolation;
+        valid = true;
+        return size;
+    }
+
+    // Applies the prepared tables; `dst` must already have the prepared size
+    void remap(const cv::Mat& img, cv::Mat& dst) const {
+        if (cachedInterpolation == cv::INTER_NEAREST) {
+            cv::remap(img, dst, mapXY, cv::noArray(), cv::INTER_NEAREST);
+        }
+        else {
+            cv::remap(img, dst, mapXY, mapFraction, cachedInterpolation);
+        }
+    }
+
+private:
+    bool near(const cv::Point2f src[4]) const {
+        for (int i = 0; i < 4; i++) {
+            if (std::fabs(src[i].x - quad[i].x) > epsilon || std::fabs(src[i].y - quad[i].y) > epsilon) return false;
+        }
+        return true;
+    }
+
+    // For every output pixel (u, v): (x, y, w) = Hinv * (u, v, 1). Stored
+    // as integer source coordinates plus a 5-bit sub-pixel index per axis.
+    void buildMaps(const double Hinv[9], cv::Size size, bool nearest) {
+        mapXY.create(size, CV_16SC2);
+        if (!nearest) mapFraction.create(size, CV_16UC1);
+
+        const double scale = nearest ? 1.0 : (double)cv::INTER_TAB_SIZE;
+        const int mask = cv::INTER_TAB_SIZE - 1;
+        for (int v = 0; v < size.height; v++) {
+            short* xy = mapXY.ptr<short>(v);
+            ushort* frac = nearest ? 0 : mapFraction.ptr<ushort>(v);
+            double x = Hinv[1] * v + Hinv[2];
+            double y = Hinv[4] * v + Hinv[5];
+            double w = Hinv[7] * v + Hinv[8];
+            for (int u = 0; u < size.width; u++) {
+                double iw = w != 0.0 ? scale / w : 0.0;
+                int ix = cv::saturate_cast<int>(x * iw);
+                int iy = cv::saturate_cast<int>(y * iw);
+                if (nearest) {
+                    xy[2 * u] = cv::saturate_cast<short>(ix);
+                    xy[2 * u + 1] = cv::saturate_cast<short>(iy);
+                }
+                else {
+                    xy[2 * u] = cv::saturate_cast<short>(ix >> cv::INTER_BITS);
+                    xy[2 * u + 1] = cv::saturate_cast<short>(iy >> cv::INTER_BITS);
+                    frac[u] = (ushort)((iy & mask) * cv::INTER_TAB_SIZE + (ix & mask));
+                }
+                x += Hinv[0];
+                y += Hinv[3];
+                w += Hinv[6];
+            }
+        }
+    }
+
+    double epsilon;
+    bool valid;
+    cv::Point2f quad[4];
+    cv::Size cachedSize;
+    int cachedInterpolation;
+    cv::Mat mapXY, mapFraction;
+    unsigned long long hitCount, missCount;
+};
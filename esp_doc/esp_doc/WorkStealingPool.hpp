@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN     // keeps winsock.h out, HttpServer.hpp uses winsock2.h
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Pins the calling thread to one logical core; false where unsupported
+inline bool pinCurrentThread(int core) {
+    if (core < 0) return false;
+#ifdef _WIN32
+    if (core >= (int)(sizeof(DWORD_PTR) * 8)) return false;
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+// Fixed set of worker threads with one task deque each. submit() puts a
+// priority-0 task on the preferred worker's deque (round-robin when there
+// is none); a worker runs its own tasks first and, once out of work,
+// steals the oldest task of the other deques. Tasks with any other
+// priority go to one shared lane, highest first and FIFO among equals,
+// which every worker serves before its own deque (priority > 0) or only
+// when there is nothing left to steal (priority < 0). So priority orders
+// work across all workers, while default-priority work keeps its worker.
+// Tasks must not block on each other.
+class WorkStealingPool {
+public:
+    typedef std::function<void()> Task;
+
+    // workerCount <= 0: one per hardware thread. pinToCores pins worker i
+    // to core i (modulo the core count).
+    explicit WorkStealingPool(int workerCount, bool pinToCores = false)
+        : queued(0), nextWorker(0), stopping(false), executed(0), stolen(0) {
+        int cores = (int)std::thread::hardware_concurrency();
+        if (cores < 1) cores = 1;
+        if (workerCount <= 0) workerCount = cores;
+        for (int i = 0; i < workerCount; i++) {
+            queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+        }
+        for (int i = 0; i < workerCount; i++) {
+            threads.emplace_back(&WorkStealingPool::workerLoop, this, i, pinToCores ? i % cores : -1);
+        }
+    }
+
+    ~WorkStealingPool() {
+        shutdown();
+    }
+
+    // false once shutdown() has started; the task is then dropped
+    bool submit(Task task, int priority = 0, int preferredWorker = -1) {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            if (stopping) return false;
+            queued++;
+        }
+        int count = (int)queues.size();
+        int target = preferredWorker >= 0 ? preferredWorker % count : (int)(nextWorker++ % (unsigned)count);
+        {
+            WorkerQueue& q = priority != 0 ? shared : *queues[target];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            std::deque<Entry>::iterator pos = q.tasks.end();
+            while (pos != q.tasks.begin() && (pos - 1)->priority < priority) --pos;
+            Entry entry;
+            entry.priority = priority;
+            entry.task = std::move(task);
+            q.tasks.insert(pos, std::move(entry));
+        }
+        wake.notify_one();
+        return true;
+    }
+
+    // Runs what is queued, then joins the workers
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            if (stopping && threads.empty()) return;
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+        threads.clear();
+    }
+
+    int size() const { return (int)queues.size(); }
+    unsigned long long executedCount() const { return executed; }
+    unsigned long long stolenCount() const { return stolen; }
+
+private:
+    struct Entry {
+        int priority;
+        Task task;
+    };
+
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Entry> tasks;
+    };
+
+    // Front task of `q` if its priority is at least `minPriority`
+    static bool popFront(WorkerQueue& q, Task& task, int minPriority) {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty() || q.tasks.front().priority < minPriority) return false;
+        task = std::move(q.tasks.front().task);
+        q.tasks.pop_front();
+        return true;
+    }
+
+    // Takes the front task of the first other worker that has one
+    bool steal(int self, Task& task) {
+        int count = (int)queues.size();
+        for (int k = 1; k < count; k++) {
+            if (popFront(*queues[(self + k) % count], task, 0)) {
+                stolen++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Urgent shared work, own deque, stolen work, then deferred shared work
+    bool take(int self, Task& task) {
+        return popFront(shared, task, 1) || popFront(*queues[self], task, 0) || steal(self, task)
+            || popFront(shared, task, INT_MIN);
+    }
+
+    void workerLoop(int self, int core) {
+        if (core >= 0) pinCurrentThread(core);
+        Task task;
+        while (true) {
+            if (take(self, task)) {
+                {
+                    std::lock_guard<std::mutex> lock(sleepMutex);
+                    queued--;
+                }
+                task();
+                task = Task();
+                executed++;
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            if (queued > 0) continue;           // submitted but not yet in a deque, or raced a thief
+            if (stopping) return;
+            wake.wait(lock, [this]() { return queued > 0 || stopping; });
+        }
+    }
+
+    std::vector<std::unique_ptr<WorkerQueue> > queues;
+    WorkerQueue shared;                     // tasks with priority != 0, for every worker
+    std::vector<std::thread> threads;
+    std::mutex sleepMutex;                  // guards queued/stopping for sleeping workers
+    std::condition_variable wake;
+    size_t queued;                          // submitted and not yet taken
+    std::atomic<unsigned> nextWorker;
+    bool stopping;
+    std::atomic<unsigned long long> executed;
+    std::atomic<unsigned long long> stolen;
+};
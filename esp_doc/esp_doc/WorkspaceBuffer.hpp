@@ -0,0 +1,16 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+// Returns a size x type view into `backing`, growing the backing buffer only
+// when it is too small. OpenCV's create() is a no-op on a header that already
+// has the requested size and type, so functions write straight into the view.
+// Used for outputs whose size follows the detected quad.
+inline cv::Mat workspaceView(cv::Mat& backing, cv::Size size, int type) {
+    if (backing.type() != type || backing.rows < size.height || backing.cols < size.width) {
+        int rows = backing.type() == type && backing.rows > size.height ? backing.rows : size.height;
+        int cols = backing.type() == type && backing.cols > size.width ? backing.cols : size.width;
+        backing.create(rows, cols, type);
+    }
+    return backing(cv::Rect(0, 0, size.width, size.height));
+}
@@ -4,388 +4,61 @@
 #include <opencv2/imgcodecs.hpp>
 #include <iostream>
 #include <vector>
-#include <windows.h>
 #include <ctime>
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <csignal>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#ifdef _WIN32
 #include <direct.h>
-
-// BALANCED Configuration - Fast + Good Detection
-struct Config {
-    std::string comPort = "COM6";
-    std::string streamUrl = "http://192.168.1.103:8080/video";
-    std::string saveFolder = "C:/Users/kbakhtiyar/Documents/document_tester/";
-
-    // ADJUSTED detection parameters for lower resolution
-    int minArea = 1500;              // REDUCED for 480x360 (was 3000)
-    int maxArea = 300000;            // REDUCED for 480x360 (was 500000)
-    double epsilonFactor = 0.02;
-    int detectionTimeSeconds = 5;
-    int cannyLow = 20;               // LOWERED for better edge detection
-    int cannyHigh = 100;             // LOWERED for better edge detection
-
-    bool autoEnhance = true;
-    bool showPreview = false;        // Keep disabled for speed
-    int qualityThreshold = 60;       // LOWERED threshold (was 70)
-
-    // BALANCED camera settings
-    int frameWidth = 480;
-    int frameHeight = 360;
-    int fps = 30;                    // REDUCED from 60 for stability
-    int bufferSize = 1;              // Keep minimal for speed
-
-    // BALANCED processing
-    bool skipFrames = false;         // DISABLED - detect every frame
-    int processEveryNthFrame = 1;    // Process EVERY frame for detection
-    bool fastProcessing = false;     // DISABLED - use full processing
-    bool useColorDetection = true;   // ENABLED - better document detection
-};
-
-// Same fast serial port
-class SerialPort {
-private:
-    HANDLE hSerial;
-    std::string portName;
-    bool connected;
-
-public:
-    SerialPort() : hSerial(INVALID_HANDLE_VALUE), connected(false) {}
-
-    bool init(const std::string& comPort, DWORD baud = CBR_115200) {
-        portName = comPort;
-        return reconnect(baud);
-    }
-
-    bool reconnect(DWORD baud = CBR_115200) {
-        if (hSerial != INVALID_HANDLE_VALUE) {
-            CloseHandle(hSerial);
-        }
-
-        std::string full = "\\.\\" + portName;
-        hSerial = CreateFileA(full.c_str(), GENERIC_WRITE | GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-
-        if (hSerial == INVALID_HANDLE_VALUE) {
-            connected = false;
-            return false;
-        }
-
-        DCB dcb;
-        SecureZeroMemory(&dcb, sizeof(dcb));
-        dcb.DCBlength = sizeof(dcb);
-
-        if (!GetCommState(hSerial, &dcb)) {
-            CloseHandle(hSerial);
-            hSerial = INVALID_HANDLE_VALUE;
-            connected = false;
-            return false;
-        }
-
-        dcb.BaudRate = baud;
-        dcb.ByteSize = 8;
-        dcb.Parity = NOPARITY;
-        dcb.StopBits = ONESTOPBIT;
-        dcb.fDtrControl = DTR_CONTROL_ENABLE;
-        dcb.fRtsControl = RTS_CONTROL_ENABLE;
-
-        if (!SetCommState(hSerial, &dcb)) {
-            CloseHandle(hSerial);
-            hSerial = INVALID_HANDLE_VALUE;
-            connected = false;
-            return false;
-        }
-
-        COMMTIMEOUTS timeouts = { 0 };
-        timeouts.ReadIntervalTimeout = 10;
-        timeouts.ReadTotalTimeoutConstant = 10;
-        timeouts.WriteTotalTimeoutConstant = 10;
-        SetCommTimeouts(hSerial, &timeouts);
-
-        connected = true;
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
-        return true;
-    }
-
-    bool send(const std::string& msg) {
-        if (!connected && !reconnect()) return false;
-
-        DWORD bytesWritten = 0;
-        BOOL ok = WriteFile(hSerial, msg.c_str(), (DWORD)msg.size(), &bytesWritten, NULL);
-        FlushFileBuffers(hSerial);
-
-        if (!ok || bytesWritten != msg.size()) {
-            connected = false;
-            return false;
-        }
-        return true;
-    }
-
-    bool isConnected() const { return connected; }
-
-    ~SerialPort() {
-        if (hSerial != INVALID_HANDLE_VALUE) {
-            CloseHandle(hSerial);
-        }
-    }
-};
-
-struct QualityMetrics {
-    double sharpness;
-    double brightness;
-    double contrast;
-    int overallScore;
-    bool isGoodQuality;
-};
+#else
+#include <sys/stat.h>
+#endif
+
+#include "Config.hpp"
+#include "QualityMetrics.hpp"
+#include "BalancedDocumentDetector.hpp"
+#include "BalancedDocumentWarper.hpp"
+#include "DocumentTracker.hpp"
+#include "QosController.hpp"
+#include "ScanStateMachine.hpp"
+#include "DocumentWriter.hpp"
+#include "FramePipeline.hpp"
+#include "DetectionStage.hpp"
+#include "FrameSource.hpp"
+#include "FrameRecorder.hpp"
+#include "MjpegStreamSource.hpp"
+#include "AllocationCounter.hpp"
+#include "Metrics.hpp"
+#include "PreviewServer.hpp"
+#include "SerialNotifier.hpp"
+#include "StreamConfig.hpp"
+#include "WorkStealingPool.hpp"
+
+ESP_DOC_DEFINE_ALLOCATION_HOOKS
 
 void ensureDirectoryExists(const std::string& path) {
+#ifdef _WIN32
     _mkdir(path.c_str());
-}
-
-// BALANCED document detection - fast but accurate
-class BalancedDocumentDetector {
-private:
-    Config config;
-    cv::Mat kernel;
-
-public:
-    BalancedDocumentDetector(const Config& cfg) : config(cfg) {
-        kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
-    }
-
-    // BALANCED preprocessing - fast but thorough
-    cv::Mat balancedPreprocess(const cv::Mat& img) {
-        cv::Mat gray, enhanced, blurred, edges, morph;
-
-        // Convert to grayscale
-        cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
-
-        // RESTORED: CLAHE for better contrast (essential for detection)
-        cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(2.0, cv::Size(8, 8));
-        clahe->apply(gray, enhanced);
-
-        // RESTORED: Bilateral filter for noise reduction
-        cv::bilateralFilter(enhanced, blurred, 5, 50, 50); // Faster than original
-
-        // RESTORED: Multi-scale edge detection (critical for detection)
-        cv::Mat edges1, edges2;
-        cv::Canny(blurred, edges1, config.cannyLow, config.cannyHigh);
-        cv::Canny(blurred, edges2, config.cannyLow / 2, config.cannyHigh / 2);
-        cv::bitwise_or(edges1, edges2, edges);
-
-        // RESTORED: Enhanced morphological operations
-        cv::dilate(edges, morph, kernel, cv::Point(-1, -1), 2);
-        cv::erode(morph, morph, kernel, cv::Point(-1, -1), 1);
-        cv::morphologyEx(morph, morph, cv::MORPH_CLOSE, kernel);
-
-        return morph;
-    }
-
-    // RESTORED: Color-based paper detection (critical for documents)
-    cv::Mat detectPaper(const cv::Mat& img) {
-        cv::Mat hsv, mask, mask1, mask2;
-        cv::cvtColor(img, hsv, cv::COLOR_BGR2HSV);
-
-        // White paper range in HSV
-        cv::inRange(hsv, cv::Scalar(0, 0, 180), cv::Scalar(180, 30, 255), mask1);
-
-        // Light colored surfaces
-        cv::inRange(hsv, cv::Scalar(0, 0, 150), cv::Scalar(180, 50, 255), mask2);
-
-        cv::bitwise_or(mask1, mask2, mask);
-
-        // Morphological operations to clean up
-        cv::morphologyEx(mask, mask, cv::MORPH_OPEN, kernel);
-        cv::morphologyEx(mask, mask, cv::MORPH_CLOSE, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(15, 15)));
-
-        return mask;
-    }
-
-    std::vector<cv::Point> reorderPoints(const std::vector<cv::Point>& pts) {
-        if (pts.size() != 4) return pts;
-
-        std::vector<cv::Point> ordered(4);
-        std::vector<double> sums, diffs;
-
-        for (size_t i = 0; i < pts.size(); i++) {
-            sums.push_back(pts[i].x + pts[i].y);
-            diffs.push_back(pts[i].x - pts[i].y);
-        }
-
-        ordered[0] = pts[std::min_element(sums.begin(), sums.end()) - sums.begin()];
-        ordered[1] = pts[std::min_element(diffs.begin(), diffs.end()) - diffs.begin()];
-        ordered[2] = pts[std::max_element(diffs.begin(), diffs.end()) - diffs.begin()];
-        ordered[3] = pts[std::max_element(sums.begin(), sums.end()) - sums.begin()];
-
-        return ordered;
-    }
-
-    // IMPROVED: Better validation for smaller resolution
-    bool isValidDocument(const std::vector<cv::Point>& contour, const cv::Size& imgSize) {
-        double area = cv::contourArea(contour);
-        if (area < config.minArea || area > config.maxArea) return false;
-
-        std::vector<cv::Point> approx;
-        cv::approxPolyDP(contour, approx, config.epsilonFactor * cv::arcLength(contour, true), true);
-        if (approx.size() != 4) return false;
-
-        // Check aspect ratio (should be reasonable for documents)
-        cv::Rect bbox = cv::boundingRect(approx);
-        double aspectRatio = (double)bbox.width / bbox.height;
-        if (aspectRatio < 0.2 || aspectRatio > 5.0) return false; // More lenient
-
-        // ADJUSTED: Smaller margin for lower resolution
-        int margin = 10; // Reduced from 20
-        for (size_t i = 0; i < approx.size(); i++) {
-            if (approx[i].x < margin || approx[i].y < margin ||
-                approx[i].x > imgSize.width - margin || approx[i].y > imgSize.height - margin) {
-                return false;
-            }
-        }
-
-        // Check if contour is convex enough
-        if (!cv::isContourConvex(approx)) {
-            return false;
-        }
-
-        return true;
-    }
-
-    // RESTORED: Find best document with proper filtering
-    std::vector<cv::Point> findBestDocument(const cv::Mat& binary, const cv::Mat& original) {
-        std::vector<std::vector<cv::Point> > contours;
-        std::vector<cv::Vec4i> hierarchy;
-
-        cv::findContours(binary, contours, hierarchy, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
-
-        std::vector<std::pair<double, std::vector<cv::Point> > > candidates;
-
-        for (size_t i = 0; i < contours.size(); i++) {
-            if (isValidDocument(contours[i], original.size())) {
-                std::vector<cv::Point> approx;
-                cv::approxPolyDP(contours[i], approx, config.epsilonFactor * cv::arcLength(contours[i], true), true);
-                double area = cv::contourArea(approx);
-                candidates.push_back(std::make_pair(area, approx));
-            }
-        }
-
-        // Sort by area (largest first)
-        for (size_t i = 0; i < candidates.size(); i++) {
-            for (size_t j = i + 1; j < candidates.size(); j++) {
-                if (candidates[i].first < candidates[j].first) {
-                    std::swap(candidates[i], candidates[j]);
-                }
-            }
-        }
-
-        if (!candidates.empty()) {
-            return candidates[0].second;
-        }
-        return std::vector<cv::Point>();
-    }
-};
-
-// Document warper with good quality
-class BalancedDocumentWarper {
-public:
-    static cv::Mat warpDocument(const cv::Mat& img, const std::vector<cv::Point>& points, bool enhance = true) {
-        if (points.size() != 4) return cv::Mat();
-
-        Config config;
-        BalancedDocumentDetector detector(config);
-        std::vector<cv::Point> ordered = detector.reorderPoints(points);
-
-        double w1 = cv::norm(ordered[1] - ordered[0]);
-        double w2 = cv::norm(ordered[3] - ordered[2]);
-        double h1 = cv::norm(ordered[2] - ordered[0]);
-        double h2 = cv::norm(ordered[3] - ordered[1]);
-
-        int maxW = (w1 > w2) ? (int)w1 : (int)w2;
-        int maxH = (h1 > h2) ? (int)h1 : (int)h2;
-
-        if (maxW < 300) maxW = 300;
-        if (maxH < 300) maxH = 300;
-
-        cv::Point2f src[4] = { ordered[0], ordered[1], ordered[2], ordered[3] };
-        cv::Point2f dst[4] = {
-            cv::Point2f(0, 0), cv::Point2f((float)maxW, 0),
-            cv::Point2f(0, (float)maxH), cv::Point2f((float)maxW, (float)maxH)
-        };
-
-        cv::Mat transform = cv::getPerspectiveTransform(src, dst);
-        cv::Mat warped;
-        cv::warpPerspective(img, warped, transform, cv::Size(maxW, maxH), cv::INTER_CUBIC);
-
-        if (enhance) {
-            return enhanceDocument(warped);
-        }
-        return warped;
-    }
-
-private:
-    static cv::Mat enhanceDocument(const cv::Mat& img) {
-        cv::Mat enhanced, gray;
-
-        if (img.channels() == 3) {
-            cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
-        }
-        else {
-            gray = img.clone();
-        }
-
-        cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(3.0, cv::Size(8, 8));
-        clahe->apply(gray, enhanced);
-        cv::GaussianBlur(enhanced, enhanced, cv::Size(3, 3), 0.5);
-
-        if (img.channels() == 3) {
-            cv::cvtColor(enhanced, enhanced, cv::COLOR_GRAY2BGR);
-        }
-        return enhanced;
-    }
-};
-
-// RESTORED: Proper quality assessment
-QualityMetrics assessQuality(const cv::Mat& img) {
-    QualityMetrics metrics;
-    cv::Mat gray;
-
-    if (img.channels() == 3) {
-        cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
-    }
-    else {
-        gray = img.clone();
-    }
-
-    // Sharpness (Laplacian variance)
-    cv::Mat laplacian;
-    cv::Laplacian(gray, laplacian, CV_64F);
-    cv::Scalar mean, stddev;
-    cv::meanStdDev(laplacian, mean, stddev);
-    metrics.sharpness = stddev[0] * stddev[0];
-
-    // Brightness
-    cv::meanStdDev(gray, mean, stddev);
-    metrics.brightness = mean[0];
-
-    // Contrast
-    metrics.contrast = stddev[0];
-
-    // Overall score calculation
-    double sharpnessScore = (metrics.sharpness > 100.0) ? 100.0 : (metrics.sharpness / 100.0 * 100.0);
-    double brightnessScore = 100.0 - (metrics.brightness > 128.0 ? (metrics.brightness - 128.0) : (128.0 - metrics.brightness)) / 128.0 * 100.0;
-    double contrastScore = (metrics.contrast > 50.0) ? 100.0 : (metrics.contrast / 50.0 * 100.0);
-
-    metrics.overallScore = (int)((sharpnessScore * 0.4 + brightnessScore * 0.3 + contrastScore * 0.3));
-    metrics.isGoodQuality = metrics.overallScore >= 60; // Lowered threshold
-
-    return metrics;
+#else
+    mkdir(path.c_str(), 0755);
+#endif
 }
 
 std::string getTimestamp() {
     std::time_t now = std::time(0);
     std::tm tm;
+#ifdef _WIN32
     localtime_s(&tm, &now);
+#else
+    localtime_r(&now, &tm);
+#endif
     std::ostringstream oss;
     oss << std::put_time(&tm, "%Y-%m-%d_%H-%M-%S");
     return oss.str();
@@ -396,10 +69,15 @@ long long getCurrentTimeMillis() {
         std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+// Controls hint at the bottom of the overlay: windows, or the headless preview
+const char* const kKeyControls = "Press 'c' to capture manually, 'q' to quit";
+const char* const kRemoteControls = "POST /capture to capture, /quit to quit";
+
 // Enhanced UI with detection info
 void drawUI(cv::Mat& img, const std::vector<cv::Point>& document,
     long long detectionStartTime, bool saved, int requiredSeconds,
-    const QualityMetrics* quality, bool documentDetected = false, int fps = 0) {
+    const QualityMetrics* quality, bool documentDetected = false, int fps = 0, int latencyMs = -1,
+    const char* controls = kKeyControls) {
 
     // Draw document outline
     if (document.size() == 4) {
@@ -456,57 +134,737 @@ void drawUI(cv::Mat& img, const std::vector<cv::Point>& document,
     if (fps > 0) {
         std::ostringstream fpsOss;
         fpsOss << "FPS: " << fps;
+        if (latencyMs >= 0) fpsOss << "  Latency: " << latencyMs << " ms";
         cv::putText(img, fpsOss.str(), cv::Point(10, img.rows - 50), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(255, 255, 255), 1);
     }
 
     // Controls
-    cv::putText(img, "Press 'c' to capture manually, 'q' to quit",
+    cv::putText(img, controls,
         cv::Point(10, img.rows - 20), cv::FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255, 255, 255), 1);
 }
 
+// Multi-document mode: outline and countdown for every page in view
+void drawPageLabels(cv::Mat& img, const std::vector<ScanTrack>& pages, long long now, int requiredSeconds) {
+    for (size_t i = 0; i < pages.size(); i++) {
+        const ScanTrack& page = pages[i];
+        if (page.quad.size() != 4) continue;
+        cv::Scalar color = page.saved ? cv::Scalar(0, 255, 0) : cv::Scalar(0, 255, 255);
+        cv::polylines(img, page.quad, true, color, 2);
+
+        cv::Point center(0, 0);
+        for (size_t k = 0; k < page.quad.size(); k++) center += page.quad[k];
+        center.x /= 4;
+        center.y /= 4;
+
+        std::ostringstream label;
+        label << "#" << page.id << " ";
+        if (page.saved) {
+            label << "saved";
+        }
+        else {
+            long long remaining = requiredSeconds - (now - page.detectedAt) / 1000;
+            label << (remaining < 0 ? 0 : remaining) << "s";
+        }
+        cv::putText(img, label.str(), center + cv::Point(8, -8), cv::FONT_HERSHEY_SIMPLEX, 0.5, color, 2);
+    }
+}
+
+
+// Pipeline buffers: 1 being captured, 1 in the mailbox, 1 in detection,
+// up to 4 waiting for display and 1 on screen
+const size_t kFrameSlots = 8;
+const size_t kDisplayQueueSize = 4;
+
+// Page timers of one stream: turns detection results into serial events
+// and saves, and reports the saves back. Serial ids are only sent in
+// multi-document mode, so the single-page protocol stays unchanged.
+class SaveScheduler {
+public:
+    SaveScheduler(const Config& cfg, SerialNotifier& notifier, AsyncDocumentWriter& out, int streamIndex = 0,
+        const std::string& name = "")
+        : config(cfg), serial(notifier), writer(out), stream(streamIndex), label(name.empty() ? "" : "[" + name + "] "),
+          scanState(cfg), docCount(0) {}
+
+    // Time-based detection logic for one displayed result
+    void update(const FrameSlot& current, long long now) {
+        // Only good-quality pages count
+        validDocuments.clear();
+        validScores.clear();
+        for (size_t i = 0; i < current.documents.size(); i++) {
+            if (current.qualities[i].isGoodQuality) {
+                validDocuments.push_back(current.documents[i]);
+                validScores.push_back(current.qualities[i].overallScore);
+            }
+        }
+
+        scanEvents.clear();
+        scanState.update(now, validDocuments, validScores, !current.skipped, scanEvents);
+
+        // Auto-save logic: hand due pages to the writer, then cool down without blocking
+        duePages.clear();
+        dueIds.clear();
+        for (size_t i = 0; i < scanEvents.size(); i++) {
+            const ScanEvent& ev = scanEvents[i];
+            const ScanTrack* page = scanState.find(ev.id);
+            int serialId = config.multiDocument ? ev.id : 0;
+            if (ev.type == ScanEventType::Detected) {
+                std::cout << label << "?? Document detected! Area: " << (int)cv::contourArea(page->quad) << " Quality: " << page->qualityScore << "%";
+                if (config.multiDocument) std::cout << " (page " << ev.id << ")";
+                std::cout << std::endl;
+                serial.post(NotifierEvent::DocDetected, serialId);
+            }
+            else if (ev.type == ScanEventType::Lost) {
+                std::cout << label << "? Detection lost!";
+                if (config.multiDocument) std::cout << " (page " << ev.id << ")";
+                std::cout << std::endl;
+                serial.post(NotifierEvent::DocLost, serialId);
+            }
+            else {
+                SavePage due;
+                due.document = page->quad;
+                due.filename = nextFilename("doc_", (int)duePages.size());
+                due.qualityScore = page->qualityScore;
+                due.docId = serialId;
+                due.stream = stream;
+                duePages.push_back(due);
+                dueIds.push_back(ev.id);
+            }
+        }
+        if (!duePages.empty() && writer.submitAll(current.frame, duePages, config.autoEnhance, current.original)) {
+            for (size_t i = 0; i < scanEvents.size(); i++) {
+                const ScanEvent& ev = scanEvents[i];
+                if (ev.type != ScanEventType::SaveDue || !ev.early) continue;
+                std::ostringstream jitterOss;
+                jitterOss << std::fixed << std::setprecision(1) << scanState.find(ev.id)->stability.jitter();
+                std::cout << label << "?? Page stable after " << ev.elapsedMs << " ms (jitter " << jitterOss.str()
+                    << " px), saving early" << std::endl;
+            }
+            for (size_t i = 0; i < dueIds.size(); i++) scanState.markSaved(dueIds[i], now);
+            docCount += (int)duePages.size();
+        }
+        // else: writer is saturated, the pages stay due and are retried with the next frame
+    }
+
+    // Manual capture: every page in the frame on screen, whatever its quality
+    void captureAll(const FrameSlot& shown) {
+        if (shown.documents.empty()) return;
+        duePages.clear();
+        for (size_t i = 0; i < shown.documents.size(); i++) {
+            SavePage page;
+            page.document = shown.documents[i];
+            page.filename = nextFilename("manual_", (int)i);
+            page.qualityScore = shown.qualities[i].overallScore;
+            page.docId = 0;
+            page.stream = stream;
+            duePages.push_back(page);
+        }
+        if (writer.submitAll(shown.frame, duePages, config.autoEnhance, shown.original)) {
+            docCount += (int)duePages.size();
+        }
+        else {
+            std::cout << label << "?? Save queue full, manual capture skipped" << std::endl;
+        }
+    }
+
+    void saved(const SaveResult& r) {
+        if (r.ok) {
+            ESP_DOC_COUNT(SavesOk);
+            std::cout << label << "? Document saved: " << r.filename << " (" << (int)r.elapsedMs << " ms, "
+                << (r.bytes + 512) / 1024 << " KB, encode " << (int)r.encodeMs << " ms)" << std::endl;
+            std::cout << label << "?? Final quality: " << r.qualityScore << "%" << std::endl;
+            serial.post(NotifierEvent::DocSaved, r.docId);
+        }
+        else {
+            ESP_DOC_COUNT(SavesFailed);
+            std::cerr << label << "Failed to save " << r.filename << std::endl;
+        }
+    }
+
+    const ScanStateMachine& state() const { return scanState; }
+    int documents() const { return docCount; }
+
+private:
+    std::string nextFilename(const char* prefix, int offset) const {
+        std::ostringstream filenameOss;
+        filenameOss << config.saveFolder << prefix << getTimestamp() << "_" << (docCount + 1 + offset) << writer.fileExtension();
+        return filenameOss.str();
+    }
+
+    Config config;
+    SerialNotifier& serial;
+    AsyncDocumentWriter& writer;
+    int stream;
+    std::string label;
+    ScanStateMachine scanState;
+    std::vector<ScanEvent> scanEvents;
+    std::vector<std::vector<cv::Point> > validDocuments;
+    std::vector<int> validScores;
+    std::vector<SavePage> duePages;
+    std::vector<int> dueIds;
+    int docCount;
+};
+
+// Outline, page labels and status overlay for one result
+void drawScanOverlay(cv::Mat& img, const std::vector<cv::Point>& document, const QualityMetrics* quality,
+    const std::vector<ScanTrack>& pages, const Config& config, long long now, int fps, int latencyMs,
+    const char* controls) {
+    if (config.multiDocument) drawPageLabels(img, pages, now, config.detectionTimeSeconds);
+    drawUI(img, document, pages.empty() ? 0 : pages[0].detectedAt, !pages.empty() && pages[0].saved,
+        config.detectionTimeSeconds, quality, !pages.empty(), fps, latencyMs, controls);
+}
+
+// Overlay of one displayed result, drawn into its frame
+void drawScanState(FrameSlot& current, const ScanStateMachine& scanState, const Config& config, long long now,
+    int fps, int latencyMs) {
+    drawScanOverlay(current.frame, current.document, current.hasQuality ? &current.quality : NULL, scanState.pages(),
+        config, now, fps, latencyMs, kKeyControls);
+}
+
+// What drawScanState() draws, copied so the preview thread can draw it later
+struct ScanOverlay {
+    std::vector<cv::Point> document;
+    QualityMetrics quality;
+    bool hasQuality;
+    std::vector<ScanTrack> pages;
+    long long now;
+    int fps;
+    int latencyMs;
+
+    ScanOverlay(const FrameSlot& current, const ScanStateMachine& scanState, long long time, int currentFps, int latency)
+        : document(current.document), quality(current.quality), hasQuality(current.hasQuality), pages(scanState.pages()),
+          now(time), fps(currentFps), latencyMs(latency) {}
+
+    void draw(cv::Mat& img, const Config& config) const {
+        drawScanOverlay(img, document, hasQuality ? &quality : NULL, pages, config, now, fps, latencyMs, kRemoteControls);
+    }
+};
+
+// Headless display stage: hands the frame to the preview when a client
+// wants one; the overlay is drawn on the preview thread
+void publishPreview(PreviewServer& preview, int feed, const FrameSlot& current, const ScanStateMachine& scanState,
+    const Config& config, long long now, int fps, int latencyMs) {
+    if (!preview.wantsFrame(feed)) return;
+    ScanOverlay overlay(current, scanState, now, fps, latencyMs);
+    preview.publish(feed, current.frame, [overlay, &config](cv::Mat& canvas) { overlay.draw(canvas, config); });
+}
+
+// Ctrl+C / SIGTERM in headless mode: shut down the way 'q' does
+volatile std::sig_atomic_t stopSignal = 0;
+
+void onStopSignal(int) {
+    stopSignal = 1;
+}
+
+// Serves the preview and controls (feeds must be added already) and
+// routes Ctrl+C to a clean shutdown
+void startHeadless(PreviewServer& preview, const Config& config) {
+    std::signal(SIGINT, onStopSignal);
+    std::signal(SIGTERM, onStopSignal);
+    if (config.previewPort <= 0) {
+        std::cout << "Headless: no preview, stop with Ctrl+C" << std::endl;
+    }
+    else if (preview.start(config.previewPort, config.previewMaxFps, config.previewJpegQuality)) {
+        std::cout << "Headless: preview and controls on http://127.0.0.1:" << config.previewPort << "/" << std::endl;
+    }
+    else {
+        std::cerr << "Could not serve the preview on 127.0.0.1:" << config.previewPort << ", stop with Ctrl+C" << std::endl;
+    }
+}
+
+// Headless stand-in for cv::waitKey(1): the remote controls and Ctrl+C as keys
+int pollHeadlessKey(PreviewServer& preview) {
+    if (stopSignal || preview.quitRequested()) return 'q';
+    if (preview.takeCaptureRequest()) return 'c';
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return -1;
+}
+
+// One camera in multi-stream mode. Capture runs on the station's own
+// thread; detection runs on the shared pool, at most one job per station
+// at a time and always on the newest frame, so a fast stream cannot crowd
+// out the others. Frames move between capture, the pending slot,
+// detection, the result slot and the display by swapping, so no two
+// threads ever touch the same buffer.
+struct Station {
+    Config config;                      // streamUrl, comPort and saveFolder of this camera
+    StreamSettings settings;
+    int index;
+    MjpegStreamSource mjpegSource;
+    VideoCaptureSource captureSource;
+    RecordingSource replaySource;
+    FrameSource* source;
+#ifndef _WIN32
+    PtyNotifierDevice ptyDevice;
+#endif
+    std::unique_ptr<SerialNotifier> serial;
+    std::unique_ptr<DetectionStage> detection;
+    std::unique_ptr<SaveScheduler> scheduler;
+    std::thread captureThread;
+
+    std::mutex mutex;
+    FrameSlot pending;                  // newest capture (mutex)
+    FrameSlot result;                   // newest detection result (mutex)
+    bool hasPending, hasResult, inFlight;
+    FrameSlot working;                  // the running detection job's frame
+    FrameSlot shown;                    // display loop only
+    bool hasShown;
+
+    std::atomic<unsigned long long> captured;
+    std::atomic<unsigned long long> dropped;
+    int fpsCounter, currentFps;
+    std::chrono::steady_clock::time_point lastFpsTime;
+
+    Station()
+        : index(0), source(NULL), hasPending(false), hasResult(false), inFlight(false), hasShown(false),
+          captured(0), dropped(0), fpsCounter(0), currentFps(0), lastFpsTime(std::chrono::steady_clock::now()) {}
+};
+
+// Detects the station's newest frame; resubmits itself while new frames
+// keep arriving, so the station holds one place in the pool at most
+void runStationDetection(Station& st, WorkStealingPool& pool) {
+    {
+        std::lock_guard<std::mutex> lock(st.mutex);
+        std::swap(st.working, st.pending);
+        st.hasPending = false;
+    }
+
+    st.detection->process(st.working);
+
+    bool again;
+    {
+        std::lock_guard<std::mutex> lock(st.mutex);
+        std::swap(st.working, st.result);
+        if (st.hasResult) {
+            st.dropped++;
+            ESP_DOC_COUNT(ResultsDropped);
+        }
+        st.hasResult = true;
+        again = st.inFlight = st.hasPending;
+    }
+    if (again && !pool.submit([&st, &pool]() { runStationDetection(st, pool); }, st.settings.priority, st.index)) {
+        std::lock_guard<std::mutex> lock(st.mutex);
+        st.inFlight = false;
+    }
+}
+
+// Scans every camera listed in config.streamsFile in this one process
+int runMultiStream(const Config& config, const EncoderSettings& encoding) {
+    std::vector<StreamSettings> streams;
+    std::string error;
+    if (!loadStreamSettings(config.streamsFile, config, streams, error)) {
+        std::cerr << "Stream list: " << error << std::endl;
+        return -1;
+    }
+    if (config.pdfSession) std::cout << "PDF sessions are single-stream only; saving separate files" << std::endl;
+    if (!config.recordPath.empty()) std::cout << "Recording is single-stream only; not recording" << std::endl;
+
+    metrics::MetricsReporter metricsReporter;
+    metricsReporter.start(config.metricsDumpPath, config.metricsDumpIntervalMs, config.metricsHttpPort);
+
+    std::vector<std::unique_ptr<Station> > stations;
+    for (size_t i = 0; i < streams.size(); i++) {
+        std::unique_ptr<Station> st(new Station());
+        st->settings = streams[i];
+        st->index = (int)stations.size();
+        st->config = config;
+        st->config.streamUrl = streams[i].url;
+        st->config.comPort = streams[i].comPort;
+        st->config.saveFolder = streams[i].saveFolder;
+        ensureDirectoryExists(st->config.saveFolder);
+
+        const std::string& name = st->settings.name;
+        cv::Size captureSize(config.frameWidth, config.frameHeight);
+        std::string replayPath;
+        st->source = &st->mjpegSource;
+        if (parseReplayUrl(st->config.streamUrl, replayPath)) {
+            if (!st->replaySource.open(replayPath, true, error)) {
+                std::cerr << "[" << name << "] " << error << ", skipping this stream" << std::endl;
+                continue;
+            }
+            st->source = &st->replaySource;
+        }
+        else if (!config.nativeMjpeg || !st->mjpegSource.open(st->config.streamUrl, captureSize)) {
+            if (!st->captureSource.open(st->config.streamUrl, config.frameWidth, config.frameHeight, config.fps, config.bufferSize)) {
+                std::cerr << "[" << name << "] No camera available, skipping this stream" << std::endl;
+                continue;
+            }
+            st->source = &st->captureSource;
+        }
+
+        std::string serialDevice = st->config.comPort;
+#ifndef _WIN32
+        if (serialDevice == "pty") {
+            serialDevice = st->ptyDevice.start() ? st->ptyDevice.devicePath() : "";
+        }
+#endif
+        st->serial.reset(new SerialNotifier(serialDevice));
+        st->detection.reset(new DetectionStage(st->config, name));
+        std::cout << "[" << name << "] " << st->source->describe() << ", priority " << st->settings.priority
+            << ", saving to " << st->config.saveFolder
+            << (serialDevice.empty() ? ", no ESP32" : ", notifying on " + serialDevice) << std::endl;
+        stations.push_back(std::move(st));
+    }
+    if (stations.empty()) {
+        std::cerr << "No camera available!" << std::endl;
+        return -1;
+    }
+
+    AsyncDocumentWriter writer(config.saveWorkers, (size_t)config.saveQueueCapacity, config.warpCacheEpsilon, encoding);
+    for (size_t i = 0; i < stations.size(); i++) {
+        Station& st = *stations[i];
+        st.scheduler.reset(new SaveScheduler(st.config, *st.serial, writer, st.index, st.settings.name));
+    }
+
+    WorkStealingPool pool(config.detectionWorkers, config.pinWorkers);
+    std::cout << "?? Detection pool: " << pool.size() << " worker(s)" << (config.pinWorkers ? ", pinned to cores" : "")
+        << " for " << stations.size() << " stream(s)" << std::endl;
+
+    PreviewServer preview;
+    if (config.headless) {
+        for (size_t i = 0; i < stations.size(); i++) preview.addFeed(stations[i]->settings.name);
+        startHeadless(preview, config);
+    }
+
+    std::atomic<bool> running(true);
+    auto start = std::chrono::steady_clock::now();
+
+    // Capture stages: publish the newest frame, start detection if the station is idle
+    for (size_t i = 0; i < stations.size(); i++) {
+        Station& st = *stations[i];
+        st.captureThread = std::thread([&st, &pool, &running]() {
+            FrameSlot incoming;
+            unsigned long long sequence = 0;
+            while (running) {
+                bool ok;
+                {
+                    ESP_DOC_TIME_STAGE(Decode);
+                    ok = st.source->read(incoming.frame);
+                }
+                if (!ok) {
+                    if (st.source->finished()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    continue;
+                }
+                ESP_DOC_COUNT(FramesCaptured);
+                st.captured++;
+                incoming.captureTime = getCurrentTimeMillis();
+                incoming.sequence = ++sequence;
+                cv::flip(incoming.frame, incoming.frame, 1);
+                incoming.original = st.source->original();
+                incoming.original.mirrored = true;
+
+                bool idle;
+                {
+                    std::lock_guard<std::mutex> lock(st.mutex);
+                    if (st.hasPending) {
+                        st.dropped++;
+                        ESP_DOC_COUNT(FramesDropped);
+                    }
+                    std::swap(incoming, st.pending);
+                    st.hasPending = true;
+                    idle = !st.inFlight;
+                    if (idle) st.inFlight = true;
+                }
+                if (idle && !pool.submit([&st, &pool]() { runStationDetection(st, pool); }, st.settings.priority, st.index)) {
+                    std::lock_guard<std::mutex> lock(st.mutex);
+                    st.inFlight = false;
+                }
+            }
+        });
+    }
+
+    std::vector<SaveResult> finishedSaves;
+    auto reportSaves = [&]() {
+        writer.pollCompleted(finishedSaves);
+        for (size_t i = 0; i < finishedSaves.size(); i++) {
+            stations[finishedSaves[i].stream]->scheduler->saved(finishedSaves[i]);
+        }
+        finishedSaves.clear();
+    };
+
+    std::cout << "?? Starting multi-stream capture..." << std::endl;
+
+    // Display stage (HighGUI must stay on the main thread): one window per
+    // stream, or one preview feed per stream when headless
+    while (true) {
+        for (size_t i = 0; i < stations.size(); i++) {
+            Station& st = *stations[i];
+            bool fresh;
+            {
+                std::lock_guard<std::mutex> lock(st.mutex);
+                fresh = st.hasResult;
+                if (fresh) {
+                    std::swap(st.shown, st.result);
+                    st.hasResult = false;
+                }
+            }
+            if (!fresh) continue;
+            st.hasShown = true;
+
+            st.fpsCounter++;
+            auto currentTime = std::chrono::steady_clock::now();
+            if (currentTime - st.lastFpsTime >= std::chrono::seconds(1)) {
+                st.currentFps = st.fpsCounter;
+                st.fpsCounter = 0;
+                st.lastFpsTime = currentTime;
+            }
+
+            long long now = getCurrentTimeMillis();
+            st.scheduler->update(st.shown, now);
+            int latencyMs = (int)(getCurrentTimeMillis() - st.shown.captureTime);
+
+            ESP_DOC_TIME_STAGE(Display);
+            if (config.headless) {
+                publishPreview(preview, st.index, st.shown, st.scheduler->state(), st.config, now, st.currentFps, latencyMs);
+                continue;
+            }
+            drawScanState(st.shown, st.scheduler->state(), st.config, now, st.currentFps, latencyMs);
+            cv::imshow("esp_doc: " + st.settings.name, st.shown.frame);
+        }
+
+        int key = config.headless ? pollHeadlessKey(preview) : cv::waitKey(1) & 0xFF;
+        if (key == 'q' || key == 27) {
+            break;
+        }
+        else if (key == 'c') {
+            for (size_t i = 0; i < stations.size(); i++) {
+                if (stations[i]->hasShown) stations[i]->scheduler->captureAll(stations[i]->shown);
+            }
+        }
+
+        reportSaves();
+    }
+
+    std::cout << "\n?? Shutting down..." << std::endl;
+    preview.stop();
+    running = false;
+    for (size_t i = 0; i < stations.size(); i++) stations[i]->captureThread.join();
+    pool.shutdown();
+    writer.shutdown();
+    reportSaves();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int totalDocuments = 0;
+    int totalDetected = 0;
+    for (size_t i = 0; i < stations.size(); i++) {
+        Station& st = *stations[i];
+        st.serial->post(NotifierEvent::ScannerOff);
+        st.serial->stop();
+        st.mjpegSource.close();
+        st.captureSource.release();
+        st.replaySource.close();
+
+        int detected = st.detection->processed();
+        totalDetected += detected;
+        totalDocuments += st.scheduler->documents();
+        std::cout << "[" << st.settings.name << "] Captured " << st.captured << ", detected " << detected
+            << " (" << (int)(detected / seconds) << " fps), dropped " << st.dropped
+            << ", documents " << st.scheduler->documents() << std::endl;
+    }
+    metricsReporter.stop();
+    if (!config.headless) cv::destroyAllWindows();
+
+    std::cout << "?? Total documents: " << totalDocuments << std::endl;
+    std::cout << "?? Detection: " << (int)(totalDetected / seconds) << " frames/s over " << stations.size() << " stream(s), "
+        << pool.executedCount() << " jobs, " << pool.stolenCount() << " stolen" << std::endl;
+    return 0;
+}
+
 int main() {
     Config config;
+    alloccount::install();
 
     std::cout << "=== BALANCED Document Scanner (Fast + Good Detection) ===" << std::endl;
     std::cout << "Resolution: " << config.frameWidth << "x" << config.frameHeight << std::endl;
     std::cout << "Min Area: " << config.minArea << " (adjusted for resolution)" << std::endl;
+    std::cout << "Detection level: " << config.detectionPyramidLevel << " (1/" << (1 << config.detectionPyramidLevel) << " scale)" << std::endl;
+    DetectorEngineKind engine;
+    if (parseDetectorEngine(config.detectorEngine, engine)) {
+        std::cout << "Detector engine: " << config.detectorEngine << std::endl;
+    }
+    else {
+        std::cerr << "Unknown detectorEngine \"" << config.detectorEngine << "\", using contour" << std::endl;
+    }
     std::cout << "Quality Threshold: " << config.qualityThreshold << "%" << std::endl;
+    EncoderSettings encoding = EncoderSettings::fromConfig(config);
+    if (config.pdfSession) {
+        encoding.format = OutputFormat::Jpeg;       // embedded in the PDF as is
+    }
+    else if (!parseOutputFormat(config.outputFormat, encoding.format)) {
+        std::cerr << "Unknown outputFormat \"" << config.outputFormat << "\", saving JPEG" << std::endl;
+    }
+    std::cout << "Output: " << encoding.describe() << (config.pdfSession ? " pages in one session PDF" : "") << std::endl;
+    std::cout << "Multi-document: " << (config.multiDocument ? "ON" : "OFF") << " (up to " << config.maxDocuments << " pages)" << std::endl;
+    std::cout << "Adaptive QoS: " << (config.adaptiveQos ? "ON" : "OFF") << " (budget " << config.qosBudgetMs << " ms/frame)" << std::endl;
 
     ensureDirectoryExists(config.saveFolder);
+    if (!config.streamsFile.empty()) {
+        return runMultiStream(config, encoding);
+    }
 
-    SerialPort serial;
-    bool serialOk = serial.init(config.comPort);
-    std::cout << "Serial: " << (serialOk ? "? Connected" : "? Failed") << std::endl;
+    PdfSessionWriter pdfSession;
+    if (config.pdfSession) {
+        const std::string marker = config.saveFolder + "pdf_session.open";
+        std::string interrupted;
+        int recovered = PdfSessionWriter::recoverFromMarker(marker, interrupted);
+        if (recovered > 0) {
+            std::cout << "?? Recovered interrupted session " << interrupted << " (" << recovered << " pages)" << std::endl;
+        }
+        else if (recovered < 0 && !interrupted.empty()) {
+            std::cerr << "Could not recover interrupted session " << interrupted << std::endl;
+        }
 
-    // Camera setup with speed optimizations but stable settings
-    cv::VideoCapture cap;
+        std::string pdfPath = config.saveFolder + "session_" + getTimestamp() + ".pdf";
+        if (pdfSession.open(pdfPath, config.pdfDpi, marker)) {
+            std::cout << "PDF session: " << pdfPath << std::endl;
+        }
+        else {
+            std::cerr << "Could not create " << pdfPath << ", saving separate JPEG files" << std::endl;
+        }
+    }
 
-    cap.open(config.streamUrl, cv::CAP_FFMPEG);
-    if (!cap.isOpened()) {
-        std::cout << "IP camera failed, trying webcam..." << std::endl;
-        cap.open(0, cv::CAP_DSHOW);
-        if (!cap.isOpened()) {
+    std::string serialDevice = config.comPort;
+#ifndef _WIN32
+    PtyNotifierDevice ptyDevice;
+    if (config.comPort == "pty") {
+        if (ptyDevice.start()) {
+            serialDevice = ptyDevice.devicePath();
+        }
+        else {
+            std::cerr << "Could not open a pseudo-terminal for the ESP32 stand-in" << std::endl;
+        }
+    }
+#endif
+
+    // Connects (and reconnects) in the background; never blocks the frame loop
+    SerialNotifier serial(serialDevice);
+
+    metrics::MetricsReporter metricsReporter;
+    metricsReporter.start(config.metricsDumpPath, config.metricsDumpIntervalMs, config.metricsHttpPort);
+    std::cout << "Serial: notifying on " << serialDevice << std::endl;
+
+    // Camera setup: phone MJPEG streams ignore the requested size, so the
+    // built-in client decodes them scaled; everything else goes through
+    // VideoCapture with speed optimizations but stable settings
+    MjpegStreamSource mjpegSource;
+    VideoCaptureSource captureSource;
+    RecordingSource replaySource;
+    std::string replayPath;
+    FrameSource* source = &mjpegSource;
+    if (parseReplayUrl(config.streamUrl, replayPath)) {
+        std::string error;
+        if (!replaySource.open(replayPath, true, error)) {
+            std::cerr << error << std::endl;
+            return -1;
+        }
+        source = &replaySource;
+    }
+    else if (!config.nativeMjpeg || !mjpegSource.open(config.streamUrl, cv::Size(config.frameWidth, config.frameHeight))) {
+        if (!captureSource.open(config.streamUrl, config.frameWidth, config.frameHeight, config.fps, config.bufferSize)) {
             std::cerr << "No camera available!" << std::endl;
             return -1;
         }
+        source = &captureSource;
     }
 
-    // BALANCED camera settings
-    cap.set(cv::CAP_PROP_FRAME_WIDTH, config.frameWidth);
-    cap.set(cv::CAP_PROP_FRAME_HEIGHT, config.frameHeight);
-    cap.set(cv::CAP_PROP_FPS, config.fps);
-    cap.set(cv::CAP_PROP_BUFFERSIZE, config.bufferSize);
+    std::cout << "?? Camera configured for balanced performance! Source: " << source->describe() << std::endl;
 
-    std::cout << "?? Camera configured for balanced performance!" << std::endl;
+    FrameRecorder recorder;
+    bool recording = false;
+    if (!config.recordPath.empty()) {
+        recording = recorder.open(config.recordPath);
+        if (recording) std::cout << "?? Recording frames to " << config.recordPath << std::endl;
+        else std::cerr << "Could not create " << config.recordPath << ", not recording" << std::endl;
+    }
 
-    BalancedDocumentDetector detector(config);
+    SlotPool<FrameSlot, kFrameSlots> framePool;
+    LatestSlot latestFrame;                                 // capture -> detection
+    SpscQueue<int, kDisplayQueueSize> detectedFrames;       // detection -> display
+    std::atomic<bool> running(true);
+    std::atomic<unsigned long long> droppedFrames(0);
+    std::atomic<unsigned long long> droppedResults(0);
+
+    // Capture stage: always decode the newest frame, never wait on detection
+    std::thread captureThread([&]() {
+        unsigned long long sequence = 0;
+        while (running) {
+            int slot = framePool.acquire();
+            if (slot < 0) {
+                // Every buffer is busy downstream: drain the stream without decoding
+                source->grab();
+                droppedFrames++;
+                ESP_DOC_COUNT(FramesDropped);
+                continue;
+            }
 
-    cv::Mat frame, processed, paperMask, combined;
-    long long detectionStartTime = 0;
-    bool documentDetected = false;
-    bool saved = false;
-    std::vector<cv::Point> lastBestDocument;
-    int docCount = 0;
+            FrameSlot& s = framePool[slot];
+            bool ok;
+            {
+                ESP_DOC_TIME_STAGE(Decode);
+                ok = source->read(s.frame);
+            }
+            if (!ok) {
+                framePool.release(slot);
+                if (source->finished()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            ESP_DOC_COUNT(FramesCaptured);
+            s.captureTime = getCurrentTimeMillis();
+            s.sequence = ++sequence;
+            if (recording) recorder.record(s.frame, s.captureTime, source->original(), source->compressedFrame());
+            cv::flip(s.frame, s.frame, 1);
+            s.original = source->original();
+            s.original.mirrored = true;
+
+            int stale = latestFrame.publish(slot);
+            if (stale >= 0) {
+                framePool.release(stale);
+                droppedFrames++;
+                ESP_DOC_COUNT(FramesDropped);
+            }
+        }
+    });
+
+    // Detection stage: always works on the newest captured frame
+    std::thread detectionThread([&]() {
+        DetectionStage detection(config);
+        while (running) {
+            int slot = latestFrame.take();
+            if (slot < 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+
+            detection.process(framePool[slot]);
+            if (!detectedFrames.push(slot)) {
+                framePool.release(slot);
+                droppedResults++;
+                ESP_DOC_COUNT(ResultsDropped);
+            }
+        }
+    });
+
+    AsyncDocumentWriter writer(config.saveWorkers, (size_t)config.saveQueueCapacity, config.warpCacheEpsilon, encoding);
+    if (pdfSession.isOpen()) writer.setPdfSession(&pdfSession);
+    std::vector<SaveResult> finishedSaves;
+    SaveScheduler scheduler(config, serial, writer);
+
+    auto reportSaves = [&]() {
+        writer.pollCompleted(finishedSaves);
+        for (size_t i = 0; i < finishedSaves.size(); i++) {
+            scheduler.saved(finishedSaves[i]);
+        }
+        finishedSaves.clear();
+        ESP_DOC_COUNT_SET(SerialFailures, serial.failureCount());
+        ESP_DOC_COUNT_SET(SerialDropped, serial.droppedCount());
+    };
+
+    PreviewServer preview;
+    if (config.headless) {
+        preview.addFeed("scanner");
+        startHeadless(preview, config);
+    }
+
+    int displayedSlot = -1;
 
     // FPS calculation
     auto lastFpsTime = std::chrono::steady_clock::now();
@@ -515,126 +873,100 @@ int main() {
 
     std::cout << "?? Starting balanced capture..." << std::endl;
 
+    // Display stage (HighGUI must stay on the main thread; headless, the
+    // preview thread draws)
     while (true) {
-        cap >> frame;
-        if (frame.empty()) continue;
-
-        fpsCounter++;
-
-        // Calculate FPS
-        auto currentTime = std::chrono::steady_clock::now();
-        auto timeDiff = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastFpsTime);
-        if (timeDiff.count() >= 1000) {
-            currentFps = fpsCounter;
-            fpsCounter = 0;
-            lastFpsTime = currentTime;
+        // Only the newest detection result is shown; older ones are stale
+        int slot = -1;
+        int next;
+        while (detectedFrames.pop(next)) {
+            if (slot >= 0) {
+                framePool.release(slot);
+                droppedResults++;
+                ESP_DOC_COUNT(ResultsDropped);
+            }
+            slot = next;
         }
 
-        cv::flip(frame, frame, 1);
+        if (slot >= 0) {
+            framePool.release(displayedSlot);
+            displayedSlot = slot;
 
-        // FULL processing every frame for good detection
-        processed = detector.balancedPreprocess(frame);
+            FrameSlot& current = framePool[slot];
 
-        // RESTORED: Color-based paper detection
-        if (config.useColorDetection) {
-            paperMask = detector.detectPaper(frame);
-            cv::bitwise_and(processed, paperMask, combined);
-        }
-        else {
-            combined = processed;
-        }
-
-        // Find document
-        std::vector<cv::Point> document = detector.findBestDocument(combined, frame);
-
-        QualityMetrics quality;
-        bool hasGoodDocument = false;
+            fpsCounter++;
 
-        if (document.size() == 4) {
-            cv::Mat warped = BalancedDocumentWarper::warpDocument(frame, document, false);
-            if (!warped.empty()) {
-                quality = assessQuality(warped);
-                hasGoodDocument = quality.isGoodQuality;
+            // Calculate FPS
+            auto currentTime = std::chrono::steady_clock::now();
+            auto timeDiff = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastFpsTime);
+            if (timeDiff.count() >= 1000) {
+                currentFps = fpsCounter;
+                fpsCounter = 0;
+                lastFpsTime = currentTime;
             }
-        }
 
-        // Time-based detection logic
-        bool currentFrameValid = !document.empty() && hasGoodDocument;
+            long long now = getCurrentTimeMillis();
+            scheduler.update(current, now);
 
-        if (currentFrameValid) {
-            if (!documentDetected) {
-                documentDetected = true;
-                detectionStartTime = getCurrentTimeMillis();
-                lastBestDocument = document;
-                std::cout << "?? Document detected! Area: " << (int)cv::contourArea(document) << " Quality: " << quality.overallScore << "%" << std::endl;
-                serial.send("DOC_DETECTED\n");
-            }
-            lastBestDocument = document;
+            int latencyMs = (int)(getCurrentTimeMillis() - current.captureTime);
 
-        }
-        else {
-            if (documentDetected) {
-                documentDetected = false;
-                saved = false;
-                std::cout << "? Detection lost!" << std::endl;
-                serial.send("DOC_LOST\n");
+            ESP_DOC_TIME_STAGE(Display);
+            if (config.headless) {
+                publishPreview(preview, 0, current, scheduler.state(), config, now, currentFps, latencyMs);
             }
-        }
+            else {
+                // Enhanced UI
+                drawScanState(current, scheduler.state(), config, now, currentFps, latencyMs);
 
-        // Auto-save logic
-        if (documentDetected && !saved) {
-            long long elapsedTime = getCurrentTimeMillis() - detectionStartTime;
-            if (elapsedTime >= (config.detectionTimeSeconds * 1000)) {
-                cv::Mat warped = BalancedDocumentWarper::warpDocument(frame, lastBestDocument, config.autoEnhance);
-                if (!warped.empty()) {
-                    std::ostringstream filenameOss;
-                    filenameOss << config.saveFolder << "doc_" << getTimestamp() << "_" << (++docCount) << ".jpg";
-                    std::string filename = filenameOss.str();
-                    cv::imwrite(filename, warped);
-
-                    std::cout << "? Document saved: " << filename << std::endl;
-                    std::cout << "?? Final quality: " << quality.overallScore << "%" << std::endl;
-
-                    serial.send("DOC_SAVED\n");
-                    saved = true;
-
-                    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
-                    documentDetected = false;
-                    saved = false;
+                cv::imshow("BALANCED Document Scanner", current.frame);
+                if (!current.skipped) {
+                    cv::imshow("Processing", current.combined); // Show processing result
                 }
             }
         }
 
-        // Enhanced UI
-        drawUI(frame, document, detectionStartTime, saved, config.detectionTimeSeconds,
-            (document.size() == 4) ? &quality : NULL, documentDetected, currentFps);
-
-        cv::imshow("BALANCED Document Scanner", frame);
-        cv::imshow("Processing", combined); // Show processing result
-
-        int key = cv::waitKey(1) & 0xFF;
+        int key = config.headless ? pollHeadlessKey(preview) : cv::waitKey(1) & 0xFF;
         if (key == 'q' || key == 27) {
             break;
         }
-        else if (key == 'c' && document.size() == 4) {
-            cv::Mat warped = BalancedDocumentWarper::warpDocument(frame, document, config.autoEnhance);
-            if (!warped.empty()) {
-                std::ostringstream filenameOss;
-                filenameOss << config.saveFolder << "manual_" << getTimestamp() << "_" << (++docCount) << ".jpg";
-                std::string filename = filenameOss.str();
-                cv::imwrite(filename, warped);
-                std::cout << "?? Manual capture: " << filename << std::endl;
-                serial.send("DOC_SAVED\n");
-            }
+        else if (key == 'c' && displayedSlot >= 0) {
+            scheduler.captureAll(framePool[displayedSlot]);
         }
+
+        reportSaves();
     }
 
     std::cout << "\n?? Shutting down..." << std::endl;
-    serial.send("SCANNER_OFF\n");
-
-    cap.release();
-    cv::destroyAllWindows();
-
-    std::cout << "?? Total documents: " << docCount << std::endl;
+    preview.stop();
+    running = false;
+    captureThread.join();
+    recorder.close();
+    detectionThread.join();
+    writer.shutdown();
+    reportSaves();
+    int sessionPages = pdfSession.pageCount();
+    pdfSession.close();
+    serial.post(NotifierEvent::ScannerOff);
+    serial.stop();
+    ESP_DOC_COUNT_SET(SerialFailures, serial.failureCount());
+    ESP_DOC_COUNT_SET(SerialDropped, serial.droppedCount());
+    metricsReporter.stop();
+
+    mjpegSource.close();
+    captureSource.release();
+    replaySource.close();
+    if (!config.headless) cv::destroyAllWindows();
+
+    std::cout << "?? Total documents: " << scheduler.documents() << std::endl;
+    if (sessionPages > 0) std::cout << "?? Session PDF: " << pdfSession.path() << " (" << sessionPages << " pages)" << std::endl;
+    if (recording) {
+        std::cout << "?? Recorded " << recorder.framesRecorded() << " frames to " << recorder.path();
+        if (recorder.framesDropped() > 0) std::cout << " (" << recorder.framesDropped() << " left out, disk too slow)";
+        if (recorder.writeFailed()) std::cout << " (write error, recording is incomplete)";
+        std::cout << std::endl;
+    }
+    std::cout << "?? Dropped stale frames: " << droppedFrames << ", dropped results: " << droppedResults << std::endl;
+    std::cout << "?? Serial failures: " << serial.failureCount() << std::endl;
+    std::cout << "?? Save warp cache: " << writer.warpCacheHits() << " hits, " << writer.warpCacheMisses() << " misses" << std::endl;
     return 0;
 }
@@ -20,8 +20,12 @@
 #define LED_PIN     2      // Built-in LED or external LED
 #define BUZZER_PIN  4      // Buzzer pin
 
+// Page ids fit pagesInView (the scanner reuses 1..maxDocuments)
+#define MAX_PAGE_ID 31
+
 // State variables
 bool documentDetected = false;
+unsigned long pagesInView = 0;  // Bit per page id in multi-document mode (bit 0 = single page)
 bool ledState = false;
 unsigned long lastBuzzTime = 0;
 int docCount = 0;
@@ -53,6 +57,7 @@ void setup() {
   Serial.println("- DOC_DETECTED: Turn on LED");
   Serial.println("- DOC_SAVED: LED + Buzzer");
   Serial.println("- DOC_LOST: Turn off LED");
+  Serial.println("  (multi-document mode appends a page id: DOC_DETECTED 2)");
 }
 
 void loop() {
@@ -67,16 +72,32 @@ void loop() {
   delay(10);
 }
 
-void handleCommand(String command) {
-  Serial.println("Received: " + command);
+void handleCommand(String line) {
+  Serial.println("Received: " + line);
+
+  // Optional page id after the command: 1..MAX_PAGE_ID (0 = single page).
+  // Anything else is ignored rather than folded onto another page's bit.
+  String command = line;
+  int docId = 0;
+  int space = line.indexOf(' ');
+  if (space >= 0) {
+    command = line.substring(0, space);
+    docId = line.substring(space + 1).toInt();
+    if (docId < 0 || docId > MAX_PAGE_ID) {
+      Serial.println("Invalid page id: " + line);
+      return;
+    }
+  }
+  unsigned long bit = 1UL << docId;
 
   if (command == "DOC_DETECTED") {
     // Document detected - turn on LED
+    pagesInView |= bit;
     documentDetected = true;
     digitalWrite(LED_PIN, HIGH);
     ledState = true;
 
-    Serial.println("LED ON - Document detected!");
+    Serial.println("LED ON - Document " + String(docId) + " detected!");
 
   } else if (command == "DOC_SAVED") {
     // Document saved - LED + buzzer
@@ -90,13 +111,16 @@ void handleCommand(String command) {
     Serial.println("LED + BUZZER - Document saved! (Total: " + String(docCount) + ")");
 
   } else if (command == "DOC_LOST") {
-    // Document lost - turn off LED
-    documentDetected = false;
-    digitalWrite(LED_PIN, LOW);
-    digitalWrite(BUZZER_PIN, LOW);
-    ledState = false;
+    // Document lost - turn off LED once no page is left in view
+    pagesInView &= ~bit;
+    documentDetected = pagesInView != 0;
+    if (!documentDetected) {
+      digitalWrite(LED_PIN, LOW);
+      digitalWrite(BUZZER_PIN, LOW);
+      ledState = false;
+    }
 
-    Serial.println("LED OFF - Document lost");
+    Serial.println(documentDetected ? "Document " + String(docId) + " lost, LED stays ON" : String("LED OFF - Document lost"));
 
   } else if (command == "SCANNER_OFF") {
     // Scanner shutting down - turn off everything
@@ -104,6 +128,7 @@ void handleCommand(String command) {
     digitalWrite(BUZZER_PIN, LOW);
     ledState = false;
     documentDetected = false;
+    pagesInView = 0;
 
     Serial.println("Scanner OFF - Session ended");
     Serial.println("Total documents scanned: " + String(docCount));
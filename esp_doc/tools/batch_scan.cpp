@@ -0,0 +1,418 @@
+// Headless batch scanner: runs the esp_doc detection, warp and enhancement
+// over image directories, glob patterns and recorded videos on a worker
+// pool. Never opens a window, so it runs on machines without a display.
+//
+//   esp_doc_batch [-o DIR] [-j N] [--stride N] [--no-enhance] INPUT...
+//
+// INPUT is an image, a directory (its images, sorted by name), a quoted
+// glob such as "photos/*.jpg", or a video file. Images are written as
+// NNNNN_<name>.<ext> in input order, in Config::outputFormat. For videos
+// every --stride'th frame is detected in parallel and the sharpest frame of
+// each run of frames that show a document is saved as
+// <video>_segNNN_fNNNNNN.<ext>.
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/videoio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Config.hpp"
+#include "QualityMetrics.hpp"
+#include "DetectorFactory.hpp"
+#include "BalancedDocumentWarper.hpp"
+#include "DocumentEncoder.hpp"
+#include "DocumentWriter.hpp"
+
+namespace fs = std::filesystem;
+
+struct BatchOptions {
+    std::vector<std::string> inputs;
+    std::string outputDir = "batch_scans";
+    int workers = 0;                    // 0 = one per core
+    int videoStride = 3;                // detect every Nth video frame
+    int segmentGap = 5;                 // sampled frames without a document that end a segment
+    bool enhance = true;
+};
+
+static std::string lowerExtension(const fs::path& p) {
+    std::string ext = p.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return ext;
+}
+
+static bool isImageFile(const fs::path& p) {
+    static const char* exts[] = { ".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff", ".webp" };
+    std::string ext = lowerExtension(p);
+    for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+        if (ext == exts[i]) return true;
+    }
+    return false;
+}
+
+static bool isVideoFile(const fs::path& p) {
+    static const char* exts[] = { ".mp4", ".avi", ".mov", ".mkv", ".webm", ".mjpeg", ".mjpg" };
+    std::string ext = lowerExtension(p);
+    for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+        if (ext == exts[i]) return true;
+    }
+    return false;
+}
+
+// '*' and '?' wildcards, for patterns the shell did not expand
+static bool wildcardMatch(const char* pattern, const char* name) {
+    if (*pattern == '\0') return *name == '\0';
+    if (*pattern == '*') {
+        for (const char* n = name; ; n++) {
+            if (wildcardMatch(pattern + 1, n)) return true;
+            if (*n == '\0') return false;
+        }
+    }
+    if (*name == '\0') return false;
+    if (*pattern == '?' || *pattern == *name) return wildcardMatch(pattern + 1, name + 1);
+    return false;
+}
+
+// Splits the inputs into an ordered image list and a list of videos
+static void collectInputs(const std::vector<std::string>& inputs, std::vector<fs::path>& images, std::vector<fs::path>& videos) {
+    for (size_t i = 0; i < inputs.size(); i++) {
+        fs::path p(inputs[i]);
+        std::error_code ec;
+        std::vector<fs::path> found;
+
+        if (inputs[i].find_first_of("*?") != std::string::npos) {
+            fs::path dir = p.has_parent_path() ? p.parent_path() : fs::path(".");
+            std::string pattern = p.filename().string();
+            for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+                if (it->is_regular_file() && wildcardMatch(pattern.c_str(), it->path().filename().string().c_str())) {
+                    found.push_back(it->path());
+                }
+            }
+        }
+        else if (fs::is_directory(p, ec)) {
+            for (fs::directory_iterator it(p, ec), end; !ec && it != end; it.increment(ec)) {
+                if (it->is_regular_file()) found.push_back(it->path());
+            }
+        }
+        else if (fs::exists(p, ec)) {
+            found.push_back(p);
+        }
+        else {
+            std::cerr << "Skipping missing input: " << inputs[i] << std::endl;
+        }
+
+        std::sort(found.begin(), found.end());
+        for (size_t j = 0; j < found.size(); j++) {
+            if (isVideoFile(found[j])) videos.push_back(found[j]);
+            else if (isImageFile(found[j])) images.push_back(found[j]);
+        }
+    }
+}
+
+// The detector is tuned for the capture resolution in Config, so large
+// photos are searched on a copy fitted to it and the quad is scaled back.
+static void detectFitted(DetectorEngine& detector, const Config& config, const cv::Mat& img,
+    cv::Mat& small, cv::Mat& combined, std::vector<cv::Point>& document) {
+    int longSide = std::max(img.cols, img.rows);
+    int target = std::max(config.frameWidth, config.frameHeight);
+    if (longSide <= target) {
+        detector.detect(img, document, combined);
+        return;
+    }
+
+    double scale = (double)target / longSide;
+    cv::resize(img, small, cv::Size(), scale, scale, cv::INTER_AREA);
+    detector.detect(small, document, combined);
+    double sx = (double)img.cols / small.cols;
+    double sy = (double)img.rows / small.rows;
+    for (size_t i = 0; i < document.size(); i++) {
+        document[i].x = std::min(cvRound(document[i].x * sx), img.cols - 1);
+        document[i].y = std::min(cvRound(document[i].y * sy), img.rows - 1);
+    }
+}
+
+static int workerCount(const BatchOptions& opts) {
+    if (opts.workers > 0) return opts.workers;
+    unsigned int cores = std::thread::hardware_concurrency();
+    return cores > 0 ? (int)cores : 4;
+}
+
+struct BatchTotals {
+    std::atomic<int> inputs;
+    std::atomic<int> saved;
+    std::atomic<int> noDocument;
+    std::atomic<int> failed;
+
+    BatchTotals() : inputs(0), saved(0), noDocument(0), failed(0) {}
+};
+
+static void scanImages(const std::vector<fs::path>& images, const Config& config, const BatchOptions& opts, BatchTotals& totals) {
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    int workers = std::min(workerCount(opts), (int)images.size());
+
+    for (int w = 0; w < workers; w++) {
+        pool.emplace_back([&]() {
+            std::unique_ptr<DetectorEngine> detector = createDetectorEngine(config);
+            WarpWorkspace warpWs;
+            warpWs.cache.setEpsilon(-1.0);      // every image is a new quad
+            DocumentEncoder encoder(EncoderSettings::fromConfig(config));
+            cv::Mat small, combined;
+            std::vector<cv::Point> document;
+            std::vector<uchar> encoded;
+            char prefix[16];
+
+            for (size_t i = next++; i < images.size(); i = next++) {
+                totals.inputs++;
+                cv::Mat img = cv::imread(images[i].string(), cv::IMREAD_COLOR);
+                if (img.empty()) {
+                    std::cerr << "Cannot read " << images[i] << std::endl;
+                    totals.failed++;
+                    continue;
+                }
+
+                try {
+                    detectFitted(*detector, config, img, small, combined, document);
+                    if (document.size() != 4) {
+                        std::cout << "No document: " << images[i].filename().string() << std::endl;
+                        totals.noDocument++;
+                        continue;
+                    }
+
+                    cv::Mat warped = BalancedDocumentWarper::warpDocument(img, document, warpWs, opts.enhance);
+                    std::snprintf(prefix, sizeof(prefix), "%05d_", (int)i + 1);
+                    fs::path out = fs::path(opts.outputDir) / (prefix + images[i].stem().string() + encoder.extension());
+                    if (encoder.encode(warped, encoded) && writeFileBytes(out.string(), encoded)) totals.saved++;
+                    else totals.failed++;
+                }
+                catch (const cv::Exception& e) {
+                    std::cerr << "Failed on " << images[i] << ": " << e.what() << std::endl;
+                    totals.failed++;
+                }
+            }
+        });
+    }
+    for (size_t i = 0; i < pool.size(); i++) pool[i].join();
+}
+
+struct VideoSample {
+    long long frameIndex;
+    cv::Mat frame;
+    std::vector<cv::Point> document;
+    int score;
+};
+
+// Reads sampled frames in order, detects on the pool and hands results back
+// in frame order, so segments can be cut and their best frame picked
+static void scanVideo(const fs::path& video, const Config& config, const BatchOptions& opts, BatchTotals& totals) {
+    cv::VideoCapture cap(video.string());
+    if (!cap.isOpened()) {
+        std::cerr << "Cannot open video " << video << std::endl;
+        totals.failed++;
+        return;
+    }
+
+    int workers = workerCount(opts);
+    const size_t maxInFlight = (size_t)workers * 2;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<VideoSample> jobs;
+    std::map<long long, VideoSample> results;      // keyed by sample number
+    long long samplesRead = 0;
+    bool readerDone = false;
+
+    std::vector<std::thread> pool;
+    for (int w = 0; w < workers; w++) {
+        pool.emplace_back([&]() {
+            std::unique_ptr<DetectorEngine> detector = createDetectorEngine(config);
+            cv::Mat small, combined, gray;
+            while (true) {
+                VideoSample job;
+                long long sample;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&]() { return readerDone || !jobs.empty(); });
+                    if (jobs.empty()) return;
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                sample = job.frameIndex / opts.videoStride;
+
+                job.score = -1;
+                try {
+                    detectFitted(*detector, config, job.frame, small, combined, job.document);
+                    if (job.document.size() == 4) {
+                        cv::cvtColor(job.frame, gray, cv::COLOR_BGR2GRAY);
+                        job.score = assessQuadQuality(gray, job.document).overallScore;
+                    }
+                }
+                catch (const cv::Exception& e) {
+                    std::cerr << "Frame " << job.frameIndex << " failed: " << e.what() << std::endl;
+                }
+                if (job.score < 0) job.frame.release();
+
+                std::lock_guard<std::mutex> lock(mutex);
+                results[sample] = std::move(job);
+                changed.notify_all();
+            }
+        });
+    }
+
+    AsyncDocumentWriter writer(workers, (size_t)workers * 2, -1.0, EncoderSettings::fromConfig(config));
+    std::string stem = video.stem().string();
+    int segmentNumber = 0;
+    VideoSample best;
+    best.score = -1;
+    int gap = 0;
+    char suffix[32];
+
+    auto closeSegment = [&]() {
+        if (best.score < 0) return;
+        segmentNumber++;
+        if (best.score >= config.qualityThreshold) {
+            std::snprintf(suffix, sizeof(suffix), "_seg%03d_f%06lld", segmentNumber, best.frameIndex);
+            fs::path out = fs::path(opts.outputDir) / (stem + suffix + writer.fileExtension());
+            while (writer.submit(best.frame, best.document, out.string(), opts.enhance, best.score) == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        }
+        else {
+            std::cout << stem << ": segment " << segmentNumber << " best quality " << best.score
+                << "% is below " << config.qualityThreshold << "%, skipped" << std::endl;
+            totals.noDocument++;
+        }
+        best = VideoSample();
+        best.score = -1;
+    };
+
+    // Collector: consumes results strictly in sample order
+    std::thread collector([&]() {
+        for (long long sample = 0; ; sample++) {
+            VideoSample result;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return results.count(sample) || (readerDone && sample >= samplesRead); });
+                if (!results.count(sample)) break;
+                result = std::move(results[sample]);
+                results.erase(sample);
+                changed.notify_all();
+            }
+
+            if (result.score >= 0) {
+                gap = 0;
+                if (result.score > best.score) best = std::move(result);
+            }
+            else if (++gap >= opts.segmentGap) {
+                closeSegment();
+            }
+        }
+        closeSegment();
+    });
+
+    // Reader: decoding is sequential, so it stays on this thread
+    cv::Mat frame;
+    for (long long index = 0; cap.read(frame); index++) {
+        if (index % opts.videoStride != 0) continue;
+        totals.inputs++;
+        VideoSample job;
+        job.frameIndex = index;
+        job.frame = frame.clone();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]() { return jobs.size() + results.size() < maxInFlight; });
+        jobs.push_back(std::move(job));
+        samplesRead++;
+        changed.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        readerDone = true;
+    }
+    changed.notify_all();
+
+    for (size_t i = 0; i < pool.size(); i++) pool[i].join();
+    collector.join();
+    writer.shutdown();
+
+    std::vector<SaveResult> saves;
+    writer.pollCompleted(saves);
+    for (size_t i = 0; i < saves.size(); i++) {
+        if (saves[i].ok) totals.saved++;
+        else totals.failed++;
+    }
+    std::cout << stem << ": " << segmentNumber << " document segment(s)" << std::endl;
+}
+
+static void printUsage() {
+    std::cout << "Usage: esp_doc_batch [-o DIR] [-j N] [--stride N] [--no-enhance] INPUT..." << std::endl
+        << "  INPUT        image, directory, quoted glob (\"dir/*.jpg\") or video file" << std::endl
+        << "  -o DIR       output folder (default batch_scans)" << std::endl
+        << "  -j N         worker threads (default: one per core)" << std::endl
+        << "  --stride N   detect every Nth video frame (default 3)" << std::endl
+        << "  --no-enhance save the plain warp without CLAHE" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    Config config;
+    BatchOptions opts;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) opts.outputDir = argv[++i];
+        else if (arg == "-j" && i + 1 < argc) opts.workers = std::atoi(argv[++i]);
+        else if (arg == "--stride" && i + 1 < argc) opts.videoStride = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--no-enhance") opts.enhance = false;
+        else if (arg == "-h" || arg == "--help") {
+            printUsage();
+            return 0;
+        }
+        else opts.inputs.push_back(arg);
+    }
+    if (opts.inputs.empty()) {
+        printUsage();
+        return 1;
+    }
+
+    std::vector<fs::path> images, videos;
+    collectInputs(opts.inputs, images, videos);
+    if (images.empty() && videos.empty()) {
+        std::cerr << "No images or videos found" << std::endl;
+        return 1;
+    }
+
+    std::error_code ec;
+    fs::create_directories(opts.outputDir, ec);
+
+    // Parallelism comes from our own pool; keep OpenCV from oversubscribing
+    cv::setNumThreads(1);
+
+    std::cout << "Batch scan: " << images.size() << " image(s), " << videos.size() << " video(s), "
+        << workerCount(opts) << " worker(s) -> " << opts.outputDir << std::endl;
+
+    BatchTotals totals;
+    auto start = std::chrono::steady_clock::now();
+    if (!images.empty()) scanImages(images, config, opts, totals);
+    for (size_t i = 0; i < videos.size(); i++) scanVideo(videos[i], config, opts, totals);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Inputs: " << totals.inputs << " (images + sampled frames)" << std::endl;
+    std::cout << "Saved: " << totals.saved << ", no document: " << totals.noDocument
+        << ", failed: " << totals.failed << std::endl;
+    std::cout << "Elapsed: " << seconds << " s, " << (seconds > 0 ? totals.saved / seconds : 0.0) << " documents/s, "
+        << (seconds > 0 ? totals.inputs / seconds : 0.0) << " inputs/s" << std::endl;
+    return totals.failed > 0 ? 2 : 0;
+}
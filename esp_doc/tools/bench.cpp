@@ -0,0 +1,633 @@
+// Per-stage benchmark for the document pipeline. Times every stage on
+// fixed inputs and reports median/p99 per stage plus whole-frame
+// throughput, as a table and as JSON, so configurations can be compared
+// and regressions caught. The stages are the contour engine's; the line
+// engine is timed as a whole (lines_detect) next to them, with its own
+// search counts. balancedPreprocess_fast is the fastProcessing path, checked
+// against the full one on every input: the edge maps and the quad detect()
+// finds.
+// quality_estimate compares assessQuadQuality() with assessQuality() on the
+// warped page, the score Config::fastQualityEstimate swaps out.
+//
+// stream_scaling runs 1, 2, 4, ... up to --streams detection streams on one
+// WorkStealingPool of detectionWorkers threads, as multi-stream mode does
+// (one job per stream in the pool, DetectionStage per stream, tracking and
+// QoS off so every frame is detected), and reports the total frame rate
+// and its efficiency against N x the single-stream rate.
+//
+//   esp_doc_bench [--iterations N] [--images DIR] [--video FILE] [--frames N]
+//                 [--level N] [--no-color] [--streams N] [--json FILE|-]
+//
+// --json - writes the JSON to stdout and the table to stderr.
+//
+// Inputs: the images in --images (default dOCUMENT_SCANNER/dOCUMENT_SCANNER/
+// resources), the first --frames frames of --video (default
+// esp_doc/esp_doc/resources/Recording #2.mp4) and synthetic documents
+// rendered at 480x360, 640x480, 1280x720 and 1920x1080. Missing files are
+// skipped. Paths are relative to the repository root.
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/videoio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Config.hpp"
+#include "QualityMetrics.hpp"
+#include "BalancedDocumentDetector.hpp"
+#include "FastPreprocess.hpp"
+#include "LineQuadDetector.hpp"
+#include "BalancedDocumentWarper.hpp"
+#include "MjpegStreamSource.hpp"
+#include "DetectionStage.hpp"
+#include "WorkStealingPool.hpp"
+
+namespace fs = std::filesystem;
+
+struct BenchInput {
+    std::string name;
+    std::vector<cv::Mat> frames;
+    std::vector<cv::Point> knownQuad;   // synthetic inputs only
+};
+
+struct StageStats {
+    std::string stage;
+    double medianMs;
+    double p99Ms;
+    double meanMs;
+    size_t samples;
+};
+
+// The fastProcessing path against the full one, over the timed iterations
+struct FastPathCheck {
+    int frames;
+    double edgeIouSum;                  // balancedPreprocess edge maps, intersection over union
+    int detectAgree;                    // both found a page or neither did
+    int bothFound;
+    double cornerErrorSum;              // mean corner distance when both found one, pixels
+};
+
+// assessQuadQuality() against assessQuality() on the same quads
+struct QualityEstimateCheck {
+    int frames;
+    int decisionAgree;                  // same side of Config::qualityThreshold
+    double scoreDiffSum;                // |overallScore difference|
+    int scoreDiffMax;
+};
+
+struct InputReport {
+    std::string name;
+    cv::Size size;
+    int detectedFrames;
+    std::vector<StageStats> stages;
+    double frameFps;                    // detect + quality, as the detection thread runs it
+    ContourStats contours;              // findBestDocument's candidate cascade over the timed iterations
+    int contourSearches;
+    LineQuadStats lines;                // the line engine over the timed iterations
+    int lineSearches;
+    int lineDetectedFrames;
+    FastPathCheck fast;
+    QualityEstimateCheck quality;
+};
+
+// N streams detecting at once on one pool
+struct StreamScaling {
+    int streams;
+    int workers;
+    double totalFps;
+    double efficiency;                  // totalFps / (streams x single-stream fps)
+    unsigned long long stolen;
+};
+
+static double nowMs() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static StageStats summarize(const std::string& stage, std::vector<double>& ms) {
+    StageStats st = { stage, 0.0, 0.0, 0.0, ms.size() };
+    if (ms.empty()) return st;
+    std::sort(ms.begin(), ms.end());
+    st.medianMs = ms[ms.size() / 2];
+    st.p99Ms = ms[std::min(ms.size() - 1, (size_t)(ms.size() * 0.99))];
+    double sum = 0.0;
+    for (size_t i = 0; i < ms.size(); i++) sum += ms[i];
+    st.meanMs = sum / ms.size();
+    return st;
+}
+
+// A white page with text lines, in perspective, on a noisy dark desk
+static BenchInput renderSynthetic(cv::Size size, cv::RNG& rng) {
+    BenchInput input;
+    std::ostringstream name;
+    name << "synthetic_" << size.width << "x" << size.height;
+    input.name = name.str();
+
+    cv::Mat img(size, CV_8UC3, cv::Scalar(70, 85, 100));
+    cv::Mat noise(size, CV_8UC3);
+    cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(24));
+    img += noise;
+
+    cv::Mat page(594, 420, CV_8UC3, cv::Scalar(235, 238, 240));
+    for (int y = 60; y < page.rows - 40; y += 22) {
+        std::string line;
+        int words = 4 + rng.uniform(0, 5);
+        for (int w = 0; w < words; w++) line += std::string(rng.uniform(2, 8), 'a' + rng.uniform(0, 26)) + " ";
+        cv::putText(page, line, cv::Point(30, y), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(30, 30, 30), 1, cv::LINE_AA);
+    }
+
+    float w = (float)size.width, h = (float)size.height;
+    float jx = w * 0.06f, jy = h * 0.06f;
+    cv::Point2f dst[4] = {
+        cv::Point2f(w * 0.25f + rng.uniform(-jx, jx), h * 0.15f + rng.uniform(-jy, jy)),
+        cv::Point2f(w * 0.75f + rng.uniform(-jx, jx), h * 0.15f + rng.uniform(-jy, jy)),
+        cv::Point2f(w * 0.75f + rng.uniform(-jx, jx), h * 0.85f + rng.uniform(-jy, jy)),
+        cv::Point2f(w * 0.25f + rng.uniform(-jx, jx), h * 0.85f + rng.uniform(-jy, jy))
+    };
+    cv::Point2f src[4] = {
+        cv::Point2f(0, 0), cv::Point2f((float)page.cols, 0),
+        cv::Point2f((float)page.cols, (float)page.rows), cv::Point2f(0, (float)page.rows)
+    };
+    cv::Mat H = cv::getPerspectiveTransform(src, dst);
+    cv::warpPerspective(page, img, H, size, cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+    cv::GaussianBlur(img, img, cv::Size(3, 3), 0.8);
+
+    for (int i = 0; i < 4; i++) input.knownQuad.push_back(cv::Point(cvRound(dst[i].x), cvRound(dst[i].y)));
+    input.frames.push_back(img);
+    return input;
+}
+
+static std::vector<cv::Point> insetQuad(cv::Size size) {
+    int mx = size.width / 10, my = size.height / 10;
+    std::vector<cv::Point> quad;
+    quad.push_back(cv::Point(mx, my));
+    quad.push_back(cv::Point(size.width - mx, my));
+    quad.push_back(cv::Point(size.width - mx, size.height - my));
+    quad.push_back(cv::Point(mx, size.height - my));
+    return quad;
+}
+
+static double edgeIou(const cv::Mat& a, const cv::Mat& b, cv::Mat& scratch) {
+    cv::bitwise_or(a, b, scratch);
+    int either = cv::countNonZero(scratch);
+    cv::bitwise_and(a, b, scratch);
+    return either ? (double)cv::countNonZero(scratch) / either : 1.0;
+}
+
+static double cornerError(const std::vector<cv::Point>& a, const std::vector<cv::Point>& b) {
+    cv::Point oa[4], ob[4];
+    orderQuadCorners(a, oa);
+    orderQuadCorners(b, ob);
+    double sum = 0.0;
+    for (int i = 0; i < 4; i++) sum += cv::norm(oa[i] - ob[i]);
+    return sum / 4;
+}
+
+static InputReport benchInput(const BenchInput& input, const Config& config, int iterations) {
+    BalancedDocumentDetector detector(config);
+    Config fastConfig = config;
+    fastConfig.fastProcessing = true;
+    BalancedDocumentDetector fastDetector(fastConfig);
+    cv::Mat fastCombined, scratch;
+    std::vector<cv::Point> fastDocument;
+    LineQuadDetector lineDetector(config);
+    WarpWorkspace plainWs, cachedWs;
+    plainWs.cache.setEpsilon(-1.0);
+    cachedWs.cache.setEpsilon(config.warpCacheEpsilon);
+    QualityWorkspace qualityWs;
+    cv::Mat combined, gray;
+    std::vector<cv::Point> document;
+    std::vector<uchar> encoded, frameJpeg;
+    cv::Mat decoded, decodeScratch;
+    cv::Size captureSize(config.frameWidth, config.frameHeight);
+    int decodeFactor = 1;
+    std::vector<int> jpegParams;
+    jpegParams.push_back(cv::IMWRITE_JPEG_QUALITY);
+    jpegParams.push_back(95);
+
+    const char* names[] = {
+        "balancedPreprocess", "detectPaper", "findBestDocument", "warpDocument_cubic",
+        "warpDocument_linear", "warpDocument_cubic_cached", "enhanceDocument", "assessQuality",
+        "assessQuadQuality", "jpeg_encode", "jpeg_decode_full", "jpeg_decode_scaled", "lines_detect",
+        "balancedPreprocess_fast", "frame_detect_quality"
+    };
+    const int stageCount = sizeof(names) / sizeof(names[0]);
+    std::vector<std::vector<double> > samples(stageCount);
+
+    InputReport report;
+    report.name = input.name;
+    report.size = input.frames[0].size();
+    report.detectedFrames = 0;
+    report.contourSearches = 0;
+    report.lineSearches = 0;
+    report.lineDetectedFrames = 0;
+    report.fast = FastPathCheck();
+    report.quality = QualityEstimateCheck();
+
+    const int warmup = 3;
+    for (int it = -warmup; it < iterations; it++) {
+        const cv::Mat& frame = input.frames[(size_t)(it + warmup) % input.frames.size()];
+        bool record = it >= 0;
+        double t0, t1;
+
+        t0 = nowMs();
+        const cv::Mat& processed = detector.balancedPreprocess(frame);
+        t1 = nowMs();
+        if (record) samples[0].push_back(t1 - t0);
+
+        t0 = nowMs();
+        const cv::Mat& fastProcessed = fastDetector.balancedPreprocess(frame);
+        t1 = nowMs();
+        if (record) {
+            samples[13].push_back(t1 - t0);
+            report.fast.frames++;
+            report.fast.edgeIouSum += edgeIou(processed, fastProcessed, scratch);
+        }
+
+        t0 = nowMs();
+        const cv::Mat& paper = detector.detectPaper(frame);
+        t1 = nowMs();
+        if (record) samples[1].push_back(t1 - t0);
+
+        if (config.useColorDetection) cv::bitwise_and(processed, paper, combined);
+        else processed.copyTo(combined);
+
+        t0 = nowMs();
+        detector.findBestDocument(combined, frame, document);
+        t1 = nowMs();
+        if (record) {
+            samples[2].push_back(t1 - t0);
+            report.contours.add(detector.lastContourStats());
+            report.contourSearches++;
+        }
+
+        bool found = document.size() == 4;
+        if (record && found && it < (int)input.frames.size()) report.detectedFrames++;
+        if (!found) document = input.knownQuad.empty() ? insetQuad(frame.size()) : input.knownQuad;
+
+        t0 = nowMs();
+        cv::Mat warped = BalancedDocumentWarper::warpDocument(frame, document, plainWs, false, cv::INTER_CUBIC);
+        t1 = nowMs();
+        if (record) samples[3].push_back(t1 - t0);
+
+        t0 = nowMs();
+        BalancedDocumentWarper::warpDocument(frame, document, plainWs, false, cv::INTER_LINEAR);
+        t1 = nowMs();
+        if (record) samples[4].push_back(t1 - t0);
+
+        t0 = nowMs();
+        BalancedDocumentWarper::warpDocument(frame, document, cachedWs, false, cv::INTER_CUBIC);
+        t1 = nowMs();
+        if (record) samples[5].push_back(t1 - t0);
+
+        warped = BalancedDocumentWarper::warpDocument(frame, document, plainWs, false, cv::INTER_CUBIC);
+        t0 = nowMs();
+        cv::Mat enhanced = BalancedDocumentWarper::enhanceDocument(warped, plainWs);
+        t1 = nowMs();
+        if (record) samples[6].push_back(t1 - t0);
+
+        t0 = nowMs();
+        QualityMetrics warpedQuality = assessQuality(warped, qualityWs);
+        t1 = nowMs();
+        if (record) samples[7].push_back(t1 - t0);
+
+        cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+        t0 = nowMs();
+        QualityMetrics quadQuality = assessQuadQuality(gray, document);
+        t1 = nowMs();
+        if (record) {
+            samples[8].push_back(t1 - t0);
+            QualityEstimateCheck& q = report.quality;
+            int diff = std::abs(quadQuality.overallScore - warpedQuality.overallScore);
+            q.frames++;
+            if ((quadQuality.overallScore >= config.qualityThreshold) == (warpedQuality.overallScore >= config.qualityThreshold)) {
+                q.decisionAgree++;
+            }
+            q.scoreDiffSum += diff;
+            q.scoreDiffMax = std::max(q.scoreDiffMax, diff);
+        }
+
+        t0 = nowMs();
+        cv::imencode(".jpg", enhanced, encoded, jpegParams);
+        t1 = nowMs();
+        if (record) samples[9].push_back(t1 - t0);
+
+        // What a camera frame costs to decode: fully vs. scaled to the capture
+        // size (MjpegStreamSource; frames at capture size decode fully either way)
+        cv::imencode(".jpg", frame, frameJpeg, jpegParams);
+        cv::Mat frameBytes(1, (int)frameJpeg.size(), CV_8UC1, frameJpeg.data());
+        t0 = nowMs();
+        cv::imdecode(frameBytes, cv::IMREAD_COLOR, &decoded);
+        t1 = nowMs();
+        if (record) samples[10].push_back(t1 - t0);
+
+        t0 = nowMs();
+        decodeScaledJpeg(frameBytes, frame.size(), captureSize, decoded, decodeScratch, decodeFactor);
+        t1 = nowMs();
+        if (record) samples[11].push_back(t1 - t0);
+
+        // The other engine (Config::detectorEngine = "lines") on the same frame
+        t0 = nowMs();
+        lineDetector.detect(frame, document, combined);
+        t1 = nowMs();
+        if (record) {
+            samples[12].push_back(t1 - t0);
+            report.lines.add(lineDetector.lastStats());
+            report.lineSearches++;
+            if (document.size() == 4 && it < (int)input.frames.size()) report.lineDetectedFrames++;
+        }
+
+        // The detection thread's per-frame work
+        t0 = nowMs();
+        detector.detect(frame, document, combined);
+        if (document.size() == 4) {
+            if (config.fastQualityEstimate) {
+                assessQuadQuality(detector.frameGray(), document);
+            }
+            else {
+                assessQuality(BalancedDocumentWarper::warpDocument(frame, document, cachedWs, false), qualityWs);
+            }
+        }
+        t1 = nowMs();
+        if (record) samples[14].push_back(t1 - t0);
+
+        if (record) {
+            fastDetector.detect(frame, fastDocument, fastCombined);
+            bool found = document.size() == 4, fastFound = fastDocument.size() == 4;
+            if (found == fastFound) report.fast.detectAgree++;
+            if (found && fastFound) {
+                report.fast.bothFound++;
+                report.fast.cornerErrorSum += cornerError(document, fastDocument);
+            }
+        }
+    }
+
+    for (int i = 0; i < stageCount; i++) {
+        report.stages.push_back(summarize(names[i], samples[i]));
+    }
+    double frameMedian = report.stages.back().medianMs;
+    report.frameFps = frameMedian > 0 ? 1000.0 / frameMedian : 0.0;
+    return report;
+}
+
+// One stream's frames, detected one job at a time like runStationDetection()
+struct BenchStream {
+    std::unique_ptr<DetectionStage> stage;
+    FrameSlot slot;
+    int remaining;
+    int index;
+};
+
+static void runBenchStream(BenchStream& bs, WorkStealingPool& pool, const std::vector<cv::Mat>& frames, std::atomic<int>& active) {
+    bs.slot.frame = frames[(size_t)bs.remaining % frames.size()];
+    bs.stage->process(bs.slot);
+    if (--bs.remaining > 0 && pool.submit([&bs, &pool, &frames, &active]() { runBenchStream(bs, pool, frames, active); }, 0, bs.index)) {
+        return;
+    }
+    active--;
+}
+
+static std::vector<StreamScaling> benchStreams(const BenchInput& input, const Config& config, int maxStreams, int iterations) {
+    Config streamConfig = config;
+    streamConfig.trackDocument = false;
+    streamConfig.adaptiveQos = false;
+    std::vector<int> counts;
+    for (int n = 1; n < maxStreams; n *= 2) counts.push_back(n);
+    counts.push_back(maxStreams);
+
+    std::vector<StreamScaling> results;
+    double singleFps = 0.0;
+    for (size_t c = 0; c < counts.size(); c++) {
+        int n = counts[c];
+        WorkStealingPool pool(config.detectionWorkers, config.pinWorkers);
+        std::vector<std::unique_ptr<BenchStream> > streams;
+        for (int i = 0; i < n; i++) {
+            std::unique_ptr<BenchStream> bs(new BenchStream());
+            bs->stage.reset(new DetectionStage(streamConfig));
+            bs->index = i;
+            bs->slot.frame = input.frames[0];
+            bs->stage->process(bs->slot);      // size the workspaces untimed
+            bs->remaining = iterations;
+            streams.push_back(std::move(bs));
+        }
+
+        std::atomic<int> active(n);
+        double t0 = nowMs();
+        for (int i = 0; i < n; i++) {
+            BenchStream& bs = *streams[i];
+            pool.submit([&bs, &pool, &input, &active]() { runBenchStream(bs, pool, input.frames, active); }, 0, i);
+        }
+        while (active > 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        double seconds = (nowMs() - t0) / 1000.0;
+
+        StreamScaling r;
+        r.streams = n;
+        r.workers = pool.size();
+        r.totalFps = seconds > 0 ? n * iterations / seconds : 0.0;
+        if (n == 1) singleFps = r.totalFps;
+        r.efficiency = singleFps > 0 ? r.totalFps / (n * singleFps) : 0.0;
+        r.stolen = pool.stolenCount();
+        results.push_back(r);
+        pool.shutdown();
+    }
+    return results;
+}
+
+static void writeJson(std::ostream& out, const std::vector<InputReport>& reports, const std::vector<StreamScaling>& scaling,
+    const std::string& scalingInput, const Config& config, int iterations) {
+    out << std::fixed << std::setprecision(4);
+    out << "{\n  \"iterations\": " << iterations << ",\n";
+    out << "  \"config\": {\"detectionPyramidLevel\": " << config.detectionPyramidLevel
+        << ", \"useColorDetection\": " << (config.useColorDetection ? "true" : "false")
+        << ", \"fastQualityEstimate\": " << (config.fastQualityEstimate ? "true" : "false")
+        << ", \"cannyLow\": " << config.cannyLow << ", \"cannyHigh\": " << config.cannyHigh << "},\n";
+    out << "  \"inputs\": [\n";
+    for (size_t i = 0; i < reports.size(); i++) {
+        const InputReport& r = reports[i];
+        out << "    {\"name\": \"" << r.name << "\", \"width\": " << r.size.width << ", \"height\": " << r.size.height
+            << ", \"detected_frames\": " << r.detectedFrames << ", \"frame_fps\": " << r.frameFps << ",\n";
+        out << "     \"stages\": {";
+        for (size_t j = 0; j < r.stages.size(); j++) {
+            const StageStats& s = r.stages[j];
+            out << (j ? ", " : "") << "\n       \"" << s.stage << "\": {\"median_ms\": " << s.medianMs
+                << ", \"p99_ms\": " << s.p99Ms << ", \"mean_ms\": " << s.meanMs << ", \"samples\": " << s.samples << "}";
+        }
+        out << "},\n     \"contour_cascade\": {\"searches\": " << r.contourSearches << ", \"contours\": " << r.contours.contours
+            << ", \"accepted\": " << r.contours.accepted << ", \"rejected\": {";
+        for (int t = 0; t < (int)ContourTest::Count; t++) {
+            out << (t ? ", " : "") << "\"" << contourTestName((ContourTest)t) << "\": " << r.contours.rejected[t];
+        }
+        out << "}},\n     \"line_engine\": {\"searches\": " << r.lineSearches << ", \"detected_frames\": " << r.lineDetectedFrames
+            << ", \"segments\": " << r.lines.segments << ", \"lines\": " << r.lines.lines << ", \"hypotheses\": " << r.lines.hypotheses
+            << ", \"accepted\": " << r.lines.accepted << "},\n";
+        const FastPathCheck& f = r.fast;
+        out << "     \"fast_path\": {\"frames\": " << f.frames
+            << ", \"edge_iou\": " << f.edgeIouSum / std::max(f.frames, 1) << ", \"detect_agree\": " << f.detectAgree
+            << ", \"both_found\": " << f.bothFound << ", \"corner_error_px\": " << f.cornerErrorSum / std::max(f.bothFound, 1)
+            << "},\n";
+        const QualityEstimateCheck& q = r.quality;
+        out << "     \"quality_estimate\": {\"frames\": " << q.frames << ", \"decision_agree\": " << q.decisionAgree
+            << ", \"score_diff_mean\": " << q.scoreDiffSum / std::max(q.frames, 1) << ", \"score_diff_max\": " << q.scoreDiffMax
+            << "}}" << (i + 1 < reports.size() ? "," : "") << "\n";
+    }
+    out << "  ],\n  \"stream_scaling\": {\"input\": \"" << scalingInput << "\", \"runs\": [";
+    for (size_t i = 0; i < scaling.size(); i++) {
+        const StreamScaling& s = scaling[i];
+        out << (i ? "," : "") << "\n    {\"streams\": " << s.streams << ", \"workers\": " << s.workers << ", \"total_fps\": "
+            << s.totalFps << ", \"efficiency\": " << s.efficiency << ", \"stolen\": " << s.stolen << "}";
+    }
+    out << "]}\n}\n";
+}
+
+static void printScaling(std::ostream& out, const std::vector<StreamScaling>& scaling, const std::string& scalingInput) {
+    if (scaling.empty()) return;
+    out << "\nstream scaling on " << scalingInput << " (" << scaling[0].workers << " pool worker(s))" << std::endl;
+    out << std::right << std::setw(10) << "streams" << std::setw(14) << "total fps" << std::setw(14) << "efficiency"
+        << std::setw(10) << "stolen" << std::endl;
+    for (size_t i = 0; i < scaling.size(); i++) {
+        const StreamScaling& s = scaling[i];
+        out << std::setw(10) << s.streams << std::setw(14) << std::setprecision(1) << s.totalFps
+            << std::setw(13) << std::setprecision(0) << s.efficiency * 100 << "%" << std::setw(10) << s.stolen << std::endl;
+    }
+}
+
+static void printTable(std::ostream& out, const std::vector<InputReport>& reports) {
+    for (size_t i = 0; i < reports.size(); i++) {
+        const InputReport& r = reports[i];
+        out << "\n" << r.name << " (" << r.size.width << "x" << r.size.height << "), document found in "
+            << r.detectedFrames << " frame(s), " << std::fixed << std::setprecision(1) << r.frameFps << " frames/s" << std::endl;
+        out << std::left << std::setw(28) << "  stage" << std::right << std::setw(12) << "median ms"
+            << std::setw(12) << "p99 ms" << std::endl;
+        for (size_t j = 0; j < r.stages.size(); j++) {
+            const StageStats& s = r.stages[j];
+            out << "  " << std::left << std::setw(26) << s.stage << std::right << std::setprecision(3)
+                << std::setw(12) << s.medianMs << std::setw(12) << s.p99Ms << std::endl;
+        }
+
+        // Where the contours of one search end up; tests listed cheapest first
+        const ContourStats& c = r.contours;
+        double searches = std::max(r.contourSearches, 1);
+        out << "  contour cascade: " << std::setprecision(1) << c.contours / searches << " contours/search, "
+            << c.accepted / searches << " accepted; rejected by";
+        for (int t = 0; t < (int)ContourTest::Count; t++) {
+            out << " " << contourTestName((ContourTest)t) << " " << c.rejected[t] / searches;
+        }
+        out << std::endl;
+
+        const LineQuadStats& l = r.lines;
+        double lineSearches = std::max(r.lineSearches, 1);
+        out << "  line engine: document found in " << r.lineDetectedFrames << " frame(s); " << l.segments / lineSearches
+            << " segments, " << l.lines / lineSearches << " lines, " << l.hypotheses / lineSearches << " quads, "
+            << l.accepted / lineSearches << " accepted per search" << std::endl;
+
+        const FastPathCheck& f = r.fast;
+        out << "  fast path: edge IoU " << std::setprecision(3)
+            << f.edgeIouSum / std::max(f.frames, 1) << ", detection agrees in " << f.detectAgree << "/" << f.frames
+            << " frame(s), corner error " << std::setprecision(2) << f.cornerErrorSum / std::max(f.bothFound, 1) << " px" << std::endl;
+
+        const QualityEstimateCheck& q = r.quality;
+        out << "  quality estimate: threshold decision agrees in " << q.decisionAgree << "/" << q.frames
+            << " frame(s), score diff mean " << q.scoreDiffSum / std::max(q.frames, 1) << ", max " << q.scoreDiffMax << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    Config config;
+    int iterations = 100;
+    int videoFrames = 30;
+    int maxStreams = std::max(1, (int)std::thread::hardware_concurrency());
+    std::string imageDir = "dOCUMENT_SCANNER/dOCUMENT_SCANNER/resources";
+    std::string videoPath = "esp_doc/esp_doc/resources/Recording #2.mp4";
+    std::string jsonPath;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--iterations" && i + 1 < argc) iterations = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--images" && i + 1 < argc) imageDir = argv[++i];
+        else if (arg == "--video" && i + 1 < argc) videoPath = argv[++i];
+        else if (arg == "--frames" && i + 1 < argc) videoFrames = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--level" && i + 1 < argc) config.detectionPyramidLevel = std::atoi(argv[++i]);
+        else if (arg == "--no-color") config.useColorDetection = false;
+        else if (arg == "--streams" && i + 1 < argc) maxStreams = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--json" && i + 1 < argc) jsonPath = argv[++i];
+        else {
+            std::cout << "Usage: esp_doc_bench [--iterations N] [--images DIR] [--video FILE] [--frames N]"
+                << " [--level N] [--no-color] [--streams N] [--json FILE|-]" << std::endl;
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+    }
+
+    std::vector<BenchInput> inputs;
+
+    std::error_code ec;
+    std::vector<fs::path> files;
+    for (fs::directory_iterator it(imageDir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file()) files.push_back(it->path());
+    }
+    std::sort(files.begin(), files.end());
+    for (size_t i = 0; i < files.size(); i++) {
+        cv::Mat img = cv::imread(files[i].string(), cv::IMREAD_COLOR);
+        if (img.empty()) continue;
+        BenchInput input;
+        input.name = files[i].filename().string();
+        input.frames.push_back(img);
+        inputs.push_back(input);
+    }
+    if (files.empty()) std::cerr << "No images in " << imageDir << ", skipped" << std::endl;
+
+    cv::VideoCapture cap(videoPath);
+    if (cap.isOpened()) {
+        BenchInput input;
+        input.name = fs::path(videoPath).filename().string();
+        cv::Mat frame;
+        while ((int)input.frames.size() < videoFrames && cap.read(frame)) input.frames.push_back(frame.clone());
+        if (!input.frames.empty()) inputs.push_back(input);
+    }
+    else {
+        std::cerr << "Cannot open " << videoPath << ", skipped" << std::endl;
+    }
+
+    // Fixed seed: the synthetic pages are identical on every run
+    cv::RNG rng(0x5eed);
+    const cv::Size sizes[] = { cv::Size(480, 360), cv::Size(640, 480), cv::Size(1280, 720), cv::Size(1920, 1080) };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        inputs.push_back(renderSynthetic(sizes[i], rng));
+    }
+
+    std::vector<InputReport> reports;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        reports.push_back(benchInput(inputs[i], config, iterations));
+    }
+
+    // Streams at the capture size, the recording when there is one
+    cv::Size captureSize(config.frameWidth, config.frameHeight);
+    const BenchInput* scalingInput = NULL;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (inputs[i].frames[0].size() != captureSize) continue;
+        if (scalingInput == NULL || inputs[i].frames.size() > scalingInput->frames.size()) scalingInput = &inputs[i];
+    }
+    if (scalingInput == NULL) scalingInput = &inputs.back();
+    std::vector<StreamScaling> scaling = benchStreams(*scalingInput, config, maxStreams, iterations);
+
+    // With the JSON on stdout the table goes to stderr, so stdout parses
+    std::ostream& table = jsonPath == "-" ? std::cerr : std::cout;
+    printTable(table, reports);
+    printScaling(table, scaling, scalingInput->name);
+    if (jsonPath == "-") {
+        writeJson(std::cout, reports, scaling, scalingInput->name, config, iterations);
+    }
+    else if (!jsonPath.empty()) {
+        std::ofstream out(jsonPath.c_str());
+        writeJson(out, reports, scaling, scalingInput->name, config, iterations);
+        std::cout << "\nJSON written to " << jsonPath << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,524 @@
+// Labeled evaluation and parameter search for the detector. Scores a
+// configuration on annotated frames (corner error, quad IoU, false
+// positives, per-frame cost), searches the parameter space on all cores
+// and prints the Pareto frontier of accuracy against latency, so Config
+// values can be chosen on evidence.
+//
+//   esp_doc_eval [-j N] [--samples N | --grid] [--seed N] [--param NAME=v1,v2,...]
+//                [--iou T] [--native] [--csv FILE] DATASET
+//
+// DATASET is a directory holding annotations.csv, or the CSV itself. Each
+// line is one frame, paths relative to the CSV:
+//
+//   page01.jpg,x1,y1,x2,y2,x3,y3,x4,y4     shows one document (corners in any order)
+//   desk07.jpg                              shows no document
+//   session.mp4@120,x1,y1,...               frame 120 of a video
+//
+// Corners are in source pixels; '#' starts a comment line. Frames are
+// scaled to fit the Config capture size, as the scanner sees them, unless
+// --native is given.
+//
+// A frame's result is the quad the scanner would act on: detected and
+// scoring at least qualityThreshold. The accuracy score is the mean over
+// frames of the IoU with the annotation (0 when missed), and for frames
+// without a document 1 when nothing was accepted, else 0. "detect%" counts
+// annotated frames with IoU >= --iou (default 0.9); "FP%" counts accepted
+// quads on empty frames plus misplaced ones (IoU < --iou) over all frames.
+// Latency is detect + quality scoring per frame (the quad estimate or the
+// warp, per fastQualityEstimate).
+//
+// The current Config is always evaluated first. Without --grid, --samples
+// (default 300) random combinations of the parameter values are tried;
+// --param replaces one parameter's candidate values. Configurations are
+// spread over -j threads (default: all cores). The frontier is picked from
+// those timings, which were all taken under the same contention; its
+// members are then timed again on one thread and shown next to them
+// ("1-thr ms") as what the scanner's own thread would see. detectorEngine is
+// searched as 0 = contour, 1 = lines, so the frontier shows what the
+// cheaper engine gives up on this data.
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Config.hpp"
+#include "QualityMetrics.hpp"
+#include "DetectorFactory.hpp"
+#include "BalancedDocumentWarper.hpp"
+
+namespace fs = std::filesystem;
+
+struct LabeledFrame {
+    std::string name;
+    cv::Mat image;
+    std::vector<cv::Point2f> corners;   // empty: no document in the frame
+};
+
+// One tunable Config field and its candidate values
+struct Parameter {
+    const char* name;
+    std::vector<double> values;
+    void (*set)(Config&, double);
+    double (*get)(const Config&);
+};
+
+struct EvalResult {
+    std::vector<double> values;         // one per Parameter
+    double score;
+    double detectRate;
+    double falsePositiveRate;
+    double meanIoU;                     // annotated frames, misses count as 0
+    double cornerError;                 // % of the diagonal, over correct frames
+    double medianMs;                    // under the parallel search, like every other candidate
+    double p95Ms;
+    double soloMedianMs;                // timed alone on one thread (frontier and current Config only, else 0)
+    bool frontier;
+};
+
+static std::vector<Parameter> defaultParameters() {
+    std::vector<Parameter> params;
+    params.push_back({ "cannyLow", { 10, 20, 30, 50 },
+        [](Config& c, double v) { c.cannyLow = (int)v; }, [](const Config& c) { return (double)c.cannyLow; } });
+    params.push_back({ "cannyHigh", { 60, 100, 150, 200 },
+        [](Config& c, double v) { c.cannyHigh = (int)v; }, [](const Config& c) { return (double)c.cannyHigh; } });
+    params.push_back({ "epsilonFactor", { 0.01, 0.015, 0.02, 0.03, 0.04 },
+        [](Config& c, double v) { c.epsilonFactor = v; }, [](const Config& c) { return c.epsilonFactor; } });
+    params.push_back({ "minArea", { 750, 1500, 3000, 6000 },
+        [](Config& c, double v) { c.minArea = (int)v; }, [](const Config& c) { return (double)c.minArea; } });
+    params.push_back({ "maxArea", { 150000, 300000, 500000 },
+        [](Config& c, double v) { c.maxArea = (int)v; }, [](const Config& c) { return (double)c.maxArea; } });
+    params.push_back({ "qualityThreshold", { 0, 40, 50, 60, 70 },
+        [](Config& c, double v) { c.qualityThreshold = (int)v; }, [](const Config& c) { return (double)c.qualityThreshold; } });
+    params.push_back({ "fastQualityEstimate", { 0, 1 },
+        [](Config& c, double v) { c.fastQualityEstimate = v != 0.0; }, [](const Config& c) { return c.fastQualityEstimate ? 1.0 : 0.0; } });
+    params.push_back({ "useColorDetection", { 0, 1 },
+        [](Config& c, double v) { c.useColorDetection = v != 0.0; }, [](const Config& c) { return c.useColorDetection ? 1.0 : 0.0; } });
+    params.push_back({ "paperMinValue", { 150, 180, 200 },
+        [](Config& c, double v) { c.paperMinValue = (int)v; }, [](const Config& c) { return (double)c.paperMinValue; } });
+    params.push_back({ "paperMaxSaturation", { 20, 30, 45 },
+        [](Config& c, double v) { c.paperMaxSaturation = (int)v; }, [](const Config& c) { return (double)c.paperMaxSaturation; } });
+    params.push_back({ "lightMinValue", { 120, 150, 170 },
+        [](Config& c, double v) { c.lightMinValue = (int)v; }, [](const Config& c) { return (double)c.lightMinValue; } });
+    params.push_back({ "lightMaxSaturation", { 40, 50, 70 },
+        [](Config& c, double v) { c.lightMaxSaturation = (int)v; }, [](const Config& c) { return (double)c.lightMaxSaturation; } });
+    params.push_back({ "detectionPyramidLevel", { 0, 1 },
+        [](Config& c, double v) { c.detectionPyramidLevel = (int)v; }, [](const Config& c) { return (double)c.detectionPyramidLevel; } });
+    params.push_back({ "detectorEngine", { 0, 1 },
+        [](Config& c, double v) { c.detectorEngine = v != 0.0 ? "lines" : "contour"; },
+        [](const Config& c) { return c.detectorEngine == "lines" ? 1.0 : 0.0; } });
+    return params;
+}
+
+static void printUsage() {
+    std::cout << "Usage: esp_doc_eval [-j N] [--samples N | --grid] [--seed N] [--param NAME=v1,v2,...]" << std::endl
+        << "                    [--iou T] [--native] [--csv FILE] DATASET" << std::endl
+        << "  DATASET  directory with annotations.csv, or the CSV itself" << std::endl
+        << "  Parameters:";
+    std::vector<Parameter> params = defaultParameters();
+    for (size_t i = 0; i < params.size(); i++) std::cout << (i % 4 == 0 ? "\n    " : " ") << params[i].name;
+    std::cout << std::endl;
+}
+
+static std::vector<std::string> splitCsv(const std::string& line) {
+    std::vector<std::string> fields;
+    std::stringstream ss(line);
+    std::string field;
+    while (std::getline(ss, field, ',')) {
+        size_t begin = field.find_first_not_of(" \t\r");
+        size_t end = field.find_last_not_of(" \t\r");
+        fields.push_back(begin == std::string::npos ? "" : field.substr(begin, end - begin + 1));
+    }
+    return fields;
+}
+
+// "name@123" -> frame 123 of video `name`
+static bool splitVideoFrame(const std::string& entry, std::string& path, int& frame) {
+    size_t at = entry.rfind('@');
+    if (at == std::string::npos || at + 1 >= entry.size()) return false;
+    for (size_t i = at + 1; i < entry.size(); i++) {
+        if (!std::isdigit((unsigned char)entry[i])) return false;
+    }
+    path = entry.substr(0, at);
+    frame = std::atoi(entry.c_str() + at + 1);
+    return true;
+}
+
+static bool loadDataset(const std::string& location, cv::Size captureSize, bool native, std::vector<LabeledFrame>& frames) {
+    fs::path csv = fs::is_directory(location) ? fs::path(location) / "annotations.csv" : fs::path(location);
+    std::ifstream in(csv);
+    if (!in) {
+        std::cerr << "Cannot open " << csv.string() << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        std::vector<std::string> fields = splitCsv(line);
+        if (fields.empty() || fields[0].empty() || fields[0][0] == '#') continue;
+        if (fields.size() != 1 && fields.size() != 9) {
+            std::cerr << csv.string() << ":" << lineNumber << ": expected a file name and 0 or 4 corners" << std::endl;
+            return false;
+        }
+
+        LabeledFrame frame;
+        frame.name = fields[0];
+        std::string videoPath;
+        int videoFrame = 0;
+        if (splitVideoFrame(fields[0], videoPath, videoFrame)) {
+            cv::VideoCapture video((csv.parent_path() / videoPath).string());
+            video.set(cv::CAP_PROP_POS_FRAMES, videoFrame);
+            video.read(frame.image);
+        }
+        else {
+            frame.image = cv::imread((csv.parent_path() / fields[0]).string());
+        }
+        if (frame.image.empty()) {
+            std::cerr << csv.string() << ":" << lineNumber << ": cannot read " << fields[0] << std::endl;
+            return false;
+        }
+        for (size_t i = 1; i + 1 < fields.size(); i += 2) {
+            frame.corners.push_back(cv::Point2f((float)std::atof(fields[i].c_str()), (float)std::atof(fields[i + 1].c_str())));
+        }
+
+        if (!native) {
+            // Fit the capture size; corners follow the pixel centers
+            double scale = std::min((double)captureSize.width / frame.image.cols, (double)captureSize.height / frame.image.rows);
+            if (scale != 1.0) {
+                cv::Mat scaled;
+                cv::resize(frame.image, scaled, cv::Size(), scale, scale, scale < 1.0 ? cv::INTER_AREA : cv::INTER_LINEAR);
+                frame.image = scaled;
+                for (size_t i = 0; i < frame.corners.size(); i++) {
+                    frame.corners[i].x = (float)((frame.corners[i].x + 0.5) * scale - 0.5);
+                    frame.corners[i].y = (float)((frame.corners[i].y + 0.5) * scale - 0.5);
+                }
+            }
+        }
+        frames.push_back(frame);
+    }
+    return !frames.empty();
+}
+
+static double quadIoU(const std::vector<cv::Point>& detected, const std::vector<cv::Point2f>& truth) {
+    std::vector<cv::Point2f> quad(detected.begin(), detected.end()), a, b, shared;
+    cv::convexHull(quad, a);
+    cv::convexHull(truth, b);
+    double overlap = cv::intersectConvexConvex(a, b, shared, true);
+    double both = cv::contourArea(a) + cv::contourArea(b) - overlap;
+    return both > 0.0 ? overlap / both : 0.0;
+}
+
+// Mean distance between matching corners, in % of the annotated diagonal
+static double cornerError(const std::vector<cv::Point>& detected, const std::vector<cv::Point2f>& truth) {
+    std::vector<cv::Point> truthPoints;
+    for (size_t i = 0; i < truth.size(); i++) truthPoints.push_back(cv::Point(cvRound(truth[i].x), cvRound(truth[i].y)));
+    cv::Point d[4], t[4];
+    orderQuadCorners(detected, d);
+    orderQuadCorners(truthPoints, t);
+
+    double sum = 0.0;
+    for (int i = 0; i < 4; i++) sum += cv::norm(d[i] - t[i]);
+    double diagonal = std::max(cv::norm(t[3] - t[0]), cv::norm(t[2] - t[1]));
+    return diagonal > 0.0 ? sum / 4.0 / diagonal * 100.0 : 0.0;
+}
+
+static EvalResult evaluate(const Config& config, const std::vector<LabeledFrame>& frames, double iouThreshold) {
+    std::unique_ptr<DetectorEngine> detector = createDetectorEngine(config);
+    WarpWorkspace warpWs;
+    warpWs.cache.setEpsilon(config.warpCacheEpsilon);
+    QualityWorkspace qualityWs;
+    std::vector<cv::Point> document;
+    cv::Mat combined;
+    std::vector<double> ms;
+    ms.reserve(frames.size());
+
+    EvalResult result = EvalResult();
+    double scoreSum = 0.0, iouSum = 0.0, cornerSum = 0.0;
+    int annotated = 0, correct = 0, falsePositives = 0;
+
+    detector->detect(frames[0].image, document, combined);  // size the workspaces untimed
+    for (size_t i = 0; i < frames.size(); i++) {
+        const LabeledFrame& frame = frames[i];
+        auto start = std::chrono::steady_clock::now();
+        detector->detect(frame.image, document, combined);
+        bool accepted = false;
+        if (document.size() == 4) {
+            // As DetectionStage scores it
+            QualityMetrics quality = QualityMetrics();
+            if (config.fastQualityEstimate) {
+                quality = assessQuadQuality(detector->frameGray(), document);
+            }
+            else {
+                cv::Mat warped = BalancedDocumentWarper::warpDocument(frame.image, document, warpWs, false);
+                if (!warped.empty()) quality = assessQuality(warped, qualityWs);
+            }
+            accepted = quality.overallScore >= config.qualityThreshold;
+        }
+        ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+        if (frame.corners.empty()) {
+            scoreSum += accepted ? 0.0 : 1.0;
+            if (accepted) falsePositives++;
+            continue;
+        }
+        annotated++;
+        if (!accepted) continue;
+        double iou = quadIoU(document, frame.corners);
+        scoreSum += iou;
+        iouSum += iou;
+        if (iou >= iouThreshold) {
+            correct++;
+            cornerSum += cornerError(document, frame.corners);
+        }
+        else {
+            falsePositives++;
+        }
+    }
+
+    std::sort(ms.begin(), ms.end());
+    result.score = scoreSum / frames.size();
+    result.detectRate = annotated > 0 ? (double)correct / annotated : 0.0;
+    result.falsePositiveRate = (double)falsePositives / frames.size();
+    result.meanIoU = annotated > 0 ? iouSum / annotated : 0.0;
+    result.cornerError = correct > 0 ? cornerSum / correct : 0.0;
+    result.medianMs = ms[ms.size() / 2];
+    result.p95Ms = ms[std::min(ms.size() - 1, (size_t)(ms.size() * 0.95))];
+    result.soloMedianMs = 0.0;
+    result.frontier = false;
+    return result;
+}
+
+static Config configFor(const std::vector<Parameter>& params, const std::vector<double>& values) {
+    Config config;
+    for (size_t i = 0; i < params.size(); i++) params[i].set(config, values[i]);
+    return config;
+}
+
+// Runs every candidate on `threads` threads; each thread owns its detector
+static void evaluateAll(const std::vector<Parameter>& params, const std::vector<LabeledFrame>& frames, double iouThreshold,
+    int threads, std::vector<EvalResult>& results) {
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> done(0);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&]() {
+            for (size_t i = next++; i < results.size(); i = next++) {
+                std::vector<double> values = results[i].values;
+                results[i] = evaluate(configFor(params, values), frames, iouThreshold);
+                results[i].values = values;
+                size_t finished = ++done;
+                if (finished % 25 == 0 || finished == results.size()) {
+                    std::cerr << "\r  " << finished << "/" << results.size() << std::flush;
+                }
+            }
+        });
+    }
+    for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+    std::cerr << std::endl;
+}
+
+// Marks results no other result beats on both score and median latency
+static void markFrontier(std::vector<EvalResult>& results) {
+    for (size_t i = 0; i < results.size(); i++) {
+        results[i].frontier = true;
+        for (size_t j = 0; j < results.size() && results[i].frontier; j++) {
+            const EvalResult& a = results[i];
+            const EvalResult& b = results[j];
+            bool noWorse = b.score >= a.score && b.medianMs <= a.medianMs;
+            bool better = b.score > a.score || b.medianMs < a.medianMs;
+            if (j != i && noWorse && better) results[i].frontier = false;
+        }
+    }
+}
+
+static std::string formatValue(double v) {
+    std::ostringstream oss;
+    oss << v;
+    return oss.str();
+}
+
+// The parameters that differ from the current Config
+static std::string describeChanges(const std::vector<Parameter>& params, const std::vector<double>& values) {
+    Config current;
+    std::string text;
+    for (size_t i = 0; i < params.size(); i++) {
+        if (values[i] == params[i].get(current)) continue;
+        text += std::string(text.empty() ? "" : " ") + params[i].name + "=" + formatValue(values[i]);
+    }
+    return text.empty() ? "(current Config)" : text;
+}
+
+static void printRow(const EvalResult& r, const std::string& label) {
+    std::cout << std::fixed << std::setprecision(3) << std::setw(7) << r.score
+        << std::setprecision(1) << std::setw(9) << r.detectRate * 100.0 << std::setw(7) << r.falsePositiveRate * 100.0
+        << std::setprecision(3) << std::setw(7) << r.meanIoU
+        << std::setprecision(2) << std::setw(9) << r.cornerError << std::setw(8) << r.medianMs << std::setw(8) << r.p95Ms
+        << std::setw(9) << r.soloMedianMs << "  " << label << std::endl;
+}
+
+static bool writeCsv(const std::string& path, const std::vector<Parameter>& params, const std::vector<EvalResult>& results) {
+    std::ofstream out(path);
+    if (!out) return false;
+    out << "score,detect_rate,false_positive_rate,mean_iou,corner_error_pct,median_ms,p95_ms,solo_median_ms,frontier";
+    for (size_t i = 0; i < params.size(); i++) out << "," << params[i].name;
+    out << "\n";
+    for (size_t r = 0; r < results.size(); r++) {
+        const EvalResult& e = results[r];
+        out << e.score << "," << e.detectRate << "," << e.falsePositiveRate << "," << e.meanIoU << ","
+            << e.cornerError << "," << e.medianMs << "," << e.p95Ms << "," << e.soloMedianMs << "," << (e.frontier ? 1 : 0);
+        for (size_t i = 0; i < e.values.size(); i++) out << "," << e.values[i];
+        out << "\n";
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::vector<Parameter> params = defaultParameters();
+    std::string dataset, csvPath;
+    int threads = (int)std::thread::hardware_concurrency();
+    int samples = 300;
+    bool grid = false;
+    bool native = false;
+    double iouThreshold = 0.9;
+    unsigned seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) threads = std::atoi(argv[++i]);
+        else if (arg == "--samples" && i + 1 < argc) samples = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--grid") grid = true;
+        else if (arg == "--seed" && i + 1 < argc) seed = (unsigned)std::atoi(argv[++i]);
+        else if (arg == "--iou" && i + 1 < argc) iouThreshold = std::atof(argv[++i]);
+        else if (arg == "--native") native = true;
+        else if (arg == "--csv" && i + 1 < argc) csvPath = argv[++i];
+        else if (arg == "--param" && i + 1 < argc) {
+            std::string spec = argv[++i];
+            size_t equals = spec.find('=');
+            bool known = false;
+            for (size_t p = 0; p < params.size() && equals != std::string::npos; p++) {
+                if (spec.compare(0, equals, params[p].name) != 0 || std::string(params[p].name).size() != equals) continue;
+                params[p].values.clear();
+                std::vector<std::string> values = splitCsv(spec.substr(equals + 1));
+                for (size_t v = 0; v < values.size(); v++) params[p].values.push_back(std::atof(values[v].c_str()));
+                known = !params[p].values.empty();
+            }
+            if (!known) {
+                std::cerr << "Bad --param " << spec << std::endl;
+                printUsage();
+                return 1;
+            }
+        }
+        else if (arg == "-h" || arg == "--help") {
+            printUsage();
+            return 0;
+        }
+        else dataset = arg;
+    }
+    if (dataset.empty()) {
+        printUsage();
+        return 1;
+    }
+    if (threads < 1) threads = 1;
+
+    Config current;
+    std::vector<LabeledFrame> frames;
+    if (!loadDataset(dataset, cv::Size(current.frameWidth, current.frameHeight), native, frames)) return 1;
+    size_t annotated = 0;
+    for (size_t i = 0; i < frames.size(); i++) annotated += frames[i].corners.empty() ? 0 : 1;
+    std::cout << "Dataset: " << frames.size() << " frames, " << annotated << " with a document" << std::endl;
+
+    // Candidates: the current Config, then the grid or random samples of it
+    std::set<std::vector<double> > seen;
+    std::vector<EvalResult> results;
+    auto addCandidate = [&](const std::vector<double>& values) {
+        Config c = configFor(params, values);
+        if (c.cannyLow >= c.cannyHigh || c.minArea >= c.maxArea || !seen.insert(values).second) return;
+        EvalResult r = EvalResult();
+        r.values = values;
+        results.push_back(r);
+    };
+    std::vector<double> currentValues;
+    for (size_t i = 0; i < params.size(); i++) currentValues.push_back(params[i].get(current));
+    addCandidate(currentValues);
+
+    if (grid) {
+        std::vector<size_t> digit(params.size(), 0);
+        while (true) {
+            std::vector<double> values;
+            for (size_t i = 0; i < params.size(); i++) values.push_back(params[i].values[digit[i]]);
+            addCandidate(values);
+            size_t i = 0;
+            while (i < params.size() && ++digit[i] == params[i].values.size()) digit[i++] = 0;
+            if (i == params.size()) break;
+        }
+    }
+    else {
+        std::mt19937 rng(seed);
+        for (int attempt = 0; (int)results.size() <= samples && attempt < samples * 20; attempt++) {
+            std::vector<double> values;
+            for (size_t i = 0; i < params.size(); i++) {
+                values.push_back(params[i].values[std::uniform_int_distribution<size_t>(0, params[i].values.size() - 1)(rng)]);
+            }
+            addCandidate(values);
+        }
+    }
+
+    std::cout << "Evaluating " << results.size() << " configurations on " << threads << " thread(s)..." << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    evaluateAll(params, frames, iouThreshold, threads, results);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Done in " << std::fixed << std::setprecision(1) << seconds << " s" << std::endl;
+
+    // One timing regime for the frontier: every candidate ran under the
+    // same parallel load. Parallel runs share caches and turbo budget, so
+    // the frontier and the current Config are also timed alone, reported
+    // separately and not used to pick the frontier.
+    markFrontier(results);
+    if (threads > 1) {
+        std::vector<EvalResult> solo;
+        for (size_t i = 0; i < results.size(); i++) {
+            if (results[i].frontier || i == 0) solo.push_back(results[i]);
+        }
+        evaluateAll(params, frames, iouThreshold, 1, solo);
+        size_t k = 0;
+        for (size_t i = 0; i < results.size(); i++) {
+            if (results[i].frontier || i == 0) results[i].soloMedianMs = solo[k++].medianMs;
+        }
+    }
+    else {
+        for (size_t i = 0; i < results.size(); i++) results[i].soloMedianMs = results[i].medianMs;
+    }
+
+    std::cout << "\n  score  detect%    FP%    IoU  corner%  med ms  p95 ms 1-thr ms  parameters" << std::endl;
+    printRow(results[0], "(current Config)");
+    std::vector<EvalResult> frontier;
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i].frontier) frontier.push_back(results[i]);
+    }
+    std::sort(frontier.begin(), frontier.end(), [](const EvalResult& a, const EvalResult& b) { return a.medianMs < b.medianMs; });
+    std::cout << "Pareto frontier (" << frontier.size() << " of " << results.size() << ", fastest first):" << std::endl;
+    for (size_t i = 0; i < frontier.size(); i++) printRow(frontier[i], describeChanges(params, frontier[i].values));
+
+    if (!csvPath.empty()) {
+        if (writeCsv(csvPath, params, results)) std::cout << "All results: " << csvPath << std::endl;
+        else std::cerr << "Cannot write " << csvPath << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,213 @@
+// Replays recorded frames as an MJPEG-over-HTTP stream on 127.0.0.1, the
+// way IP Webcam serves /video, so MjpegStreamSource and the scanner can be
+// exercised without a phone.
+//
+//   esp_doc_mjpeg_replay [--port N] [--fps N] [--once] [--no-length] [--check] INPUT
+//
+// INPUT is a directory of images (sorted by name; JPEG files are sent
+// byte for byte) or a video file. The stream is at http://127.0.0.1:PORT/video
+// and serves one client at a time. --no-length leaves out the part
+// Content-Length headers, as some cameras do. --check connects an
+// MjpegStreamSource to the replay, reads for a few seconds at the Config
+// capture size and reports frame rate, decode scale and the full-size
+// decode of the last frame; it exits non-zero if nothing arrived.
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/videoio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Config.hpp"
+#include "HttpServer.hpp"
+#include "MjpegStreamSource.hpp"
+
+namespace fs = std::filesystem;
+
+struct ReplayOptions {
+    std::string input;
+    int port = 8080;
+    double fps = 15.0;
+    bool loop = true;
+    bool contentLength = true;
+    bool check = false;
+    int maxVideoFrames = 600;           // video frames are held encoded in memory
+};
+
+typedef std::vector<std::shared_ptr<const std::vector<uchar> > > FrameList;
+
+static void printUsage() {
+    std::cout << "Usage: esp_doc_mjpeg_replay [--port N] [--fps N] [--once] [--no-length] [--check] INPUT" << std::endl;
+    std::cout << "  INPUT   image directory (JPEGs are sent unchanged) or video file" << std::endl;
+}
+
+static std::shared_ptr<const std::vector<uchar> > encodeFrame(const cv::Mat& img) {
+    std::shared_ptr<std::vector<uchar> > jpeg = std::make_shared<std::vector<uchar> >();
+    cv::imencode(".jpg", img, *jpeg, std::vector<int>{ cv::IMWRITE_JPEG_QUALITY, 90 });
+    return jpeg;
+}
+
+static std::shared_ptr<const std::vector<uchar> > readFileBytes(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::shared_ptr<std::vector<uchar> > bytes = std::make_shared<std::vector<uchar> >(
+        (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return bytes;
+}
+
+static bool loadFrames(const ReplayOptions& opts, FrameList& frames) {
+    std::error_code ec;
+    if (fs::is_directory(opts.input, ec)) {
+        std::vector<fs::path> files;
+        for (fs::directory_iterator it(opts.input, ec), end; it != end && !ec; it.increment(ec)) {
+            if (it->is_regular_file()) files.push_back(it->path());
+        }
+        std::sort(files.begin(), files.end());
+        for (size_t i = 0; i < files.size(); i++) {
+            std::string ext = files[i].extension().string();
+            std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+            if (ext == ".jpg" || ext == ".jpeg") {
+                frames.push_back(readFileBytes(files[i]));
+            }
+            else {
+                cv::Mat img = cv::imread(files[i].string());
+                if (!img.empty()) frames.push_back(encodeFrame(img));
+            }
+        }
+    }
+    else {
+        cv::VideoCapture video(opts.input);
+        cv::Mat frame;
+        while ((int)frames.size() < opts.maxVideoFrames && video.read(frame)) {
+            frames.push_back(encodeFrame(frame));
+        }
+    }
+    return !frames.empty();
+}
+
+// Streams the frames as multipart/x-mixed-replace until the client leaves
+static void serveStream(const FrameList& frames, const ReplayOptions& opts, const std::atomic<bool>& running, HttpResponder& out) {
+    const std::string boundary = "esp_doc_replay";
+    if (!out.send("HTTP/1.1 200 OK\r\nContent-Type: multipart/x-mixed-replace; boundary=" + boundary +
+            "\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n")) {
+        return;
+    }
+
+    const auto interval = std::chrono::duration<double>(1.0 / std::max(opts.fps, 0.1));
+    auto next = std::chrono::steady_clock::now();
+    size_t sent = 0;
+    while (running) {
+        const std::vector<uchar>& jpeg = *frames[sent % frames.size()];
+        std::string head = "--" + boundary + "\r\nContent-Type: image/jpeg\r\n";
+        if (opts.contentLength) head += "Content-Length: " + std::to_string(jpeg.size()) + "\r\n";
+        head += "\r\n";
+        if (!out.send(head) || !out.send((const char*)jpeg.data(), jpeg.size()) || !out.send("\r\n")) return;
+
+        sent++;
+        if (!opts.loop && sent == frames.size()) return;
+        next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval);
+        std::this_thread::sleep_until(next);
+    }
+}
+
+// Reads the replay through MjpegStreamSource, as the scanner would
+static int runCheck(const ReplayOptions& opts, const FrameList& frames) {
+    Config config;
+    cv::Size captureSize(config.frameWidth, config.frameHeight);
+    std::string url = "http://127.0.0.1:" + std::to_string(opts.port) + "/video";
+
+    MjpegStreamSource source;
+    if (!source.open(url, captureSize)) {
+        std::cerr << "No frame from " << url << std::endl;
+        return 1;
+    }
+
+    cv::Mat frame;
+    int read = 0;
+    double decodeMs = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < std::chrono::seconds(3)) {
+        if (!source.read(frame)) continue;
+        decodeMs += source.decodeMs();      // read() also waits for the next frame
+        read++;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    cv::Size full;
+    const std::vector<uchar>& first = *frames[0];
+    jpegDimensions(first.data(), first.size(), full);
+    std::cout << "Stream frames: " << full.width << "x" << full.height << ", capture size " << captureSize.width << "x" << captureSize.height << std::endl;
+    std::cout << "Received " << source.received() << ", decoded " << read << " (" << (int)(read / seconds) << " fps), "
+        << (read > 0 ? decodeMs / read : 0.0) << " ms/decode at 1/" << source.decodeFactor() << " -> "
+        << frame.cols << "x" << frame.rows << std::endl;
+
+    EncodedFrame original = source.original();
+    if (original.jpeg) {
+        cv::Mat encoded(1, (int)original.jpeg->size(), CV_8UC1, (void*)original.jpeg->data());
+        cv::Mat fullFrame = cv::imdecode(encoded, cv::IMREAD_COLOR);
+        std::cout << "Full-resolution decode for saving: " << fullFrame.cols << "x" << fullFrame.rows << std::endl;
+    }
+    else {
+        std::cout << "Frames are already at capture size; no full-resolution decode needed" << std::endl;
+    }
+    source.close();
+    return read > 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    ReplayOptions opts;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) opts.port = std::atoi(argv[++i]);
+        else if (arg == "--fps" && i + 1 < argc) opts.fps = std::atof(argv[++i]);
+        else if (arg == "--once") opts.loop = false;
+        else if (arg == "--no-length") opts.contentLength = false;
+        else if (arg == "--check") opts.check = true;
+        else if (arg == "-h" || arg == "--help") {
+            printUsage();
+            return 0;
+        }
+        else opts.input = arg;
+    }
+    if (opts.input.empty()) {
+        printUsage();
+        return 1;
+    }
+
+    FrameList frames;
+    if (!loadFrames(opts, frames)) {
+        std::cerr << "No frames in " << opts.input << std::endl;
+        return 1;
+    }
+
+    std::atomic<bool> running(true);
+    LocalHttpServer server;
+    bool started = server.start(opts.port, [&](const std::string& method, const std::string& path, HttpResponder& out) {
+        if (method == "GET" && (path == "/video" || path == "/")) serveStream(frames, opts, running, out);
+        else out.respond(404, "text/plain", "not found\n");
+    });
+    if (!started) {
+        std::cerr << "Could not listen on 127.0.0.1:" << opts.port << std::endl;
+        return 1;
+    }
+    std::cout << "Replaying " << frames.size() << " frame(s) at " << opts.fps << " fps on http://127.0.0.1:" << opts.port << "/video" << std::endl;
+
+    int status = 0;
+    if (opts.check) {
+        status = runCheck(opts, frames);
+    }
+    else {
+        while (true) std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    running = false;
+    server.stop();
+    return status;
+}
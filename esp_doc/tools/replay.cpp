@@ -0,0 +1,162 @@
+// Deterministic replay of a session recording (Config::recordPath). Every
+// recorded frame goes through the scanner's DetectionStage and
+// ScanStateMachine in order, with the recorded capture times as the clock,
+// so a recording and a Config always give the same event log, on any
+// machine and at any speed.
+//
+//   esp_doc_replay [--realtime] [--qos] [--events FILE] RECORDING
+//
+// One line per event, "<frame> <ms> DETECTED|LOST|SAVED <page>": frame is
+// the index in the recording, ms the capture time since its first frame,
+// and an early save of a stable page ends in "stable". A due page counts
+// as saved at once, as when the scanner's save queue accepts it. Without
+// --events the log goes to stdout and the timing summary to stderr.
+//
+// Frames are processed as fast as possible unless --realtime paces them at
+// the recorded frame times. Adaptive QoS reacts to measured frame times,
+// so it stays off unless --qos is given (the log is then no longer
+// reproducible).
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Config.hpp"
+#include "DetectionStage.hpp"
+#include "FrameRecorder.hpp"
+#include "ScanStateMachine.hpp"
+
+static void printUsage() {
+    std::cout << "Usage: esp_doc_replay [--realtime] [--qos] [--events FILE] RECORDING" << std::endl;
+}
+
+static const char* eventName(ScanEventType type) {
+    if (type == ScanEventType::Detected) return "DETECTED";
+    if (type == ScanEventType::Lost) return "LOST";
+    return "SAVED";
+}
+
+int main(int argc, char** argv) {
+    std::string recordingPath, eventsPath;
+    bool realtime = false;
+    bool qos = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--realtime") realtime = true;
+        else if (arg == "--qos") qos = true;
+        else if (arg == "--events" && i + 1 < argc) eventsPath = argv[++i];
+        else if (arg == "-h" || arg == "--help") {
+            printUsage();
+            return 0;
+        }
+        else recordingPath = arg;
+    }
+    if (recordingPath.empty()) {
+        printUsage();
+        return 1;
+    }
+
+    Config config;
+    config.adaptiveQos = qos;
+
+    RecordingSource source;
+    std::string error;
+    if (!source.open(recordingPath, realtime, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    const RecordingReader& recording = source.recording();
+    if (recording.truncated()) {
+        std::cerr << "Ignoring the incomplete end of " << recordingPath << " (recording was cut short)" << std::endl;
+    }
+
+    std::ofstream eventsFile;
+    std::ostream* log = &std::cout;
+    if (!eventsPath.empty()) {
+        eventsFile.open(eventsPath.c_str());
+        if (!eventsFile) {
+            std::cerr << "Cannot write " << eventsPath << std::endl;
+            return 1;
+        }
+        log = &eventsFile;
+    }
+    std::ostream& summary = eventsPath.empty() ? std::cerr : std::cout;
+    summary << "Replaying " << source.describe() << std::endl;
+
+    DetectionStage detection(config);
+    ScanStateMachine scanState(config);
+    FrameSlot slot;
+    std::vector<std::vector<cv::Point> > validDocuments;
+    std::vector<int> validScores;
+    std::vector<ScanEvent> events;
+    std::vector<double> frameMs;
+    frameMs.reserve(recording.frameCount());
+    int counts[3] = { 0, 0, 0 };            // detected, lost, saved
+    unsigned long long leftOut = 0;
+    const long long firstTime = recording.captureTime(0);
+
+    auto start = std::chrono::steady_clock::now();
+    while (source.read(slot.frame)) {
+        size_t index = source.frameIndex();
+        long long now = source.captureTime() - firstTime;
+        if (index > 0) leftOut += source.sequence() - recording.sequence(index - 1) - 1;
+
+        // As the capture stage hands it on
+        cv::flip(slot.frame, slot.frame, 1);
+        slot.captureTime = source.captureTime();
+        slot.sequence = index + 1;
+        slot.original = source.original();
+        slot.original.mirrored = true;
+
+        auto t0 = std::chrono::steady_clock::now();
+        detection.process(slot);
+        frameMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+
+        // The page timers, driven as SaveScheduler::update() drives them
+        validDocuments.clear();
+        validScores.clear();
+        for (size_t i = 0; i < slot.documents.size(); i++) {
+            if (slot.qualities[i].isGoodQuality) {
+                validDocuments.push_back(slot.documents[i]);
+                validScores.push_back(slot.qualities[i].overallScore);
+            }
+        }
+        events.clear();
+        scanState.update(now, validDocuments, validScores, !slot.skipped, events);
+
+        for (size_t i = 0; i < events.size(); i++) {
+            const ScanEvent& ev = events[i];
+            *log << index << " " << now << " " << eventName(ev.type) << " " << ev.id;
+            if (ev.type == ScanEventType::SaveDue && ev.early) *log << " stable";
+            *log << "\n";
+            counts[(int)ev.type]++;
+        }
+        for (size_t i = 0; i < events.size(); i++) {
+            if (events[i].type == ScanEventType::SaveDue) scanState.markSaved(events[i].id, now);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    log->flush();
+
+    std::sort(frameMs.begin(), frameMs.end());
+    double median = frameMs.empty() ? 0.0 : frameMs[frameMs.size() / 2];
+    double p99 = frameMs.empty() ? 0.0 : frameMs[std::min(frameMs.size() - 1, (size_t)(frameMs.size() * 0.99))];
+    double recorded = (recording.captureTime(recording.frameCount() - 1) - firstTime) / 1000.0;
+
+    summary << std::fixed << std::setprecision(1);
+    summary << "Replayed " << frameMs.size() << " frames (" << recorded << " s recorded) in " << seconds << " s, "
+        << (seconds > 0 ? frameMs.size() / seconds : 0.0) << " frames/s" << std::endl;
+    summary << std::setprecision(2) << "Detection: median " << median << " ms, p99 " << p99 << " ms per frame" << std::endl;
+    summary << "Events: " << counts[(int)ScanEventType::Detected] << " detected, " << counts[(int)ScanEventType::Lost]
+        << " lost, " << counts[(int)ScanEventType::SaveDue] << " saved" << std::endl;
+    if (leftOut > 0) {
+        summary << "The recorder left out " << leftOut << " captured frame(s); the live run saw them" << std::endl;
+    }
+    return 0;
+}